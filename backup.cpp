@@ -0,0 +1,1155 @@
+#include "backup.h"
+#include "streamcopy.h"
+#include "hash.h"
+
+static const char BYTE_PREFIXES[] = {'k', 'M', 'G', 'T', 'P', 'E'};
+
+std::mutex consoleMutex;
+
+std::string lastErrorMessage() {
+    DWORD errMsgId = GetLastError();
+    LPSTR msgBuf = nullptr;
+    size_t msgSize = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                                    nullptr, errMsgId, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                                    (LPSTR) &msgBuf, 0, nullptr);
+    std::string message(msgBuf, msgSize);
+    LocalFree(msgBuf);
+    return message;
+}
+
+// Monotonic, so intervals are immune to clock changes; only differences
+// between two calls are meaningful.
+int64_t getCurrentMsTime() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Creation time, or the last write time if that is earlier: copying a
+// card's files elsewhere resets the first but usually keeps the second.
+SYSTEMTIME getFileTime(HANDLE *file) {
+    FILETIME creationTime;
+    FILETIME writeTime;
+    SYSTEMTIME sysTime{};
+    if (!GetFileTime(*file, &creationTime, nullptr, &writeTime)
+            || !FileTimeToSystemTime(CompareFileTime(&writeTime, &creationTime) < 0 ? &writeTime : &creationTime,
+                                     &sysTime)) {
+        // Left zeroed, which the layout files under its unknown-date folder
+        return SYSTEMTIME{};
+    }
+    return sysTime;
+}
+
+enum LinkStatus {
+    LINK_DONE,
+    LINK_UNSUPPORTED,       // the destination cannot hold hard links
+    LINK_FAILED
+};
+
+// Hard links dstPath to existingPath. The link is made under the partial
+// name and renamed into place, so a changed file's previous copy is
+// replaced instead of making the link fail.
+static LinkStatus linkDuplicate(const std::string &dstPath, const std::string &existingPath, bool overwrite) {
+    std::string partialPath = dstPath + PARTIAL_FILE_SUFFIX;
+    DeleteFileA(partialPath.c_str());
+    if (!CreateHardLinkA(partialPath.c_str(), existingPath.c_str(), nullptr)) {
+        DWORD error = GetLastError();
+        return error == ERROR_NOT_SUPPORTED || error == ERROR_INVALID_FUNCTION ? LINK_UNSUPPORTED : LINK_FAILED;
+    }
+    if (!MoveFileExA(partialPath.c_str(), dstPath.c_str(), overwrite ? MOVEFILE_REPLACE_EXISTING : 0)) {
+        DeleteFileA(partialPath.c_str());
+        return LINK_FAILED;
+    }
+    return LINK_DONE;
+}
+
+// Works out where a job goes and links it if dedup finds the content
+// already stored. Returns true if the job still needs copying.
+//
+// Photos and videos are filed under the date in their header, which an
+// earlier run may have cached in the manifest if the file's size and write
+// time are the same; anything else, or a header without a date, falls back
+// to the file's own times.
+bool prepareCopy(const CopyJob *job, const std::string &srcPath, CopyContext *ctx, MediaDateReader *dates,
+                 std::string *dstPath, ContentHashes *hashes, CopyResult *result) {
+    StageStats *stats = &ctx->totals->stages;
+    LPCSTR lpcSrcPath = srcPath.c_str();
+    LPCSTR filename = job->src.name;
+    std::string_view relPath = std::string_view(srcPath).substr(ctx->srcRootLen);
+    result->sizeBytes.QuadPart = (LONGLONG) job->sizeBytes;
+    result->success = false;
+    result->deduplicated = false;
+    result->packed = false;
+    result->compressed = false;
+    result->checksummed = false;
+    result->dateTaken = 0;
+    *hashes = ContentHashes{};
+
+    uint64_t dateTaken = ctx->manifest->dateTaken(relPath, job->sizeBytes, job->mtime);
+    SYSTEMTIME time{};
+    if (dateTaken == 0) {
+        HANDLE srcFile;
+        {
+            StageTimer timer(stats, STAGE_FILE_TIME);
+            srcFile = CreateFileA(lpcSrcPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (srcFile != INVALID_HANDLE_VALUE) {
+                time = getFileTime(&srcFile);
+            }
+        }
+        // Deleted or renamed since the walk, which followed folders make
+        // routine; the job is skipped
+        if (srcFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        if (dates != nullptr && hasMediaExtension(filename)) {
+            StageTimer timer(stats, STAGE_MEDIA_DATE);
+            dateTaken = dates->fromFile(srcFile, job->sizeBytes);
+        }
+        CloseHandle(srcFile);
+    }
+    if (dateTaken != 0) {
+        FILETIME fileTime{(DWORD) dateTaken, (DWORD) (dateTaken >> 32)};
+        FileTimeToSystemTime(&fileTime, &time);
+    }
+    result->dateTaken = dateTaken;
+
+    {
+        StageTimer timer(stats, STAGE_DIRECTORY);
+        ctx->layout->buildPath(time.wYear, time.wMonth, filename, dstPath);
+    }
+
+    // Copies are only renamed into place once complete, so an existing
+    // destination is either a different file with the same name, which is
+    // left alone, or one an interrupted run finished but never journaled.
+    if (!job->overwrite) {
+        WIN32_FILE_ATTRIBUTE_DATA existing;
+        if (GetFileAttributesExA(dstPath->c_str(), GetFileExInfoStandard, &existing)) {
+            uint64_t existingSize = ((uint64_t) existing.nFileSizeHigh << 32) | existing.nFileSizeLow;
+            result->success = job->resumed && existingSize == job->sizeBytes;
+            return false;
+        }
+    }
+
+    // Content already stored elsewhere in the destination is hard linked,
+    // or just logged if the destination cannot hold links. Anything else
+    // that stops the link leaves the file to be copied. Files small enough
+    // to pack skip dedup: a link costs about as much as a pack entry.
+    if (ctx->dedup == nullptr || (ctx->pack != nullptr && ctx->pack->accepts(job->sizeBytes))) {
+        return true;
+    }
+    std::string existingPath;
+    bool duplicate;
+    {
+        StageTimer timer(stats, STAGE_DEDUP, job->sizeBytes);
+        duplicate = ctx->dedup->findDuplicate(srcPath, job->sizeBytes, hashes, &existingPath);
+    }
+    if (!duplicate || existingPath == *dstPath) {
+        return true;
+    }
+    LinkStatus linked;
+    {
+        int64_t waitStartTime = getCurrentNsTime();
+        WriteSlot slot(ctx->scheduler);
+        stats->record(STAGE_WRITE_WAIT, getCurrentNsTime() - waitStartTime);
+        if (job->overwrite) {
+            ctx->dedup->invalidate(*dstPath);
+        }
+        linked = linkDuplicate(*dstPath, existingPath, job->overwrite);
+    }
+    if (linked == LINK_DONE) {
+        ctx->dedup->add(job->sizeBytes, *dstPath, *hashes);
+    }
+    // An alias cannot stand in for a changed file, whose old copy would
+    // stay at the destination
+    if (linked == LINK_UNSUPPORTED && !job->overwrite) {
+        ctx->dedup->recordAlias(*dstPath, existingPath);
+        linked = LINK_DONE;
+    }
+    if (linked != LINK_DONE) {
+        return true;
+    }
+    result->success = true;
+    result->deduplicated = true;
+    return false;
+}
+
+// Reads a small file whole and appends it to its month's pack segment. On
+// success the job's destination path becomes its "<segment>@<offset>"
+// location, which is what the manifest and journal record.
+static void packFile(const CopyJob *job, CopyBatch *batch, size_t i, CopyContext *ctx) {
+    StageStats *stats = &ctx->totals->stages;
+    int64_t startTime = getCurrentNsTime();
+    HANDLE srcFile = CreateFileA(batch->srcPaths[i].c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (srcFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    batch->packBuffer.resize((size_t) job->sizeBytes);
+    DWORD bytesRead = 0;
+    bool readOk = ReadFile(srcFile, batch->packBuffer.data(), (DWORD) job->sizeBytes, &bytesRead, nullptr)
+            && bytesRead == job->sizeBytes;
+    CloseHandle(srcFile);
+    if (!readOk) {
+        return;
+    }
+    uint64_t checksum = xxh64(batch->packBuffer.data(), bytesRead);
+
+    std::string location;
+    PackStatus status;
+    {
+        int64_t waitStartTime = getCurrentNsTime();
+        WriteSlot slot(ctx->scheduler);
+        stats->record(STAGE_WRITE_WAIT, getCurrentNsTime() - waitStartTime);
+        status = ctx->pack->add(batch->dstPaths[i], batch->packBuffer.data(), bytesRead, job->mtime,
+                                job->overwrite, job->resumed, &location);
+    }
+    if (status == PACK_ADDED) {
+        int64_t elapsedNs = getCurrentNsTime() - startTime;
+        stats->record(STAGE_COPY, elapsedNs, job->sizeBytes);
+        stats->recordFileLatency(job->sizeBytes, elapsedNs);
+        batch->results[i].success = true;
+        batch->results[i].packed = true;
+        batch->results[i].checksummed = true;
+        batch->results[i].storedBytes = bytesRead;
+        batch->results[i].checksum = checksum;
+        batch->dstPaths[i] = std::move(location);
+    }
+}
+
+// Compresses a file into "<destination>.bdz". Returns false, leaving the
+// job to the backend, when the file's sample block does not compress.
+static bool compressJob(const CopyJob *job, CopyBatch *batch, size_t i, CopyContext *ctx) {
+    std::string compressedPath = batch->dstPaths[i] + COMPRESSED_FILE_SUFFIX;
+    if (!job->overwrite && GetFileAttributesA(compressedPath.c_str()) != INVALID_FILE_ATTRIBUTES) {
+        batch->results[i].success = job->resumed;
+        return true;
+    }
+    StageStats *stats = &ctx->totals->stages;
+    int64_t startTime = getCurrentNsTime();
+    std::string *partialPath = &batch->partialPaths[i];
+    partialPath->assign(compressedPath).append(PARTIAL_FILE_SUFFIX);
+    uint64_t storedBytes = 0;
+    uint64_t checksum = 0;
+    CompressStatus status = ctx->compressor->compressFile(batch->srcPaths[i], *partialPath, compressedPath,
+                                                          job->overwrite, ctx->scheduler, &storedBytes, &checksum);
+    if (status == COMPRESS_SKIPPED) {
+        return false;
+    }
+    if (status == COMPRESS_DONE) {
+        int64_t elapsedNs = getCurrentNsTime() - startTime;
+        stats->record(STAGE_COMPRESS, elapsedNs, job->sizeBytes);
+        stats->recordFileLatency(job->sizeBytes, elapsedNs);
+        ctx->totals->compressedStoredBytes.fetch_add(storedBytes, std::memory_order_relaxed);
+        batch->results[i].success = true;
+        batch->results[i].compressed = true;
+        batch->results[i].checksummed = true;
+        batch->results[i].storedBytes = storedBytes;
+        batch->results[i].checksum = checksum;
+        batch->dstPaths[i] = std::move(compressedPath);
+    }
+    return true;
+}
+
+// Copies every job in the batch. Whatever dedup does not resolve goes to
+// the backend in one call, so backends that overlap files can keep the
+// whole batch in flight under a single write slot.
+void copyFiles(CopyBatch *batch, CopyContext *ctx) {
+    size_t numJobs = batch->jobs.size();
+    if (batch->dstPaths.size() < numJobs) {
+        batch->srcPaths.resize(numJobs);
+        batch->dstPaths.resize(numJobs);
+        batch->partialPaths.resize(numJobs);
+    }
+    batch->results.resize(numJobs);
+    batch->hashes.resize(numJobs);
+    batch->requests.clear();
+    batch->requestJobs.clear();
+    for (size_t i = 0; i < numJobs; i++) {
+        const CopyJob *job = &batch->jobs[i];
+        PathStore::fullPath(job->src, &batch->srcPaths[i]);
+        if (prepareCopy(job, batch->srcPaths[i], ctx, &batch->dates, &batch->dstPaths[i], &batch->hashes[i],
+                        &batch->results[i])) {
+            // Packed and compressed files are not plain copies, so they
+            // are left out of the dedup index
+            if (ctx->pack != nullptr && ctx->pack->accepts(job->sizeBytes)) {
+                packFile(job, batch, i, ctx);
+                continue;
+            }
+            if (ctx->compressor != nullptr && ctx->compressor->accepts(job->sizeBytes)
+                    && compressJob(job, batch, i, ctx)) {
+                continue;
+            }
+            // The backend writes a partial file, replacing any an
+            // interrupted run left behind
+            std::string *partialPath = &batch->partialPaths[i];
+            partialPath->assign(batch->dstPaths[i]).append(PARTIAL_FILE_SUFFIX);
+            batch->requests.push_back(CopyRequest{batch->srcPaths[i].c_str(), partialPath->c_str(),
+                                                  job->sizeBytes, true, ctx->checksums, false, 0, 0});
+            batch->requestJobs.push_back(i);
+        }
+    }
+    if (batch->requests.empty()) {
+        return;
+    }
+
+    StageStats *stats = &ctx->totals->stages;
+    {
+        int64_t waitStartTime = getCurrentNsTime();
+        WriteSlot slot(ctx->scheduler);
+        int64_t copyStartTime = getCurrentNsTime();
+        ctx->backend->copyBatch(batch->requests.data(), batch->requests.size());
+        int64_t copyEndTime = getCurrentNsTime();
+        stats->record(STAGE_WRITE_WAIT, copyStartTime - waitStartTime);
+        int64_t batchBytes = 0;
+        for (const CopyRequest &request : batch->requests) {
+            batchBytes += request.sizeBytes;
+        }
+        stats->record(STAGE_COPY, copyEndTime - copyStartTime, batchBytes, (int64_t) batch->requests.size());
+    }
+    for (size_t r = 0; r < batch->requests.size(); r++) {
+        size_t i = batch->requestJobs[r];
+        bool success = batch->requests[r].success;
+        // Changed files replace their previous copy, anything else already
+        // at the destination is left alone. The previous copy's index entry
+        // goes first, so nothing is linked to it once it holds other bytes.
+        if (success && batch->jobs[i].overwrite && ctx->dedup != nullptr) {
+            ctx->dedup->invalidate(batch->dstPaths[i]);
+        }
+        if (success && !MoveFileExA(batch->partialPaths[i].c_str(), batch->dstPaths[i].c_str(),
+                                    batch->jobs[i].overwrite ? MOVEFILE_REPLACE_EXISTING : 0)) {
+            success = false;
+        }
+        if (!success) {
+            DeleteFileA(batch->partialPaths[i].c_str());
+        }
+        batch->results[i].success = success;
+        if (success) {
+            batch->results[i].checksummed = ctx->checksums;
+            batch->results[i].storedBytes = batch->requests[r].sizeBytes;
+            batch->results[i].checksum = batch->requests[r].checksum;
+            stats->recordFileLatency(batch->requests[r].sizeBytes, batch->requests[r].elapsedNs);
+            if (ctx->dedup != nullptr) {
+                ctx->dedup->add(batch->jobs[i].sizeBytes, batch->dstPaths[i], batch->hashes[i]);
+            }
+        }
+    }
+}
+
+// Consumer side of the drive backup pipeline: copies queued files, as many
+// at a time as the backend takes, until the walker closes the queue.
+void copyWorker(BoundedQueue<CopyJob> *queue, CopyContext *ctx) {
+    CopyBatch batch;
+    for (;;) {
+        // Taken before popping, so parked workers do not sit on queued files
+        ConcurrencySlot slot(ctx->concurrency);
+        if (!queue->popBatch(&batch.jobs, ctx->backend->batchSize())) {
+            break;
+        }
+        slot.restartTimer();
+        copyFiles(&batch, ctx);
+        for (size_t i = 0; i < batch.jobs.size(); i++) {
+            const CopyJob &job = batch.jobs[i];
+            const CopyResult &result = batch.results[i];
+            if (result.deduplicated) {
+                ctx->totals->dedupBytes.fetch_add(result.sizeBytes.QuadPart, std::memory_order_relaxed);
+                ctx->totals->dedupFiles.fetch_add(1, std::memory_order_relaxed);
+            } else if (result.success) {
+                ctx->totals->copiedBytes.fetch_add(result.sizeBytes.QuadPart, std::memory_order_relaxed);
+                ctx->totals->copiedFiles.fetch_add(1, std::memory_order_relaxed);
+                if (result.packed) {
+                    ctx->totals->packedBytes.fetch_add(result.sizeBytes.QuadPart, std::memory_order_relaxed);
+                    ctx->totals->packedFiles.fetch_add(1, std::memory_order_relaxed);
+                } else if (result.compressed) {
+                    ctx->totals->compressedBytes.fetch_add(result.sizeBytes.QuadPart, std::memory_order_relaxed);
+                    ctx->totals->compressedFiles.fetch_add(1, std::memory_order_relaxed);
+                }
+            } else {
+                ctx->totals->skippedBytes.fetch_add(result.sizeBytes.QuadPart, std::memory_order_relaxed);
+                ctx->totals->skippedFiles.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            std::string_view relPath = std::string_view(batch.srcPaths[i]).substr(ctx->srcRootLen);
+            ctx->manifest->record(relPath, job.sizeBytes, job.mtime, batch.dstPaths[i], result.dateTaken);
+            if (ctx->journal != nullptr) {
+                ctx->journal->complete(relPath, job.sizeBytes, job.mtime, batch.dstPaths[i], result.dateTaken);
+            }
+            if (result.checksummed) {
+                ctx->catalog->add(batch.dstPaths[i], result.storedBytes, result.checksum);
+            }
+        }
+    }
+}
+
+// Applies the drive filter to a device object using its original file name,
+// converted into a stack buffer so no allocation happens per object.
+bool wpdObjectMatches(const WPDObjectTable *objects, size_t index, const FileFilter *filter) {
+    const WPDObjectRecord &record = objects->At(index);
+    if (record.contentType == WPD_CONTENT_TYPE_FOLDER
+            || record.contentType == WPD_CONTENT_TYPE_FUNCTIONAL_OBJECT) {
+        return false;
+    }
+    char name[MAX_PATH * 4];
+    std::wstring_view wideName = objects->Name(index);
+    int nameLen = WideCharToMultiByte(CP_UTF8, 0, wideName.data(), (int) wideName.size(),
+                                      name, sizeof(name), nullptr, nullptr);
+    uint64_t mtime = record.dateModified != 0 ? record.dateModified : record.dateCreated;
+    return nameLen > 0 && filter->matches(std::string_view(name, nameLen), record.sizeBytes, mtime);
+}
+
+// Device object names are wide; only the extension is narrowed, on the stack
+static bool wpdHasMediaExtension(std::wstring_view name) {
+    size_t dot = name.find_last_of(L'.');
+    if (dot == std::wstring_view::npos || name.size() - dot > 8) {
+        return false;
+    }
+    char ext[8];
+    size_t extLen = 0;
+    for (size_t i = dot; i < name.size(); i++) {
+        ext[extLen++] = name[i] < 0x80 ? (char) name[i] : '?';
+    }
+    return hasMediaExtension(std::string_view(ext, extLen));
+}
+
+// Objects are keyed by persistent unique ID, which survives renames and
+// reconnects, falling back to the session object ID. The key is converted
+// into the caller's buffer.
+std::string_view wpdObjectKey(const WPDObjectTable *objects, size_t index, char *key, size_t keySize) {
+    std::wstring_view wideKey = objects->PersistentId(index);
+    if (wideKey.empty()) {
+        wideKey = objects->ObjectId(index);
+    }
+    int keyLen = WideCharToMultiByte(CP_UTF8, 0, wideKey.data(), (int) wideKey.size(),
+                                     key, (int) keySize, nullptr, nullptr);
+    return std::string_view(key, keyLen > 0 ? keyLen : 0);
+}
+
+std::string bytesHumanReadable(int64_t numBytes) {
+    if (-1000 < numBytes && numBytes < 1000) {
+        return std::to_string(numBytes) + " B";
+    }
+    size_t idx = 0;
+    while (numBytes <= -999950 || numBytes >= 999950) {
+        numBytes /= 1000;
+        idx++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.2f %cB", numBytes / 1000.0, BYTE_PREFIXES[idx]);
+    return std::string(buf);
+}
+
+// Prints the end-of-run totals in the same format for drives, devices and
+// the whole session. Callers hold consoleMutex.
+void printSummary(const std::string &label, const CopyTotals *totals, double elapsedTime, UINT numWorkers,
+                  bool dedupEnabled) {
+    int64_t copiedBytes = totals->copiedBytes.load();
+    int64_t skippedBytes = totals->skippedBytes.load();
+    int64_t copiedFiles = totals->copiedFiles.load();
+    std::cout << label << ": " << bytesHumanReadable(copiedBytes)
+        << " copied in " << elapsedTime << " seconds ("
+        << bytesHumanReadable(copiedBytes / elapsedTime) << "/s, "
+        << copiedFiles / elapsedTime << " files/s) with "
+        << bytesHumanReadable(skippedBytes) << " skipped ("
+        << totals->skippedFiles.load() << " files) using "
+        << numWorkers << " workers." << std::endl;
+    std::cout << label << ": " << totals->newFiles.load() << " new, " << totals->changedFiles.load() << " changed, "
+        << totals->unchangedFiles.load() << " unchanged files ("
+        << bytesHumanReadable(totals->unchangedBytes.load()) << " not re-read)." << std::endl;
+    if (totals->packedFiles.load() > 0) {
+        std::cout << label << ": " << bytesHumanReadable(totals->packedBytes.load()) << " ("
+            << totals->packedFiles.load() << " small files) packed into segments." << std::endl;
+    }
+    if (totals->compressedFiles.load() > 0) {
+        std::cout << label << ": " << bytesHumanReadable(totals->compressedBytes.load()) << " ("
+            << totals->compressedFiles.load() << " files) compressed to "
+            << bytesHumanReadable(totals->compressedStoredBytes.load()) << "." << std::endl;
+    }
+    if (totals->resumedFiles.load() > 0) {
+        std::cout << label << ": " << bytesHumanReadable(totals->resumedBytes.load()) << " ("
+            << totals->resumedFiles.load() << " files) already copied by an interrupted run." << std::endl;
+    }
+    if (dedupEnabled) {
+        std::cout << label << ": " << bytesHumanReadable(totals->dedupBytes.load()) << " saved by dedup ("
+            << totals->dedupFiles.load() << " duplicate files)." << std::endl;
+    }
+}
+
+void addTotals(CopyTotals *sum, const CopyTotals *totals) {
+    sum->copiedBytes += totals->copiedBytes.load();
+    sum->skippedBytes += totals->skippedBytes.load();
+    sum->copiedFiles += totals->copiedFiles.load();
+    sum->skippedFiles += totals->skippedFiles.load();
+    sum->newFiles += totals->newFiles.load();
+    sum->changedFiles += totals->changedFiles.load();
+    sum->unchangedFiles += totals->unchangedFiles.load();
+    sum->unchangedBytes += totals->unchangedBytes.load();
+    sum->dedupFiles += totals->dedupFiles.load();
+    sum->dedupBytes += totals->dedupBytes.load();
+    sum->resumedFiles += totals->resumedFiles.load();
+    sum->resumedBytes += totals->resumedBytes.load();
+    sum->packedFiles += totals->packedFiles.load();
+    sum->packedBytes += totals->packedBytes.load();
+    sum->compressedFiles += totals->compressedFiles.load();
+    sum->compressedBytes += totals->compressedBytes.load();
+    sum->compressedStoredBytes += totals->compressedStoredBytes.load();
+    sum->plannedFiles += totals->plannedFiles.load();
+    sum->plannedBytes += totals->plannedBytes.load();
+    sum->stages.add(&totals->stages);
+}
+
+// Adds a transferred object to the dedup index, swapping the new copy for a
+// hard link if the same content is already stored. Returns true if it was
+// linked. The engine hashed the whole object on the way, so a size match
+// only reads back the sampled blocks of the new copy.
+static bool dedupTransferred(DeviceContext *ctx, const std::string &dstPath, uint64_t sizeBytes,
+                             uint64_t checksum) {
+    StageStats *stats = &ctx->totals->stages;
+    ContentHashes hashes{0, checksum, HASH_HAS_FULL};
+    if (sizeBytes <= 2 * DEDUP_SAMPLE_BLOCK) {
+        hashes.sample = checksum;
+        hashes.flags |= HASH_HAS_SAMPLE;
+    }
+    std::string existingPath;
+    bool duplicate;
+    {
+        StageTimer timer(stats, STAGE_DEDUP, sizeBytes);
+        duplicate = ctx->dedup->findDuplicate(dstPath, sizeBytes, &hashes, &existingPath);
+    }
+    if (duplicate && existingPath == dstPath) {
+        return false;
+    }
+    bool linked = false;
+    if (duplicate) {
+        int64_t waitStartTime = getCurrentNsTime();
+        WriteSlot slot(ctx->scheduler);
+        stats->record(STAGE_WRITE_WAIT, getCurrentNsTime() - waitStartTime);
+        linked = linkDuplicate(dstPath, existingPath, true) == LINK_DONE;
+    }
+    // Linked or not, dstPath now holds this content
+    ctx->dedup->add(sizeBytes, dstPath, hashes);
+    return linked;
+}
+
+// Transfer worker for device backups. Each worker has its own resources
+// interface and copy engine, so several objects stream at once.
+void deviceWorker(DeviceContext *ctx) {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    CComPtr<IPortableDeviceContent>   pContent;
+    CComPtr<IPortableDeviceResources> pResources;
+    HRESULT hr = ctx->device->Content(&pContent);
+    if (SUCCEEDED(hr)) {
+        hr = pContent->Transfer(&pResources);
+    }
+    if (FAILED(hr)) {
+        printf("! Failed to get IPortableDeviceResources for transfer worker, hr = 0x%lx\n", hr);
+    }
+
+    StageStats *stats = &ctx->totals->stages;
+    TransferCounters counters;
+    StreamCopyEngine engine(&counters);
+    std::wstring dstPath;
+    std::string narrowDstPath;
+    std::vector<BYTE> packBuffer;
+    std::vector<BYTE> header(MEDIA_DATE_WINDOW);
+    MediaDateReader dates;
+    char key[MAX_PATH * 4];
+    while (SUCCEEDED(hr)) {
+        ConcurrencySlot slot(ctx->concurrency);
+        size_t i = ctx->next.fetch_add(1);
+        if (i >= ctx->pending.size()) {
+            break;
+        }
+        size_t index = ctx->pending[i];
+        const WPDObjectRecord &record = ctx->objects->At(index);
+        std::string_view keyView = wpdObjectKey(ctx->objects, index, key, sizeof(key));
+
+        // Small objects are read into memory and packed, so only the pack
+        // append holds a write slot, and their date comes from that copy
+        ULONGLONG cbWritten = 0;
+        uint64_t checksum = 0;
+        HRESULT hrTransfer = S_OK;
+        int64_t transferTime = 0;
+        bool packed = ctx->pack != nullptr && ctx->pack->accepts(record.sizeBytes);
+        if (packed) {
+            int64_t transferStartTime = getCurrentNsTime();
+            hrTransfer = TransferObjectToMemory(pResources, ctx->objects->ObjectIdCStr(index), &engine, &packBuffer);
+            transferTime = getCurrentNsTime() - transferStartTime;
+        }
+
+        // File under the header date, like prepareCopy() does for drives,
+        // falling back to the object's creation date
+        std::wstring_view name = ctx->objects->Name(index);
+        uint64_t dateTaken = ctx->manifest->dateTaken(keyView, record.sizeBytes, record.dateModified);
+        if (dateTaken == 0 && SUCCEEDED(hrTransfer) && wpdHasMediaExtension(name)) {
+            StageTimer timer(stats, STAGE_MEDIA_DATE);
+            ULONG cbRead = 0;
+            if (packed) {
+                dateTaken = dates.fromBuffer(packBuffer.data(), packBuffer.size());
+            } else if (SUCCEEDED(ReadObjectHeader(pResources, ctx->objects->ObjectIdCStr(index), header.data(),
+                                                  (ULONG) header.size(), &cbRead))) {
+                dateTaken = dates.fromBuffer(header.data(), cbRead);
+            }
+        }
+        ULONGLONG date = dateTaken;
+        if (date == 0) {
+            date = record.dateCreated != 0 ? record.dateCreated : record.dateModified;
+        }
+        FILETIME fileTime;
+        if (date != 0) {
+            fileTime.dwLowDateTime = (DWORD) date;
+            fileTime.dwHighDateTime = (DWORD) (date >> 32);
+        } else {
+            GetSystemTimeAsFileTime(&fileTime);
+        }
+        SYSTEMTIME time{};
+        FileTimeToSystemTime(&fileTime, &time);
+        int64_t dirStartTime = getCurrentNsTime();
+        const std::string &dir = ctx->layout->monthDir(time.wYear, time.wMonth);
+        stats->record(STAGE_DIRECTORY, getCurrentNsTime() - dirStartTime);
+
+        int dirLen = MultiByteToWideChar(CP_ACP, 0, dir.c_str(), (int) dir.size(), nullptr, 0);
+        dstPath.resize(dirLen);
+        MultiByteToWideChar(CP_ACP, 0, dir.c_str(), (int) dir.size(), &dstPath[0], dirLen);
+        if (name.empty()) {
+            dstPath.append(ctx->objects->ObjectId(index)).append(L".data");
+        } else {
+            dstPath.append(name);
+        }
+
+        int pathLen = WideCharToMultiByte(CP_ACP, 0, dstPath.c_str(), (int) dstPath.size(),
+                                          nullptr, 0, nullptr, nullptr);
+        narrowDstPath.resize(pathLen);
+        WideCharToMultiByte(CP_ACP, 0, dstPath.c_str(), (int) dstPath.size(),
+                            &narrowDstPath[0], pathLen, nullptr, nullptr);
+
+        if (packed && SUCCEEDED(hrTransfer)) {
+            cbWritten = packBuffer.size();
+            checksum = xxh64(packBuffer.data(), packBuffer.size());
+            std::string location;
+            int64_t waitStartTime = getCurrentNsTime();
+            WriteSlot slot(ctx->scheduler);
+            stats->record(STAGE_WRITE_WAIT, getCurrentNsTime() - waitStartTime);
+            PackStatus status = ctx->pack->add(narrowDstPath, packBuffer.data(), packBuffer.size(),
+                                               record.dateModified, ctx->changed[i], false, &location);
+            if (status == PACK_ADDED) {
+                narrowDstPath = std::move(location);
+            } else {
+                hrTransfer = status == PACK_EXISTS ? HRESULT_FROM_WIN32(ERROR_FILE_EXISTS) : E_FAIL;
+            }
+        } else if (!packed) {
+            // A changed object's previous copy is about to be replaced
+            if (ctx->changed[i] && ctx->dedup != nullptr) {
+                ctx->dedup->invalidate(narrowDstPath);
+            }
+            int64_t waitStartTime = getCurrentNsTime();
+            WriteSlot slot(ctx->scheduler);
+            int64_t transferStartTime = getCurrentNsTime();
+            hrTransfer = TransferObjectToFile(pResources, ctx->objects->ObjectIdCStr(index), dstPath.c_str(),
+                                              ctx->changed[i], &engine, &cbWritten, &checksum);
+            transferTime = getCurrentNsTime() - transferStartTime;
+            stats->record(STAGE_WRITE_WAIT, transferStartTime - waitStartTime);
+        }
+        stats->record(STAGE_WPD_TRANSFER, transferTime, cbWritten);
+        if (SUCCEEDED(hrTransfer)) {
+            stats->recordFileLatency(cbWritten, transferTime);
+            ctx->transferredBytes.fetch_add(cbWritten, std::memory_order_relaxed);
+            ctx->transferredFiles.fetch_add(1, std::memory_order_relaxed);
+            // Packed objects live inside segments, which cannot be linked
+            if (!packed && ctx->dedup != nullptr && dedupTransferred(ctx, narrowDstPath, cbWritten, checksum)) {
+                ctx->totals->dedupBytes.fetch_add(cbWritten, std::memory_order_relaxed);
+                ctx->totals->dedupFiles.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                ctx->totals->copiedBytes.fetch_add(cbWritten, std::memory_order_relaxed);
+                ctx->totals->copiedFiles.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (packed) {
+                ctx->totals->packedBytes.fetch_add(cbWritten, std::memory_order_relaxed);
+                ctx->totals->packedFiles.fetch_add(1, std::memory_order_relaxed);
+            }
+            ctx->manifest->record(keyView, record.sizeBytes, record.dateModified, narrowDstPath, dateTaken);
+            ctx->journal->complete(keyView, record.sizeBytes, record.dateModified, narrowDstPath, dateTaken);
+            ctx->catalog->add(narrowDstPath, cbWritten, checksum);
+        } else {
+            ctx->totals->skippedBytes.fetch_add(record.sizeBytes, std::memory_order_relaxed);
+            ctx->totals->skippedFiles.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (SUCCEEDED(hrInit)) {
+        CoUninitialize();
+    }
+}
+
+// Backs up every object on a portable device that matches the filter into
+// <base>\<device name>\<year>\<MONTH>, with numWorkers transfers in flight.
+void backupDevice(IPortableDevice *device, const std::string &deviceName, const std::string &baseDstPath,
+                  const FileFilter *filter, UINT numWorkers, bool adaptive, uint64_t packThreshold,
+                  ContentIndex *dedup, WriteScheduler *scheduler, CopyTotals *totals) {
+    StageStats *stats = &totals->stages;
+    WPDObjectTree tree;
+    int64_t enumStartTime = getCurrentNsTime();
+    GetAllContent(device, &tree);
+    int64_t enumNs = getCurrentNsTime() - enumStartTime;
+    stats->record(STAGE_WPD_ENUMERATE, enumNs, 0, (int64_t) tree.Size() - 1);
+    double enumTime = enumNs / 1e9;
+    std::cout << deviceName << ": enumerated " << tree.Size() - 1 << " objects in " << enumTime << " seconds ("
+        << (tree.Size() - 1) / enumTime << " objects/s, "
+        << bytesHumanReadable(tree.ArenaBytes()) << " of IDs)." << std::endl;
+
+    WPDObjectTable objects(&tree);
+    int64_t fetchStartTime = getCurrentMsTime();
+    {
+        StageTimer timer(stats, STAGE_WPD_METADATA);
+        FetchObjectMetadata(device, &tree, &objects);
+    }
+
+    DestinationLayout layout(baseDstPath, deviceName);
+    BackupManifest manifest(layout.rootDir() + MANIFEST_FILE_NAME);
+    BackupJournal journal(layout.rootDir() + JOURNAL_FILE_NAME);
+    {
+        StageTimer timer(stats, STAGE_MANIFEST);
+        manifest.load();
+        if (journal.load(&manifest)) {
+            totals->resumedFiles += journal.doneCount();
+            totals->resumedBytes += journal.doneBytes();
+        }
+    }
+    if (!journal.open()) {
+        std::cout << "! Failed to open backup journal, this run cannot be resumed: " << lastErrorMessage();
+    }
+    std::unique_ptr<PackWriter> pack;
+    if (packThreshold > 0) {
+        pack = std::make_unique<PackWriter>(packThreshold);
+    }
+    BackupCatalog catalog(layout.rootDir());
+    DeviceContext ctx{device, &objects};
+    ctx.layout = &layout;
+    ctx.manifest = &manifest;
+    ctx.journal = &journal;
+    ctx.pack = pack.get();
+    ctx.dedup = dedup;
+    ctx.scheduler = scheduler;
+    ctx.totals = totals;
+    ctx.catalog = &catalog;
+    std::unique_ptr<AdaptiveConcurrency> concurrency;
+    if (adaptive && numWorkers > 1) {
+        concurrency = std::make_unique<AdaptiveConcurrency>(numWorkers, &ctx.transferredBytes, &ctx.transferredFiles);
+        ctx.concurrency = concurrency.get();
+    }
+
+    // Metadata is all in memory by now, so the device's plan is exact
+    // before the first transfer starts.
+    size_t numMatching = 0;
+    char key[MAX_PATH * 4];
+    for (size_t i = 0; i < objects.Size(); i++) {
+        if (!wpdObjectMatches(&objects, i, filter)) {
+            continue;
+        }
+        numMatching++;
+        const WPDObjectRecord &record = objects.At(i);
+        std::string_view keyView = wpdObjectKey(&objects, i, key, sizeof(key));
+        if (journal.isDone(keyView)) {
+            continue;
+        }
+        ManifestStatus status = manifest.classify(keyView, record.sizeBytes, record.dateModified);
+        if (status == MANIFEST_UNCHANGED) {
+            totals->unchangedFiles++;
+            totals->unchangedBytes += record.sizeBytes;
+            continue;
+        }
+        (status == MANIFEST_NEW ? totals->newFiles : totals->changedFiles)++;
+        ctx.pending.push_back(i);
+        ctx.changed.push_back(status == MANIFEST_CHANGED);
+        totals->plannedBytes += record.sizeBytes;
+    }
+    totals->plannedFiles += ctx.pending.size();
+    totals->planned = true;
+    std::cout << deviceName << ": fetched metadata for " << objects.Size() << " objects in "
+        << getCurrentMsTime() - fetchStartTime << " ms, " << numMatching
+        << " match " << filter->describe() << ", " << ctx.pending.size() << " to transfer." << std::endl;
+
+    int64_t startTime = getCurrentMsTime();
+    std::cout << deviceName << ": starting transfer with " << (concurrency != nullptr ? "up to " : "")
+        << numWorkers << " workers..." << std::endl;
+    std::vector<std::thread> workers;
+    for (UINT i = 0; i < numWorkers; i++) {
+        workers.emplace_back(deviceWorker, &ctx);
+    }
+    if (concurrency != nullptr) {
+        concurrency->start();
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    if (concurrency != nullptr) {
+        concurrency->stop();
+    }
+    if (!catalog.flush()) {
+        std::cout << "! Failed to write checksum catalog: " << lastErrorMessage();
+    }
+    bool saved;
+    {
+        StageTimer timer(stats, STAGE_MANIFEST);
+        saved = manifest.save();
+    }
+    if (saved) {
+        journal.finish();
+    } else {
+        std::cout << "! Failed to save backup manifest: " << lastErrorMessage();
+    }
+
+    double elapsedTime = (getCurrentMsTime() - startTime) / 1000.0;
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    printSummary(deviceName, totals, elapsedTime, numWorkers, dedup != nullptr);
+    if (concurrency != nullptr) {
+        concurrency->printDecisions(deviceName);
+    }
+    std::cout << deviceName << ": " << layout.mkdirCalls() << " directories created, "
+        << layout.mkdirAvoided() << " mkdir calls avoided." << std::endl;
+    if (pack != nullptr) {
+        std::cout << deviceName << ": " << pack->segmentsCreated() << " pack segments started." << std::endl;
+    }
+}
+
+// Runs the same filter and manifest checks as the walker in backupDrive(),
+// but never waits on the copy queue, so it finishes long before the walker
+// and the progress reporter can show an ETA early in the run.
+void scanDrive(const std::string &rootPath, const FileFilter *filter, const BackupManifest *manifest,
+               const BackupJournal *journal, CopyTotals *totals) {
+    TreeWalker walker(rootPath, nullptr, nullptr);
+    while (walker.next()) {
+        uint64_t sizeBytes = walker.sizeBytes();
+        uint64_t mtime = walker.mtime();
+        if (!filter->matches(walker.path(), sizeBytes, mtime)) {
+            continue;
+        }
+        std::string_view relPath = walker.path().substr(rootPath.size());
+        if (!journal->isDone(relPath) && manifest->classify(relPath, sizeBytes, mtime) != MANIFEST_UNCHANGED) {
+            totals->plannedFiles.fetch_add(1, std::memory_order_relaxed);
+            totals->plannedBytes.fetch_add(sizeBytes, std::memory_order_relaxed);
+        }
+    }
+    totals->planned = true;
+}
+
+// Size and write time of the version of each file a followed source last
+// queued, by relative path. The manifest only classifies against what was
+// loaded, so this is what tells a rewrite of a file copied earlier in the
+// same run from a new file.
+using QueuedVersions = std::unordered_map<std::string, std::pair<uint64_t, uint64_t>>;
+
+// Returns false if this version of relPath is already queued, and sets
+// *requeue if an earlier one was.
+static bool rememberQueued(QueuedVersions *queued, std::string_view relPath, uint64_t sizeBytes, uint64_t mtime,
+                           bool *requeue) {
+    auto [it, inserted] = queued->try_emplace(std::string(relPath), sizeBytes, mtime);
+    if (inserted) {
+        return true;
+    }
+    if (it->second == std::make_pair(sizeBytes, mtime)) {
+        return false;
+    }
+    it->second = {sizeBytes, mtime};
+    *requeue = true;
+    return true;
+}
+
+// Copies the walker holds back so it can queue them in disk order
+struct DiskOrderWindow {
+    std::vector<CopyJob> jobs;
+    std::vector<std::pair<uint64_t, size_t>> order;
+    std::string path;
+};
+
+// Queues the held-back copies sorted by where their data starts, so a
+// spinning disk or a fragmented card is read in a sweep instead of
+// seeking back and forth in directory order. Workers pop in queue order,
+// so they keep to the sweep apart from the few batches in flight at once.
+static void flushDiskOrder(DiskOrderWindow *window, CopyContext *ctx, BoundedQueue<CopyJob> *copyQueue) {
+    if (window->jobs.empty()) {
+        return;
+    }
+    StageStats *stats = &ctx->totals->stages;
+    {
+        StageTimer timer(stats, STAGE_LOCALITY);
+        window->order.clear();
+        for (size_t i = 0; i < window->jobs.size(); i++) {
+            PathStore::fullPath(window->jobs[i].src, &window->path);
+            window->order.emplace_back(diskLocation(window->path.c_str()), i);
+        }
+        std::sort(window->order.begin(), window->order.end());
+    }
+    int64_t pushStartTime = getCurrentNsTime();
+    for (const auto &[location, i] : window->order) {
+        copyQueue->push(std::move(window->jobs[i]));
+    }
+    stats->record(STAGE_QUEUE_WAIT, getCurrentNsTime() - pushStartTime);
+    window->jobs.clear();
+}
+
+// Queues a job now, or once a window of them can be put in disk order if
+// window is not nullptr
+static void queueJob(CopyJob job, DiskOrderWindow *window, CopyContext *ctx, BoundedQueue<CopyJob> *copyQueue) {
+    if (window == nullptr) {
+        StageTimer timer(&ctx->totals->stages, STAGE_QUEUE_WAIT);
+        copyQueue->push(std::move(job));
+        return;
+    }
+    window->jobs.push_back(std::move(job));
+    if (window->jobs.size() >= LOCALITY_WINDOW) {
+        flushDiskOrder(window, ctx, copyQueue);
+    }
+}
+
+// Walker side of the drive backup pipeline. Walks rootPath, which is the
+// source root or a folder under it with a trailing separator. Journaled
+// copies an interrupted run finished are skipped; everything queued is
+// journaled first, and once the walk ends a resume can skip it entirely.
+// queued is nullptr unless the source is followed after the walk.
+static void walkDrive(const std::string &rootPath, const FileFilter *filter, CopyContext *ctx,
+                      BoundedQueue<CopyJob> *copyQueue, QueuedVersions *queued) {
+    CopyTotals *totals = ctx->totals;
+    StageStats *stats = &totals->stages;
+    BackupJournal *journal = ctx->journal;
+
+    // Walker time is everything between queue pushes, so a slow card shows
+    // as walk time and slow copy workers as queue wait.
+    int64_t walkNs = 0;
+    int64_t walkMarkTime = getCurrentNsTime();
+    PathStore *paths = ctx->paths;
+    DiskOrderWindow window;
+    TreeWalker walker(rootPath, paths, paths->internDir(std::string_view(rootPath).substr(ctx->srcRootLen)));
+    while (walker.next()) {
+        // Size and write time come from the directory listing, so
+        // filtered-out and unchanged files are never opened, and only
+        // queued files are added to the path store.
+        uint64_t sizeBytes = walker.sizeBytes();
+        uint64_t mtime = walker.mtime();
+        if (!filter->matches(walker.path(), sizeBytes, mtime)) {
+            continue;
+        }
+
+        std::string_view relPath = walker.path().substr(ctx->srcRootLen);
+        if (journal->isDone(relPath)) {
+            continue;
+        }
+        bool requeue = false;
+        if (queued != nullptr && !rememberQueued(queued, relPath, sizeBytes, mtime, &requeue)) {
+            continue;
+        }
+        ManifestStatus status = requeue ? MANIFEST_CHANGED : ctx->manifest->classify(relPath, sizeBytes, mtime);
+        if (status == MANIFEST_UNCHANGED) {
+            totals->unchangedFiles++;
+            totals->unchangedBytes += sizeBytes;
+            continue;
+        }
+        (status == MANIFEST_NEW ? totals->newFiles : totals->changedFiles)++;
+        journal->plan(relPath, sizeBytes, mtime, status == MANIFEST_CHANGED);
+        walkNs += getCurrentNsTime() - walkMarkTime;
+        queueJob(CopyJob{paths->addFile(walker.dir(), walker.name()), sizeBytes, mtime, status == MANIFEST_CHANGED,
+                         journal->resumed()},
+                 ctx->diskOrder ? &window : nullptr, ctx, copyQueue);
+        walkMarkTime = getCurrentNsTime();
+    }
+    walkNs += getCurrentNsTime() - walkMarkTime;
+    stats->record(STAGE_WALK, walkNs, 0, walker.entries());
+    flushDiskOrder(&window, ctx, copyQueue);
+}
+
+// Queues one file the watcher reports as settled, if it is new or changed.
+static void queueChanged(const std::string &inPath, const FileFilter *filter, CopyContext *ctx,
+                         BoundedQueue<CopyJob> *copyQueue, QueuedVersions *queued) {
+    CopyTotals *totals = ctx->totals;
+    std::error_code ec;
+    uint64_t sizeBytes = std::filesystem::file_size(inPath, ec);
+    uint64_t mtime = std::filesystem::last_write_time(inPath, ec).time_since_epoch().count();
+    if (ec || !filter->matches(inPath, sizeBytes, mtime)) {
+        return;
+    }
+    std::string_view relPath = std::string_view(inPath).substr(ctx->srcRootLen);
+    bool requeue = false;
+    if (!rememberQueued(queued, relPath, sizeBytes, mtime, &requeue)) {
+        return;
+    }
+    // Copies an interrupted run finished are missing from the loaded
+    // manifest, but are at the destination to be replaced
+    ManifestStatus status = requeue || ctx->journal->isDone(relPath)
+            ? MANIFEST_CHANGED : ctx->manifest->classify(relPath, sizeBytes, mtime);
+    if (status == MANIFEST_UNCHANGED) {
+        totals->unchangedFiles++;
+        totals->unchangedBytes += sizeBytes;
+        return;
+    }
+    (status == MANIFEST_NEW ? totals->newFiles : totals->changedFiles)++;
+    totals->plannedFiles++;
+    totals->plannedBytes += sizeBytes;
+    ctx->journal->plan(relPath, sizeBytes, mtime, status == MANIFEST_CHANGED);
+    StageTimer timer(&totals->stages, STAGE_QUEUE_WAIT);
+    copyQueue->push(CopyJob{ctx->paths->intern(relPath), sizeBytes, mtime, status == MANIFEST_CHANGED, false});
+}
+
+// After the first walk, feeds files the watcher sees settle to the copy
+// workers until watchStopEvent() is set, saving the manifest now and then.
+static void followChanges(ChangeWatcher *watcher, const IndexedDrive *drive, const FileFilter *filter,
+                          CopyContext *ctx, BoundedQueue<CopyJob> *copyQueue, QueuedVersions *queued) {
+    std::vector<std::string> ready;
+    bool overflowed;
+    int64_t savedTime = getCurrentMsTime();
+    int64_t savedFiles = ctx->totals->copiedFiles;
+    while (watcher->wait(&ready, &overflowed)) {
+        if (overflowed) {
+            std::cout << drive->name << ": missed some changes, walking the source again." << std::endl;
+            walkDrive(drive->path, filter, ctx, copyQueue, queued);
+        }
+        for (std::string &path : ready) {
+            // A folder added or moved in whole reports only its own name;
+            // the watcher drops folders that were merely modified
+            std::error_code ec;
+            if (std::filesystem::is_directory(path, ec)) {
+                walkDrive(path + '\\', filter, ctx, copyQueue, queued);
+            } else {
+                queueChanged(path, filter, ctx, copyQueue, queued);
+            }
+        }
+        ready.clear();
+        if (getCurrentMsTime() - savedTime >= WATCH_CHECKPOINT_MS && ctx->totals->copiedFiles != savedFiles) {
+            StageTimer timer(&ctx->totals->stages, STAGE_MANIFEST);
+            ctx->catalog->flush();
+            if (!ctx->manifest->save()) {
+                std::cout << "! Failed to save backup manifest: " << lastErrorMessage();
+            }
+            savedTime = getCurrentMsTime();
+            savedFiles = ctx->totals->copiedFiles;
+        }
+    }
+}
+
+// Walks a logical drive and copies every file that matches the filter and
+// is new or changed since the last run into <base>\<drive name>. An
+// interrupted run is resumed from its journal.
+void backupDrive(const IndexedDrive *drive, const std::string &baseDstPath, const FileFilter *filter,
+                 UINT numWorkers, bool adaptive, uint64_t packThreshold, ContentIndex *dedup,
+                 BlockCompressor *compressor, WriteScheduler *scheduler, CopyBackend *backend, LocalityMode locality,
+                 bool follow, bool checksums, CopyTotals *totals) {
+    DestinationLayout layout(baseDstPath, drive->name);
+    BackupManifest manifest(layout.rootDir() + MANIFEST_FILE_NAME);
+    StageStats *stats = &totals->stages;
+    int64_t loadStartTime = getCurrentNsTime();
+    bool loaded = manifest.load();
+    BackupJournal journal(layout.rootDir() + JOURNAL_FILE_NAME);
+    bool resuming = journal.load(&manifest);
+    int64_t loadNs = getCurrentNsTime() - loadStartTime;
+    stats->record(STAGE_MANIFEST, loadNs);
+    if (loaded) {
+        std::cout << drive->name << ": loaded " << manifest.size() << " manifest entries in "
+            << loadNs / 1000000 << " ms." << std::endl;
+    }
+    if (resuming) {
+        totals->resumedFiles += journal.doneCount();
+        totals->resumedBytes += journal.doneBytes();
+        std::cout << drive->name << ": resuming interrupted run, " << journal.doneCount() << " files already copied, "
+            << (journal.walkComplete() ? std::to_string(journal.pending().size()) + " left." : "walk unfinished.")
+            << std::endl;
+    }
+    if (!journal.open()) {
+        std::cout << "! Failed to open backup journal, this run cannot be resumed: " << lastErrorMessage();
+    }
+
+    std::unique_ptr<PackWriter> pack;
+    if (packThreshold > 0) {
+        pack = std::make_unique<PackWriter>(packThreshold);
+    }
+    BackupCatalog catalog(layout.rootDir());
+    PathStore paths(drive->path);
+    std::unique_ptr<AdaptiveConcurrency> concurrency;
+    if (adaptive && numWorkers > 1) {
+        concurrency = std::make_unique<AdaptiveConcurrency>(numWorkers, &totals->copiedBytes, &totals->copiedFiles);
+    }
+    CopyContext ctx{&layout, &manifest, dedup, scheduler, backend, drive->path.size(), totals, &journal,
+                    pack.get(), compressor, &catalog, &paths, useLocalityOrder(locality, drive->path),
+                    checksums, concurrency.get()};
+    // Room for every worker to take a full batch, for backends that keep
+    // hundreds of files in flight
+    size_t slotsPerWorker = (std::max)((size_t) QUEUE_SLOTS_PER_WORKER, backend->batchSize());
+    BoundedQueue<CopyJob> copyQueue(numWorkers * slotsPerWorker);
+    std::vector<std::thread> workers;
+    int64_t startTime = getCurrentMsTime();
+    std::cout << drive->name << ": starting " << backend->name() << " copy of " << filter->describe()
+        << " with " << (concurrency != nullptr ? "up to " : "") << numWorkers << " workers"
+        << (ctx.diskOrder ? ", in disk order..." : "...") << std::endl;
+    for (UINT i = 0; i < numWorkers; i++) {
+        workers.emplace_back(copyWorker, &copyQueue, &ctx);
+    }
+    if (concurrency != nullptr) {
+        concurrency->start();
+    }
+
+    // Watching starts before the walk, so files arriving during it are
+    // either walked or reported
+    std::unique_ptr<ChangeWatcher> watcher;
+    QueuedVersions queued;
+    if (follow) {
+        watcher = std::make_unique<ChangeWatcher>(drive->path);
+        if (!watcher->open()) {
+            std::cout << "! Failed to watch " << drive->path << ", backing it up once: " << lastErrorMessage();
+            watcher.reset();
+        }
+    }
+
+    if (journal.walkComplete() && watcher == nullptr) {
+        // Everything left is already known, so the source is not walked
+        for (const JournalRecord &record : journal.pending()) {
+            (record.overwrite ? totals->changedFiles : totals->newFiles)++;
+            totals->plannedFiles++;
+            totals->plannedBytes += record.sizeBytes;
+        }
+        totals->planned = true;
+        DiskOrderWindow window;
+        for (const JournalRecord &record : journal.pending()) {
+            queueJob(CopyJob{paths.intern(record.key), record.sizeBytes, record.mtime, record.overwrite, true},
+                     ctx.diskOrder ? &window : nullptr, &ctx, &copyQueue);
+        }
+        flushDiskOrder(&window, &ctx, &copyQueue);
+    } else {
+        std::thread scanner(scanDrive, std::cref(drive->path), filter, &manifest, &journal, totals);
+        walkDrive(drive->path, filter, &ctx, &copyQueue, watcher != nullptr ? &queued : nullptr);
+        scanner.join();
+        journal.walkFinished();
+    }
+    if (watcher != nullptr) {
+        std::cout << drive->name << ": watching for new files, press Ctrl+C to stop." << std::endl;
+        followChanges(watcher.get(), drive, filter, &ctx, &copyQueue, &queued);
+    }
+    copyQueue.close();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    if (concurrency != nullptr) {
+        concurrency->stop();
+    }
+    if (!catalog.flush()) {
+        std::cout << "! Failed to write checksum catalog: " << lastErrorMessage();
+    }
+    bool saved;
+    {
+        StageTimer timer(stats, STAGE_MANIFEST);
+        saved = manifest.save();
+    }
+    if (saved) {
+        journal.finish();
+    } else {
+        std::cout << "! Failed to save backup manifest: " << lastErrorMessage();
+    }
+
+    double elapsedTime = (getCurrentMsTime() - startTime) / 1000.0;
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    printSummary(drive->name, totals, elapsedTime, numWorkers, dedup != nullptr);
+    if (concurrency != nullptr) {
+        concurrency->printDecisions(drive->name);
+    }
+    std::cout << drive->name << ": " << layout.mkdirCalls() << " directories created, "
+        << layout.mkdirAvoided() << " mkdir calls avoided." << std::endl;
+    std::cout << drive->name << ": " << paths.fileCount() << " queued paths in " << paths.dirCount()
+        << " folders took " << bytesHumanReadable(paths.bytesUsed()) << "." << std::endl;
+    if (pack != nullptr) {
+        std::cout << drive->name << ": " << pack->segmentsCreated() << " pack segments started." << std::endl;
+    }
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "common.h"
+#include "queue.h"
+#include "wpdmeta.h"
+#include "layout.h"
+#include "manifest.h"
+#include "dedup.h"
+#include "filter.h"
+#include "scheduler.h"
+#include "copybackend.h"
+#include "stats.h"
+#include "journal.h"
+#include "pack.h"
+#include "compress.h"
+#include "mediadate.h"
+#include "watch.h"
+#include "catalog.h"
+#include "pathstore.h"
+#include "locality.h"
+#include "concurrency.h"
+
+#define QUEUE_SLOTS_PER_WORKER  64
+
+struct CopyResult {
+    bool success;
+    LARGE_INTEGER sizeBytes;
+    bool deduplicated;
+    bool packed;
+    bool compressed;
+    uint64_t dateTaken;     // header date the file was filed under, 0 if it had none
+    bool checksummed;       // bytes were written this run and hashed on the way, so the catalog lists them
+    uint64_t storedBytes;   // what was written, which differs from sizeBytes when compressed
+    uint64_t checksum;
+};
+
+// Shared between all copy workers, so every field is updated atomically.
+// stages holds the per-stage timings behind the JSON run report.
+//
+// plannedFiles and plannedBytes count the new and changed files the
+// pre-scan found; planned is set once they are final. The progress
+// reporter reads all of these with relaxed loads and never locks.
+struct CopyTotals {
+    std::atomic<int64_t> copiedBytes{0};
+    std::atomic<int64_t> skippedBytes{0};
+    std::atomic<int64_t> copiedFiles{0};
+    std::atomic<int64_t> skippedFiles{0};
+    std::atomic<int64_t> newFiles{0};
+    std::atomic<int64_t> changedFiles{0};
+    std::atomic<int64_t> unchangedFiles{0};
+    std::atomic<int64_t> unchangedBytes{0};
+    std::atomic<int64_t> dedupFiles{0};
+    std::atomic<int64_t> dedupBytes{0};
+    std::atomic<int64_t> resumedFiles{0};   // finished by an interrupted run
+    std::atomic<int64_t> resumedBytes{0};
+    std::atomic<int64_t> packedFiles{0};    // copied files that went into pack segments
+    std::atomic<int64_t> packedBytes{0};
+    std::atomic<int64_t> compressedFiles{0};
+    std::atomic<int64_t> compressedBytes{0};        // original size of compressed files
+    std::atomic<int64_t> compressedStoredBytes{0};  // what they take at the destination
+    std::atomic<int64_t> plannedFiles{0};
+    std::atomic<int64_t> plannedBytes{0};
+    std::atomic<bool> planned{false};
+    StageStats stages;
+};
+
+// One file handed from the walker to the copy workers, with the metadata
+// the walker already read from its directory entry. The source path is a
+// handle into the context's path store, built out only when the file is
+// copied. resumed marks jobs an interrupted run may already have finished.
+struct CopyJob {
+    PathHandle src;
+    uint64_t sizeBytes;
+    uint64_t mtime;
+    bool overwrite;
+    bool resumed;
+};
+
+// Per-source state shared by the walker and every copy worker
+struct CopyContext {
+    DestinationLayout *layout;
+    BackupManifest *manifest;
+    ContentIndex *dedup;        // nullptr unless dedup mode is on
+    WriteScheduler *scheduler;  // shared by every source in the session
+    CopyBackend *backend;
+    size_t srcRootLen;
+    CopyTotals *totals;
+    BackupJournal *journal;     // nullptr when runs are not journaled
+    PackWriter *pack;           // nullptr unless small files are packed
+    BlockCompressor *compressor; // nullptr unless compression is on; shared by the session
+    BackupCatalog *catalog;
+    PathStore *paths;           // owns every queued job's source path
+    bool diskOrder;             // the walker queues files in the order they sit on disk
+    bool checksums;             // plain copies are hashed for the catalog, off the kernel's copy paths
+    AdaptiveConcurrency *concurrency;   // nullptr when every worker copies at once
+};
+
+// Per-device state shared by every transfer worker. Workers claim objects
+// from the pending list by bumping next; changed says whether each one
+// replaces an earlier copy.
+struct DeviceContext {
+    IPortableDevice *device;
+    const WPDObjectTable *objects;
+    std::vector<size_t> pending;
+    std::vector<bool> changed;
+    std::atomic<size_t> next{0};
+    DestinationLayout *layout;
+    BackupManifest *manifest;
+    BackupJournal *journal;
+    PackWriter *pack;
+    ContentIndex *dedup;        // nullptr unless dedup mode is on; shared with the drives
+    WriteScheduler *scheduler;
+    CopyTotals *totals;
+    BackupCatalog *catalog;
+    AdaptiveConcurrency *concurrency;   // nullptr when every worker transfers at once
+    // Every finished transfer, including those dedup then swapped for a
+    // link; this is what the concurrency controller measures
+    std::atomic<int64_t> transferredBytes{0};
+    std::atomic<int64_t> transferredFiles{0};
+};
+
+// Per-worker scratch space, reused so steady-state batches do not allocate
+struct CopyBatch {
+    std::vector<CopyJob> jobs;
+    std::vector<std::string> srcPaths;
+    std::vector<std::string> dstPaths;
+    std::vector<std::string> partialPaths;
+    std::vector<CopyResult> results;
+    std::vector<ContentHashes> hashes;
+    std::vector<CopyRequest> requests;
+    std::vector<size_t> requestJobs;
+    std::vector<char> packBuffer;
+    MediaDateReader dates;
+};
+
+// Keeps lines from concurrent sources from interleaving
+extern std::mutex consoleMutex;
+
+std::string lastErrorMessage();
+int64_t getCurrentMsTime();
+SYSTEMTIME getFileTime(HANDLE *file);
+std::string bytesHumanReadable(int64_t numBytes);
+
+bool prepareCopy(const CopyJob *job, const std::string &srcPath, CopyContext *ctx, MediaDateReader *dates, std::string *dstPath,
+                 ContentHashes *hashes, CopyResult *result);
+void copyFiles(CopyBatch *batch, CopyContext *ctx);
+void copyWorker(BoundedQueue<CopyJob> *queue, CopyContext *ctx);
+bool wpdObjectMatches(const WPDObjectTable *objects, size_t index, const FileFilter *filter);
+std::string_view wpdObjectKey(const WPDObjectTable *objects, size_t index, char *key, size_t keySize);
+void deviceWorker(DeviceContext *ctx);
+
+void printSummary(const std::string &label, const CopyTotals *totals, double elapsedTime, UINT numWorkers,
+                  bool dedupEnabled);
+void addTotals(CopyTotals *sum, const CopyTotals *totals);
+
+// Counts sizes of the files under rootPath a backup will copy, alongside
+// the walker, and sets totals->planned when done.
+void scanDrive(const std::string &rootPath, const FileFilter *filter, const BackupManifest *manifest,
+               const BackupJournal *journal, CopyTotals *totals);
+
+// Files smaller than packThreshold are packed into per-month segments;
+// 0 writes every file individually. With adaptive set, numWorkers is the
+// most that may copy at once and the source's own knee decides the rest.
+// dedup, if not nullptr, is the session's index, which device transfers
+// are added to and checked against.
+void backupDevice(IPortableDevice *device, const std::string &deviceName, const std::string &baseDstPath,
+                  const FileFilter *filter, UINT numWorkers, bool adaptive, uint64_t packThreshold,
+                  ContentIndex *dedup, WriteScheduler *scheduler, CopyTotals *totals);
+// locality says whether files are copied in disk order rather than walk
+// order. With follow set, the drive keeps being watched after the walk and
+// new or rewritten files are copied as they settle, until watchStopEvent().
+// With checksums set, plain copies are hashed for the catalog too.
+void backupDrive(const IndexedDrive *drive, const std::string &baseDstPath, const FileFilter *filter,
+                 UINT numWorkers, bool adaptive, uint64_t packThreshold, ContentIndex *dedup, BlockCompressor *compressor,
+                 WriteScheduler *scheduler, CopyBackend *backend, LocalityMode locality, bool follow,
+                 bool checksums, CopyTotals *totals);
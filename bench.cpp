@@ -0,0 +1,453 @@
+#include "common.h"
+#include "wpd.h"
+#include "backup.h"
+#include "streamcopy.h"
+#include "benchtree.h"
+#include "fakewpd.h"
+
+#include <psapi.h>
+
+#define DEFAULT_BENCH_ITERATIONS    3
+#define DEFAULT_BENCH_SCENARIOS     "tiny,photos,deep,wide,device"
+#define DEFAULT_BENCH_SEED          20240601
+
+// Latency samples for one phase, in microseconds
+struct PhaseSamples {
+    std::string name;
+    std::vector<double> us;
+};
+
+struct ScenarioResult {
+    std::string name;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    std::vector<double> filesPerSec;
+    std::vector<double> mbPerSec;
+    std::vector<PhaseSamples> phases;
+    uint64_t peakWorkingSet = 0;    // of the whole process, after the first pipeline pass
+};
+
+struct BenchOptions {
+    std::string workDir;
+    std::vector<std::string> scenarios;
+    UINT iterations = DEFAULT_BENCH_ITERATIONS;
+    double scale = 1;
+    UINT workers = 4;
+    bool adaptive = false;
+    bool checksums = false;
+    std::string backend = DEFAULT_COPY_BACKEND;
+    LocalityMode locality = LOCALITY_AUTO;
+    uint64_t seed = DEFAULT_BENCH_SEED;
+    FakeDeviceSpec device = {10, 100, 512 * 1000, 4000 * 1000, 200, 0, true, 0};
+};
+
+static double elapsedUs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - since).count();
+}
+
+static PhaseSamples *phase(ScenarioResult *result, const char *name) {
+    for (PhaseSamples &samples : result->phases) {
+        if (samples.name == name) {
+            return &samples;
+        }
+    }
+    result->phases.push_back(PhaseSamples{name, {}});
+    return &result->phases.back();
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t) (p / 100 * sorted.size() + 0.999999);
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return percentile(values, 50);
+}
+
+static uint64_t peakWorkingSet() {
+    PROCESS_MEMORY_COUNTERS counters;
+    counters.cb = sizeof(counters);
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+}
+
+static void resetDestination(const std::string &dst) {
+    std::error_code ec;
+    std::filesystem::remove_all(dst, ec);
+    std::filesystem::create_directories(dst, ec);
+}
+
+// One throughput pass through the real multi-worker pipeline, then a
+// single-threaded pass that times every walk step, path/dedup preparation
+// and backend copy on its own.
+static bool benchDrive(const BenchOptions *opts, const TreeSpec *spec, CopyBackend *backend, ScenarioResult *result) {
+    std::string src = opts->workDir + "src\\" + spec->name;
+    std::string dst = opts->workDir + "dst\\";
+    TreeStats stats;
+    std::cout << "Generating " << spec->name << " tree..." << std::endl;
+    if (!generateTree(spec, src, opts->scale, opts->seed, &stats)) {
+        std::cout << "! Failed to generate " << src << ": " << lastErrorMessage();
+        return false;
+    }
+    result->files = stats.files;
+    result->bytes = stats.bytes;
+
+    FileFilter filter;
+    std::string error;
+    FileFilter::compile("", &filter, &error);
+    IndexedDrive drive;
+    drive.path = src + "\\";
+    drive.name = spec->name;
+    drive.index = 0;
+    drive.isWPD = false;
+
+    for (UINT i = 0; i < opts->iterations; i++) {
+        resetDestination(dst);
+        CopyTotals totals;
+        auto start = std::chrono::steady_clock::now();
+        backupDrive(&drive, dst, &filter, opts->workers, opts->adaptive, 0, nullptr, nullptr, nullptr, backend, opts->locality,
+                    false, opts->checksums, &totals);
+        double seconds = elapsedUs(start) / 1e6;
+        result->filesPerSec.push_back(totals.copiedFiles.load() / seconds);
+        result->mbPerSec.push_back(totals.copiedBytes.load() / 1e6 / seconds);
+        // Before the timing pass below, whose samples grow with the tree
+        if (i == 0) {
+            result->peakWorkingSet = peakWorkingSet();
+        }
+
+        resetDestination(dst);
+        DestinationLayout layout(dst, spec->name);
+        BackupManifest manifest(layout.rootDir() + MANIFEST_FILE_NAME);
+        PathStore paths(drive.path);
+        CopyContext ctx{&layout, &manifest, nullptr, nullptr, backend, drive.path.size(), &totals, nullptr, nullptr,
+                        nullptr, nullptr, &paths, false, opts->checksums, nullptr};
+        PhaseSamples *walk = phase(result, "walk");
+        PhaseSamples *prepare = phase(result, "prepare");
+        PhaseSamples *copy = phase(result, "copy");
+        std::string srcPath;
+        std::string dstPath;
+        ContentHashes hashes;
+        CopyResult copyResult;
+        MediaDateReader dates;
+        TreeWalker walker(drive.path, &paths, paths.root());
+        auto stepStart = std::chrono::steady_clock::now();
+        while (walker.next()) {
+            CopyJob job{paths.addFile(walker.dir(), walker.name()), walker.sizeBytes(), walker.mtime(), false, false};
+            walk->us.push_back(elapsedUs(stepStart));
+
+            auto prepareStart = std::chrono::steady_clock::now();
+            PathStore::fullPath(job.src, &srcPath);
+            bool needsCopy = prepareCopy(&job, srcPath, &ctx, &dates, &dstPath, &hashes, &copyResult);
+            prepare->us.push_back(elapsedUs(prepareStart));
+            if (needsCopy) {
+                auto copyStart = std::chrono::steady_clock::now();
+                uint64_t checksum = 0;
+                backend->copy(srcPath.c_str(), dstPath.c_str(), job.sizeBytes, false,
+                              opts->checksums ? &checksum : nullptr);
+                copy->us.push_back(elapsedUs(copyStart));
+            }
+            stepStart = std::chrono::steady_clock::now();
+        }
+    }
+    return true;
+}
+
+// Same two passes for the fake device: backupDevice() for throughput, then
+// enumeration, metadata and each object's transfer timed separately.
+static bool benchDevice(const BenchOptions *opts, ScenarioResult *result) {
+    std::string dst = opts->workDir + "dst\\";
+    FakeDeviceSpec spec = opts->device;
+    spec.seed = opts->seed;
+    double objects = spec.objectsPerFolder * opts->scale;
+    spec.objectsPerFolder = objects < 1 ? 1 : (UINT32) (objects + 0.5);
+    auto model = std::make_shared<const FakeDeviceModel>(spec);
+    result->files = (uint64_t) spec.folders * spec.objectsPerFolder;
+    result->bytes = model->TotalBytes();
+
+    CComPtr<IPortableDevice> device;
+    HRESULT hr = CreateFakeDevice(model, &device);
+    if (FAILED(hr)) {
+        printf("! Failed to create fake device, hr = 0x%lx\n", hr);
+        return false;
+    }
+    FileFilter filter;
+    std::string error;
+    FileFilter::compile("", &filter, &error);
+
+    for (UINT i = 0; i < opts->iterations; i++) {
+        resetDestination(dst);
+        CopyTotals totals;
+        auto start = std::chrono::steady_clock::now();
+        backupDevice(device, "device", dst, &filter, opts->workers, opts->adaptive, 0, nullptr, nullptr, &totals);
+        double seconds = elapsedUs(start) / 1e6;
+        result->filesPerSec.push_back(totals.copiedFiles.load() / seconds);
+        result->mbPerSec.push_back(totals.copiedBytes.load() / 1e6 / seconds);
+
+        resetDestination(dst);
+        WPDObjectTree tree;
+        auto enumStart = std::chrono::steady_clock::now();
+        GetAllContent(device, &tree);
+        phase(result, "enumerate")->us.push_back(elapsedUs(enumStart));
+        WPDObjectTable table(&tree);
+        auto fetchStart = std::chrono::steady_clock::now();
+        FetchObjectMetadata(device, &tree, &table);
+        phase(result, "metadata")->us.push_back(elapsedUs(fetchStart));
+
+        CComPtr<IPortableDeviceContent> pContent;
+        CComPtr<IPortableDeviceResources> pResources;
+        hr = device->Content(&pContent);
+        if (SUCCEEDED(hr)) {
+            hr = pContent->Transfer(&pResources);
+        }
+        if (FAILED(hr)) {
+            return false;
+        }
+        TransferCounters counters;
+        StreamCopyEngine engine(&counters);
+        PhaseSamples *transfer = phase(result, "transfer");
+        std::wstring dstDir(dst.begin(), dst.end());
+        for (size_t index = 0; index < table.Size(); index++) {
+            if (table.At(index).contentType == WPD_CONTENT_TYPE_FOLDER) {
+                continue;
+            }
+            std::wstring dstPath = dstDir + std::to_wstring(index) + L".data";
+            ULONGLONG cbWritten = 0;
+            auto transferStart = std::chrono::steady_clock::now();
+            TransferObjectToFile(pResources, table.ObjectIdCStr(index), dstPath.c_str(), false, &engine, &cbWritten,
+                                 nullptr);
+            transfer->us.push_back(elapsedUs(transferStart));
+        }
+    }
+    return true;
+}
+
+static bool writeBytes(const std::string &path, const std::vector<BYTE> &data) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool ok = WriteFile(file, data.data(), (DWORD) data.size(), &bytesWritten, nullptr) && bytesWritten == data.size();
+    CloseHandle(file);
+    return ok;
+}
+
+// True if the only file named name under dir holds exactly data
+static bool storedAs(const std::string &dir, const std::string &name, const std::vector<BYTE> &data) {
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(dir, ec)) {
+        if (entry.path().filename().string() != name) {
+            continue;
+        }
+        HANDLE file = CreateFileA(entry.path().string().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        std::vector<BYTE> stored(data.size() + 1);
+        DWORD bytesRead = 0;
+        bool ok = ReadFile(file, stored.data(), (DWORD) stored.size(), &bytesRead, nullptr);
+        CloseHandle(file);
+        return ok && bytesRead == data.size() && memcmp(stored.data(), data.data(), data.size()) == 0;
+    }
+    return false;
+}
+
+// One session-style run with the dedup index loaded before and saved after
+static void backupWithDedup(const IndexedDrive *drive, const std::string &dst, const FileFilter *filter,
+                            CopyBackend *backend) {
+    ContentIndex dedup(dst);
+    dedup.load();
+    CopyTotals totals;
+    backupDrive(drive, dst, filter, 1, false, 0, &dedup, nullptr, nullptr, backend, LOCALITY_OFF, false, false,
+                &totals);
+    dedup.save();
+}
+
+// Not a benchmark but a check of the dedup index: a file is backed up, then
+// rewritten with other bytes of the same size and backed up again, then a
+// new file with its old bytes shows up. The new file must keep its own
+// bytes rather than be linked to the rewritten copy.
+static bool checkDedupRewrite(const BenchOptions *opts, CopyBackend *backend) {
+    std::string src = opts->workDir + "src\\dedup-rewrite\\";
+    std::string dst = opts->workDir + "dst\\";
+    std::error_code ec;
+    std::filesystem::remove_all(src, ec);
+    std::filesystem::create_directories(src, ec);
+    resetDestination(dst);
+
+    std::vector<BYTE> original(4 * DEDUP_SAMPLE_BLOCK);
+    std::vector<BYTE> rewritten(original.size());
+    fillSyntheticData(original.data(), original.size(), opts->seed, 0);
+    fillSyntheticData(rewritten.data(), rewritten.size(), opts->seed + 1, 0);
+
+    FileFilter filter;
+    std::string error;
+    FileFilter::compile("", &filter, &error);
+    IndexedDrive drive;
+    drive.path = src;
+    drive.name = "dedup-rewrite";
+    drive.index = 0;
+    drive.isWPD = false;
+
+    bool ok = writeBytes(src + "a.dat", original);
+    backupWithDedup(&drive, dst, &filter, backend);
+    ok = ok && writeBytes(src + "a.dat", rewritten);
+    backupWithDedup(&drive, dst, &filter, backend);
+    ok = ok && writeBytes(src + "b.dat", original);
+    backupWithDedup(&drive, dst, &filter, backend);
+
+    ok = ok && storedAs(dst, "a.dat", rewritten) && storedAs(dst, "b.dat", original);
+    std::cout << "dedup-rewrite: " << (ok ? "ok" : "FAILED, b.dat does not hold its own bytes") << std::endl;
+    return ok;
+}
+
+static void printResult(const ScenarioResult *result) {
+    printf("\n== %s: %llu files, %s, %zu iterations\n", result->name.c_str(),
+           (unsigned long long) result->files, bytesHumanReadable(result->bytes).c_str(), result->filesPerSec.size());
+    printf("   throughput (median): %.1f files/s, %.1f MB/s\n", median(result->filesPerSec), median(result->mbPerSec));
+    if (result->peakWorkingSet != 0) {
+        printf("   peak working set: %s\n", bytesHumanReadable(result->peakWorkingSet).c_str());
+    }
+    printf("   %-10s %9s %10s %10s %10s %10s\n", "phase", "samples", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (const PhaseSamples &samples : result->phases) {
+        std::vector<double> sorted = samples.us;
+        std::sort(sorted.begin(), sorted.end());
+        printf("   %-10s %9zu %10.3f %10.3f %10.3f %10.3f\n", samples.name.c_str(), sorted.size(),
+               percentile(sorted, 50) / 1000, percentile(sorted, 90) / 1000,
+               percentile(sorted, 99) / 1000, (sorted.empty() ? 0 : sorted.back()) / 1000);
+    }
+}
+
+static void printUsage() {
+    std::cout << "Usage: backup_bulldozer_bench <work dir> [options]\n"
+        "  --scenarios a,b,...   any of tiny, photos, videos, deep, wide, millions,\n"
+        "                        fragmented, device (default " DEFAULT_BENCH_SCENARIOS "),\n"
+        "                        or dedup-rewrite to check the dedup index instead\n"
+        "  --iterations N        runs per scenario (default " << DEFAULT_BENCH_ITERATIONS << ")\n"
+        "  --scale F             multiply file counts (video sizes) by F\n"
+        "  --workers N           copy workers per run (default 4)\n"
+        "  --adaptive            let the controller pick up to --workers at once\n"
+        "  --checksums           hash drive copies as a --verify run would need\n"
+        "  --backend NAME        copy backend (default " DEFAULT_COPY_BACKEND ")\n"
+        "  --disk-order MODE     auto, on or off: copy drive files in disk order\n"
+        "  --seed N              synthetic data seed\n"
+        "  --device-latency US   fake device per-call latency (default 200)\n"
+        "  --device-bandwidth M  fake device MB/s cap, 0 for none (default 0)\n"
+        "  --device-no-bulk      make the fake device refuse bulk property reads\n"
+        "Source trees are generated once under <work dir>\\src and reused while\n"
+        "the options that shape them stay the same. The peak working set is the\n"
+        "process's, so measure a scenario's on its own, e.g. --scenarios millions\n"
+        "--iterations 1 for the memory cost of a five million file walk. Compare\n"
+        "--disk-order on and off on the fragmented scenario with the work dir on a\n"
+        "spinning disk or SD card and --backend unbuffered, so that reads come\n"
+        "from the media rather than the cache." << std::endl;
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions *opts) {
+    if (argc < 2 || argv[1][0] == '-') {
+        return false;
+    }
+    opts->workDir = argv[1];
+    if (opts->workDir.back() != '\\') {
+        opts->workDir.push_back('\\');
+    }
+    std::string scenarios = DEFAULT_BENCH_SCENARIOS;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--device-no-bulk") {
+            opts->device.bulkProperties = false;
+            continue;
+        }
+        if (arg == "--adaptive") {
+            opts->adaptive = true;
+            continue;
+        }
+        if (arg == "--checksums") {
+            opts->checksums = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--scenarios") {
+            scenarios = value;
+        } else if (arg == "--iterations") {
+            opts->iterations = (UINT) std::stoul(value);
+        } else if (arg == "--scale") {
+            opts->scale = std::stod(value);
+        } else if (arg == "--workers") {
+            opts->workers = (UINT) std::stoul(value);
+        } else if (arg == "--backend") {
+            opts->backend = value;
+        } else if (arg == "--disk-order") {
+            if (!parseLocalityMode(value, &opts->locality)) {
+                return false;
+            }
+        } else if (arg == "--seed") {
+            opts->seed = std::stoull(value);
+        } else if (arg == "--device-latency") {
+            opts->device.callLatencyUs = (DWORD) std::stoul(value);
+        } else if (arg == "--device-bandwidth") {
+            opts->device.bandwidthMBps = (DWORD) std::stoul(value);
+        } else {
+            return false;
+        }
+    }
+    std::stringstream names(scenarios);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        if (name != "device" && name != "dedup-rewrite" && findTreeSpec(name) == nullptr) {
+            std::cout << "! Unknown scenario '" << name << "'" << std::endl;
+            return false;
+        }
+        opts->scenarios.push_back(name);
+    }
+    return opts->iterations > 0 && opts->workers > 0 && opts->scale > 0;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    if (!parseOptions(argc, argv, &opts)) {
+        printUsage();
+        return 2;
+    }
+    wpdInitialize();
+    std::unique_ptr<CopyBackend> backend = createCopyBackend(opts.backend);
+    if (backend == nullptr) {
+        std::cout << "! Unknown copy backend '" << opts.backend << "'" << std::endl;
+        return 2;
+    }
+
+    std::vector<ScenarioResult> results;
+    for (const std::string &name : opts.scenarios) {
+        if (name == "dedup-rewrite") {
+            if (!checkDedupRewrite(&opts, backend.get())) {
+                return 1;
+            }
+            continue;
+        }
+        ScenarioResult result;
+        result.name = name;
+        bool ok = name == "device" ? benchDevice(&opts, &result)
+                : benchDrive(&opts, findTreeSpec(name), backend.get(), &result);
+        if (!ok) {
+            return 1;
+        }
+        results.push_back(std::move(result));
+    }
+    resetDestination(opts.workDir + "dst\\");
+
+    printf("\nbackend %s%s, %s%u workers, disk order %s, scale %g, seed %llu\n", backend->name(),
+           opts.checksums ? " with checksums" : "", opts.adaptive ? "up to " : "", opts.workers,
+           localityModeName(opts.locality), opts.scale, (unsigned long long) opts.seed);
+    for (const ScenarioResult &result : results) {
+        printResult(&result);
+    }
+    return 0;
+}
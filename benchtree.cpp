@@ -0,0 +1,213 @@
+#include "benchtree.h"
+
+#include <fstream>
+
+static const uint32_t STAMP_VERSION = 1;
+static const size_t WRITE_CHUNK_SIZE = 1024 * 1024;
+static const size_t FRAGMENT_CHUNK_SIZE = 64 * 1024;
+static const uint64_t MB = 1000 * 1000;
+
+const TreeSpec BENCH_TREES[] = {
+    // name       fanout depth files  minSize    maxSize    ext    scaleSizes fragmented
+    {"tiny",      10,    2,    150,   1000,      16000,     "txt", false,     false},
+    {"photos",    12,    1,    20,    2 * MB,    8 * MB,    "jpg", false,     false},
+    {"videos",    0,     0,    2,     1500 * MB, 3000 * MB, "mp4", true,      false},
+    {"deep",      1,     64,   8,     4000,      64000,     "dat", false,     false},
+    {"wide",      2000,  1,    4,     1000,      8000,      "dat", false,     false},
+    {"millions",  40,    2,    3050,  1,         64,        "txt", false,     false},
+    {"fragmented", 4,    1,    200,   64000,     1 * MB,    "dat", false,     true},
+};
+const size_t NUM_BENCH_TREES = sizeof(BENCH_TREES) / sizeof(BENCH_TREES[0]);
+
+const TreeSpec *findTreeSpec(const std::string &name) {
+    for (const TreeSpec &spec : BENCH_TREES) {
+        if (name == spec.name) {
+            return &spec;
+        }
+    }
+    return nullptr;
+}
+
+void fillSyntheticData(BYTE *buf, size_t len, uint64_t seed, uint64_t offset) {
+    size_t i = 0;
+    while (i < len) {
+        uint64_t pos = offset + i;
+        uint64_t state = seed + (pos / 8) * 0xD1B54A32D192ED03ULL;
+        uint64_t word = splitmix64(&state);
+        size_t skip = (size_t) (pos % 8);
+        size_t n = 8 - skip < len - i ? 8 - skip : len - i;
+        memcpy(buf + i, reinterpret_cast<BYTE *>(&word) + skip, n);
+        i += n;
+    }
+}
+
+struct TreeWriter {
+    const TreeSpec *spec;
+    UINT32 filesPerDir;
+    double sizeScale;
+    uint64_t rng;
+    ULONGLONG firstDate;
+    ULONGLONG dateRange;
+    bool write;
+    std::vector<BYTE> buf;
+    TreeStats *stats;
+};
+
+static bool writeFile(TreeWriter *writer, const std::string &path, uint64_t sizeBytes, uint64_t contentSeed,
+                      ULONGLONG date) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = true;
+    for (uint64_t offset = 0; ok && offset < sizeBytes; offset += WRITE_CHUNK_SIZE) {
+        DWORD len = (DWORD) (sizeBytes - offset < WRITE_CHUNK_SIZE ? sizeBytes - offset : WRITE_CHUNK_SIZE);
+        fillSyntheticData(writer->buf.data(), len, contentSeed, offset);
+        DWORD bytesWritten = 0;
+        ok = WriteFile(file, writer->buf.data(), len, &bytesWritten, nullptr) && bytesWritten == len;
+    }
+    // The layout files everything under its creation date
+    FILETIME fileTime;
+    fileTime.dwLowDateTime = (DWORD) date;
+    fileTime.dwHighDateTime = (DWORD) (date >> 32);
+    SetFileTime(file, &fileTime, nullptr, &fileTime);
+    CloseHandle(file);
+    return ok;
+}
+
+// One file of a fragmented directory
+struct PendingFile {
+    std::string path;
+    uint64_t sizeBytes;
+    uint64_t contentSeed;
+    ULONGLONG date;
+    HANDLE handle;
+};
+
+// Writes a directory's files FRAGMENT_CHUNK_SIZE at a time each in turn, in
+// shuffled order, so their data interleaves and name order no longer
+// matches disk order: a stand-in for a card or disk image that has been
+// filled and emptied for years.
+static bool writeInterleaved(TreeWriter *writer, std::vector<PendingFile> *files, uint64_t shuffleSeed) {
+    for (size_t i = files->size(); i > 1; i--) {
+        std::swap((*files)[i - 1], (*files)[splitmix64(&shuffleSeed) % i]);
+    }
+    bool ok = true;
+    for (PendingFile &file : *files) {
+        file.handle = CreateFileA(file.path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                                  nullptr);
+        ok = ok && file.handle != INVALID_HANDLE_VALUE;
+    }
+    for (uint64_t offset = 0, written = 1; ok && written > 0; offset += FRAGMENT_CHUNK_SIZE) {
+        written = 0;
+        for (const PendingFile &file : *files) {
+            if (offset >= file.sizeBytes) {
+                continue;
+            }
+            DWORD len = (DWORD) (std::min)((uint64_t) FRAGMENT_CHUNK_SIZE, file.sizeBytes - offset);
+            fillSyntheticData(writer->buf.data(), len, file.contentSeed, offset);
+            DWORD bytesWritten = 0;
+            ok = ok && WriteFile(file.handle, writer->buf.data(), len, &bytesWritten, nullptr) && bytesWritten == len;
+            written += len;
+        }
+    }
+    for (const PendingFile &file : *files) {
+        if (file.handle == INVALID_HANDLE_VALUE) {
+            continue;
+        }
+        FILETIME fileTime;
+        fileTime.dwLowDateTime = (DWORD) file.date;
+        fileTime.dwHighDateTime = (DWORD) (file.date >> 32);
+        SetFileTime(file.handle, &fileTime, nullptr, &fileTime);
+        CloseHandle(file.handle);
+    }
+    return ok;
+}
+
+static bool generateDir(TreeWriter *writer, const std::string &dir, UINT32 level) {
+    const TreeSpec *spec = writer->spec;
+    if (writer->write) {
+        CreateDirectoryA(dir.c_str(), nullptr);
+    }
+    writer->stats->dirs++;
+    char name[64];
+    std::vector<PendingFile> interleaved;
+    for (UINT32 i = 0; i < writer->filesPerDir; i++) {
+        uint64_t span = spec->maxSize - spec->minSize + 1;
+        uint64_t sizeBytes = (uint64_t) ((spec->minSize + splitmix64(&writer->rng) % span) * writer->sizeScale);
+        uint64_t contentSeed = splitmix64(&writer->rng);
+        ULONGLONG date = writer->firstDate + splitmix64(&writer->rng) % writer->dateRange;
+        snprintf(name, sizeof(name), "\\%s_%05llu.%s", spec->name,
+                 (unsigned long long) writer->stats->files, spec->extension);
+        if (spec->fragmented) {
+            interleaved.push_back(PendingFile{dir + name, sizeBytes, contentSeed, date, INVALID_HANDLE_VALUE});
+        } else if (writer->write && !writeFile(writer, dir + name, sizeBytes, contentSeed, date)) {
+            return false;
+        }
+        writer->stats->files++;
+        writer->stats->bytes += sizeBytes;
+    }
+    // Shuffled by the directory's first file, so the sizes and contents
+    // drawn for later directories do not depend on whether files are written
+    if (writer->write && !interleaved.empty() && !writeInterleaved(writer, &interleaved, interleaved[0].contentSeed)) {
+        return false;
+    }
+    if (level < spec->depth) {
+        for (UINT32 i = 0; i < spec->fanout; i++) {
+            snprintf(name, sizeof(name), "\\d%04u", i);
+            if (!generateDir(writer, dir + name, level + 1)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool generateTree(const TreeSpec *spec, const std::string &root, double scale, uint64_t seed, TreeStats *stats) {
+    std::stringstream stamp;
+    stamp << STAMP_VERSION << ' ' << spec->name << ' ' << scale << ' ' << seed;
+    std::string stampPath = root + BENCH_STAMP_EXTENSION;
+
+    TreeWriter writer;
+    writer.spec = spec;
+    writer.filesPerDir = spec->filesPerDir;
+    writer.sizeScale = 1;
+    if (spec->scaleSizes) {
+        writer.sizeScale = scale;
+    } else {
+        double files = spec->filesPerDir * scale;
+        writer.filesPerDir = files < 1 ? 1 : (UINT32) (files + 0.5);
+    }
+    writer.rng = seed ^ std::hash<std::string>()(spec->name);
+    SYSTEMTIME first = {2019, 1, 0, 1};
+    SYSTEMTIME last = {2025, 1, 0, 1};
+    FILETIME firstTime, lastTime;
+    SystemTimeToFileTime(&first, &firstTime);
+    SystemTimeToFileTime(&last, &lastTime);
+    writer.firstDate = ((ULONGLONG) firstTime.dwHighDateTime << 32) | firstTime.dwLowDateTime;
+    writer.dateRange = (((ULONGLONG) lastTime.dwHighDateTime << 32) | lastTime.dwLowDateTime) - writer.firstDate;
+    *stats = TreeStats{};
+    writer.stats = stats;
+
+    // A matching stamp means the files are already there; the walk still
+    // runs to fill in the stats
+    std::ifstream stampIn(stampPath);
+    std::string existing;
+    std::getline(stampIn, existing);
+    writer.write = existing != stamp.str();
+    if (writer.write) {
+        std::error_code ec;
+        std::filesystem::remove_all(root, ec);
+        std::filesystem::create_directories(root, ec);
+        writer.buf.resize(WRITE_CHUNK_SIZE);
+    }
+    if (!generateDir(&writer, root, 0)) {
+        return false;
+    }
+    if (writer.write) {
+        std::ofstream stampOut(stampPath);
+        stampOut << stamp.str() << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+// Written beside a generated tree, never inside it, so it is not backed up
+#define BENCH_STAMP_EXTENSION   ".stamp"
+
+// One synthetic source tree. Directories branch fanout ways for depth
+// levels below the root and every directory holds filesPerDir files.
+struct TreeSpec {
+    const char *name;
+    UINT32 fanout;
+    UINT32 depth;
+    UINT32 filesPerDir;
+    uint64_t minSize;
+    uint64_t maxSize;
+    const char *extension;
+    bool scaleSizes;            // --scale shrinks file sizes instead of counts
+    bool fragmented;            // files are written interleaved, out of name order
+};
+
+struct TreeStats {
+    uint64_t files;
+    uint64_t bytes;
+    UINT32 dirs;
+};
+
+extern const TreeSpec BENCH_TREES[];
+extern const size_t NUM_BENCH_TREES;
+
+const TreeSpec *findTreeSpec(const std::string &name);
+
+// Writes the tree under root unless an identical earlier run left its
+// stamp beside it. Sizes, contents and creation times derive only from the
+// seed, so every run benchmarks the same bytes. Returns false if a file
+// could not be written.
+bool generateTree(const TreeSpec *spec, const std::string &root, double scale, uint64_t seed, TreeStats *stats);
+
+// SplitMix64 step: a fast, well-mixed generator for synthetic data
+inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Fills buf with the bytes at offset of the endless stream named by seed,
+// so a stream can be generated in any order and chunk size.
+void fillSyntheticData(BYTE *buf, size_t len, uint64_t seed, uint64_t offset);
@@ -0,0 +1,161 @@
+#include "catalog.h"
+#include "hash.h"
+
+// On-disk layout (little endian, no padding):
+//   header: char magic[4], uint32_t version
+//   record: uint64_t checksum, uint64_t length, uint16_t locationLen,
+//           char location[locationLen] (relative to the catalog's folder),
+//           uint32_t check (low half of the XXH64 of everything before it)
+static const char CATALOG_MAGIC[4] = {'B', 'B', 'C', 'T'};
+static const uint32_t CATALOG_VERSION = 1;
+static const size_t HEADER_SIZE = sizeof(CATALOG_MAGIC) + sizeof(uint32_t);
+static const size_t RECORD_FIXED_SIZE = 2 * sizeof(uint64_t) + sizeof(uint16_t);
+
+template <typename T>
+static T readField(const char **cursor) {
+    T value;
+    memcpy(&value, *cursor, sizeof(T));
+    *cursor += sizeof(T);
+    return value;
+}
+
+template <typename T>
+static void appendField(std::string *out, T value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+BackupCatalog::~BackupCatalog() {
+    flush();
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+
+void BackupCatalog::add(const std::string &location, uint64_t length, uint64_t checksum) {
+    // Everything this run writes is under dir, so store it relative
+    std::string_view relative(location);
+    if (relative.compare(0, dir.size(), dir) == 0) {
+        relative.remove_prefix(dir.size());
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t start = buffer.size();
+    appendField<uint64_t>(&buffer, checksum);
+    appendField<uint64_t>(&buffer, length);
+    appendField<uint16_t>(&buffer, (uint16_t) relative.size());
+    buffer.append(relative);
+    appendField<uint32_t>(&buffer, (uint32_t) xxh64(buffer.data() + start, buffer.size() - start));
+    if (++bufferedRecords >= CATALOG_FLUSH_RECORDS) {
+        writeOut();
+    }
+}
+
+bool BackupCatalog::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return writeOut();
+}
+
+bool BackupCatalog::writeOut() {
+    if (bufferedRecords == 0) {
+        return true;
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        SYSTEMTIME now;
+        GetSystemTime(&now);
+        char name[64];
+        snprintf(name, sizeof(name), CATALOG_FILE_PREFIX "%04u%02u%02uT%02u%02u%02u%03u" CATALOG_FILE_EXTENSION,
+                 now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+        file = CreateFileA((dir + name).c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_NEW,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            buffer.clear();
+            bufferedRecords = 0;
+            return false;
+        }
+        std::string header(CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+        appendField<uint32_t>(&header, CATALOG_VERSION);
+        buffer.insert(0, header);
+    }
+    DWORD bytesWritten = 0;
+    bool ok = WriteFile(file, buffer.data(), (DWORD) buffer.size(), &bytesWritten, nullptr)
+            && bytesWritten == buffer.size();
+    buffer.clear();
+    bufferedRecords = 0;
+    return ok;
+}
+
+// A drive-letter or UNC path, stored as is because it was outside the folder
+static bool isAbsolute(std::string_view location) {
+    return (location.size() > 1 && location[1] == ':') || location.compare(0, 2, "\\\\") == 0;
+}
+
+// Adds the valid records of one catalog to byLocation
+static void readCatalog(const std::string &dir, const std::string &path,
+                        std::unordered_map<std::string, CatalogEntry> *byLocation) {
+    HANDLE in = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (in == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER fileSize;
+    std::vector<char> blob;
+    DWORD bytesRead = 0;
+    bool readOk = GetFileSizeEx(in, &fileSize) && fileSize.QuadPart >= (LONGLONG) HEADER_SIZE
+            && fileSize.QuadPart <= MAXDWORD;
+    if (readOk) {
+        blob.resize((size_t) fileSize.QuadPart);
+        readOk = ReadFile(in, blob.data(), (DWORD) blob.size(), &bytesRead, nullptr) && bytesRead == blob.size();
+    }
+    CloseHandle(in);
+    const char *cursor = blob.data() + sizeof(CATALOG_MAGIC);
+    if (!readOk || memcmp(blob.data(), CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0
+            || readField<uint32_t>(&cursor) != CATALOG_VERSION) {
+        return;
+    }
+
+    const char *end = blob.data() + blob.size();
+    while ((size_t) (end - cursor) >= RECORD_FIXED_SIZE) {
+        const char *start = cursor;
+        uint64_t checksum = readField<uint64_t>(&cursor);
+        uint64_t length = readField<uint64_t>(&cursor);
+        uint16_t locationLen = readField<uint16_t>(&cursor);
+        if ((size_t) (end - cursor) < (size_t) locationLen + sizeof(uint32_t)) {
+            break;
+        }
+        std::string_view location(cursor, locationLen);
+        cursor += locationLen;
+        uint32_t check = (uint32_t) xxh64(start, cursor - start);
+        if (readField<uint32_t>(&cursor) != check) {
+            break;
+        }
+        std::string fullPath = isAbsolute(location) ? std::string(location) : dir + std::string(location);
+        (*byLocation)[fullPath] = CatalogEntry{fullPath, length, checksum};
+    }
+}
+
+size_t loadCatalogs(const std::string &rootDir, std::vector<CatalogEntry> *entries) {
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(rootDir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() > strlen(CATALOG_FILE_PREFIX) + strlen(CATALOG_FILE_EXTENSION)
+                && name.compare(0, strlen(CATALOG_FILE_PREFIX), CATALOG_FILE_PREFIX) == 0
+                && name.compare(name.size() - strlen(CATALOG_FILE_EXTENSION), std::string::npos,
+                                CATALOG_FILE_EXTENSION) == 0) {
+            paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::unordered_map<std::string, CatalogEntry> byLocation;
+    for (const std::string &path : paths) {
+        readCatalog(rootDir, path, &byLocation);
+    }
+    for (auto &kv : byLocation) {
+        entries->push_back(std::move(kv.second));
+    }
+    // Keeps each pack segment's ranges and each folder's files together
+    std::sort(entries->begin(), entries->end(), [](const CatalogEntry &a, const CatalogEntry &b) {
+        return a.location < b.location;
+    });
+    return paths.size();
+}
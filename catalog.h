@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+
+// Each run writes "bulldozer.<UTC time>.catalog" beside the manifest, so
+// sorting a source's catalogs by name puts them in run order.
+#define CATALOG_FILE_PREFIX     "bulldozer."
+#define CATALOG_FILE_EXTENSION  ".catalog"
+#define CATALOG_FLUSH_RECORDS   256
+
+// What one destination file or packed range should contain: its length and
+// the XXH64 of its bytes as they were written. location is a full path, or
+// "<segment>@<offset>" for a packed file.
+struct CatalogEntry {
+    std::string location;
+    uint64_t length;
+    uint64_t checksum;
+};
+
+// Checksums of everything one run wrote for a source, hashed by the copy
+// path on its way through memory so that the backup can be verified later
+// without trusting the copy call. Records are buffered and appended in
+// batches; a crash can only tear the last one, which readers skip.
+class BackupCatalog {
+public:
+    // rootDir is the source's destination folder, with trailing separator
+    explicit BackupCatalog(std::string rootDir) : dir(std::move(rootDir)) {}
+    ~BackupCatalog();
+
+    BackupCatalog(const BackupCatalog &) = delete;
+    BackupCatalog &operator=(const BackupCatalog &) = delete;
+
+    void add(const std::string &location, uint64_t length, uint64_t checksum);
+    // Writes buffered records, creating this run's catalog on first use
+    bool flush();
+
+private:
+    bool writeOut();
+
+    std::string dir;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::string buffer;
+    size_t bufferedRecords = 0;
+    std::mutex mutex;
+};
+
+// Reads every catalog in rootDir in run order. Only the newest record for
+// each location is kept, as a changed file replaces its earlier copy.
+// Returns the number of catalog files read.
+size_t loadCatalogs(const std::string &rootDir, std::vector<CatalogEntry> *entries);
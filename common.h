@@ -7,7 +7,19 @@
 #include <sstream>
 #include <filesystem>
 #include <string>
+#include <string_view>
+#include <cstring>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <memory>
 
 // WPD/ATL
 #include <PortableDeviceApi.h>
@@ -33,6 +45,5 @@ struct IndexedDrive : Drive {
     bool isWPD;
 };
 
-struct WPDevice : Drive {
-    PCWSTR deviceId;
-};
\ No newline at end of file
+// path is the device's PnP device ID
+struct WPDevice : Drive {};
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "compress.h"
+#include "hash.h"
+#include <compressapi.h>
+
+// Container layout (little endian, no padding):
+//   header: char magic[4], uint32_t version, uint32_t algorithm,
+//           uint32_t blockSize, uint64_t originalSize
+//   block:  uint8_t compressed, uint32_t rawLen, uint32_t storedLen,
+//           uint32_t check (low half of the XXH64 of the raw bytes),
+//           char data[storedLen]
+// Every block but the last holds blockSize raw bytes. Compressed blocks are
+// Windows Compression API buffers of the header's algorithm, stored ones
+// are the raw bytes.
+static const char COMPRESS_MAGIC[4] = {'B', 'B', 'Z', 'C'};
+static const uint32_t COMPRESS_VERSION = 1;
+static const DWORD COMPRESS_ALGORITHM = COMPRESS_ALGORITHM_XPRESS_HUFF;
+
+template <typename T>
+static void appendField(std::string *out, T value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static bool writeAll(HANDLE file, const void *data, size_t len) {
+    DWORD bytesWritten = 0;
+    return WriteFile(file, data, (DWORD) len, &bytesWritten, nullptr) && bytesWritten == len;
+}
+
+BlockCompressor::BlockCompressor(UINT numThreads)
+        : numThreads(numThreads > 0 ? numThreads : 1), tasks(this->numThreads * 4) {
+    for (UINT i = 0; i < this->numThreads; i++) {
+        threads.emplace_back(&BlockCompressor::worker, this);
+    }
+}
+
+BlockCompressor::~BlockCompressor() {
+    tasks.close();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// Compressor handles are not thread-safe, so each pool thread owns one.
+// Without one every block is stored, which makes the sample fail and the
+// file get copied normally.
+void BlockCompressor::worker() {
+    COMPRESSOR_HANDLE compressor = nullptr;
+    if (!CreateCompressor(COMPRESS_ALGORITHM, nullptr, &compressor)) {
+        compressor = nullptr;
+    }
+    BlockTask *task;
+    while (tasks.pop(&task)) {
+        task->stored.resize(task->rawLen);
+        SIZE_T compressedSize = 0;
+        task->compressed = compressor != nullptr
+                && Compress(compressor, task->raw.data(), task->rawLen, task->stored.data(), task->stored.size(),
+                            &compressedSize)
+                && compressedSize < task->rawLen;
+        task->storedLen = task->compressed ? (DWORD) compressedSize : task->rawLen;
+        task->check = (uint32_t) xxh64(task->raw.data(), task->rawLen);
+
+        BlockGroup *group = task->group;
+        std::lock_guard<std::mutex> lock(group->mutex);
+        if (--group->remaining == 0) {
+            group->done.notify_one();
+        }
+    }
+    if (compressor != nullptr) {
+        CloseCompressor(compressor);
+    }
+}
+
+void BlockCompressor::runTasks(BlockTask *blocks, size_t numTasks) {
+    BlockGroup group;
+    group.remaining = numTasks;
+    for (size_t i = 0; i < numTasks; i++) {
+        blocks[i].group = &group;
+        tasks.push(&blocks[i]);
+    }
+    std::unique_lock<std::mutex> lock(group.mutex);
+    group.done.wait(lock, [&group] { return group.remaining == 0; });
+}
+
+// Reads up to one window of blocks (one per pool thread) at a time, so
+// memory stays bounded while every thread has a block to work on.
+CompressStatus BlockCompressor::compressFile(const std::string &srcPath, const std::string &partialPath,
+                                             const std::string &dstPath, bool overwrite,
+                                             WriteScheduler *scheduler, uint64_t *storedBytes,
+                                             uint64_t *checksum) {
+    *storedBytes = 0;
+    HANDLE srcFile = CreateFileA(srcPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (srcFile == INVALID_HANDLE_VALUE) {
+        return COMPRESS_FAILED;
+    }
+    LARGE_INTEGER srcSize;
+    if (!GetFileSizeEx(srcFile, &srcSize)) {
+        CloseHandle(srcFile);
+        return COMPRESS_FAILED;
+    }
+
+    std::vector<BlockTask> window(numThreads);
+    uint64_t remaining = (uint64_t) srcSize.QuadPart;
+    auto readBlock = [&](BlockTask *block) {
+        block->rawLen = (DWORD) (std::min)(remaining, (uint64_t) COMPRESS_BLOCK_SIZE);
+        block->raw.resize(COMPRESS_BLOCK_SIZE);
+        DWORD bytesRead = 0;
+        if (!ReadFile(srcFile, block->raw.data(), block->rawLen, &bytesRead, nullptr)
+                || bytesRead != block->rawLen) {
+            return false;
+        }
+        remaining -= block->rawLen;
+        return true;
+    };
+
+    // The first block doubles as the sample
+    if (!readBlock(&window[0])) {
+        CloseHandle(srcFile);
+        return COMPRESS_FAILED;
+    }
+    runTasks(window.data(), 1);
+    if (!window[0].compressed || window[0].storedLen > window[0].rawLen * COMPRESS_MAX_RATIO) {
+        CloseHandle(srcFile);
+        return COMPRESS_SKIPPED;
+    }
+
+    HANDLE dstFile = CreateFileA(partialPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (dstFile == INVALID_HANDLE_VALUE) {
+        CloseHandle(srcFile);
+        return COMPRESS_FAILED;
+    }
+    std::string frame;
+    frame.append(COMPRESS_MAGIC, sizeof(COMPRESS_MAGIC));
+    appendField<uint32_t>(&frame, COMPRESS_VERSION);
+    appendField<uint32_t>(&frame, COMPRESS_ALGORITHM);
+    appendField<uint32_t>(&frame, COMPRESS_BLOCK_SIZE);
+    appendField<uint64_t>(&frame, (uint64_t) srcSize.QuadPart);
+    bool ok;
+    {
+        WriteSlot slot(scheduler);
+        ok = writeAll(dstFile, frame.data(), frame.size());
+    }
+    *storedBytes += frame.size();
+    Xxh64 hash;
+    hash.update(frame.data(), frame.size());
+
+    size_t ready = 1;
+    while (ok) {
+        size_t filled = ready;
+        while (filled < window.size() && remaining > 0 && (ok = readBlock(&window[filled]))) {
+            filled++;
+        }
+        if (!ok) {
+            break;
+        }
+        runTasks(window.data() + ready, filled - ready);
+
+        WriteSlot slot(scheduler);
+        for (size_t i = 0; i < filled && ok; i++) {
+            const BlockTask &block = window[i];
+            frame.clear();
+            appendField<uint8_t>(&frame, block.compressed ? 1 : 0);
+            appendField<uint32_t>(&frame, block.rawLen);
+            appendField<uint32_t>(&frame, block.storedLen);
+            appendField<uint32_t>(&frame, block.check);
+            const char *payload = block.compressed ? block.stored.data() : block.raw.data();
+            ok = writeAll(dstFile, frame.data(), frame.size()) && writeAll(dstFile, payload, block.storedLen);
+            *storedBytes += frame.size() + block.storedLen;
+            hash.update(frame.data(), frame.size());
+            hash.update(payload, block.storedLen);
+        }
+        if (remaining == 0) {
+            break;
+        }
+        ready = 0;
+    }
+    CloseHandle(srcFile);
+    CloseHandle(dstFile);
+
+    if (!ok || !MoveFileExA(partialPath.c_str(), dstPath.c_str(), overwrite ? MOVEFILE_REPLACE_EXISTING : 0)) {
+        DeleteFileA(partialPath.c_str());
+        return COMPRESS_FAILED;
+    }
+    *checksum = hash.digest();
+    return COMPRESS_DONE;
+}
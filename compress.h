@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common.h"
+#include "queue.h"
+#include "scheduler.h"
+
+// Compressed copies are named after the original plus this suffix
+#define COMPRESSED_FILE_SUFFIX  ".bdz"
+#define COMPRESS_BLOCK_SIZE     (1024 * 1024)
+// Smaller files would mostly be container overhead and thread hand-offs
+#define COMPRESS_MIN_SIZE       (64 * 1024)
+// The first block must shrink to this fraction of its size, otherwise the
+// file (typically JPEG, HEIC or MP4) is copied as is
+#define COMPRESS_MAX_RATIO      0.9
+
+enum CompressStatus {
+    COMPRESS_DONE,
+    COMPRESS_SKIPPED,   // the sample block did not compress, copy normally
+    COMPRESS_FAILED
+};
+
+// Splits files into independent COMPRESS_BLOCK_SIZE blocks and compresses
+// them on a shared pool of threads, so one large log or raw export uses
+// every core instead of making its copy worker CPU-bound.
+//
+// The container records the block size and original length up front and
+// frames every block with its raw length, stored length and a checksum of
+// the raw bytes, so any block can be expanded and verified on its own.
+// Blocks that do not shrink are stored uncompressed.
+class BlockCompressor {
+public:
+    explicit BlockCompressor(UINT numThreads);
+    ~BlockCompressor();
+
+    BlockCompressor(const BlockCompressor &) = delete;
+    BlockCompressor &operator=(const BlockCompressor &) = delete;
+
+    bool accepts(uint64_t sizeBytes) const { return sizeBytes >= COMPRESS_MIN_SIZE; }
+
+    // Compresses srcPath into partialPath and renames it to dstPath,
+    // replacing an existing file only when overwrite is set. The window
+    // of compressed blocks is written under a slot from scheduler.
+    // *storedBytes and *checksum are set to the container's size and the
+    // XXH64 of its bytes.
+    CompressStatus compressFile(const std::string &srcPath, const std::string &partialPath,
+                                const std::string &dstPath, bool overwrite, WriteScheduler *scheduler,
+                                uint64_t *storedBytes, uint64_t *checksum);
+
+private:
+    // Blocks of one compressFile() call, counted down by the pool
+    struct BlockGroup {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining = 0;
+    };
+
+    struct BlockTask {
+        std::vector<char> raw;
+        DWORD rawLen = 0;
+        std::vector<char> stored;
+        DWORD storedLen = 0;
+        bool compressed = false;
+        uint32_t check = 0;
+        BlockGroup *group = nullptr;
+    };
+
+    void worker();
+    void runTasks(BlockTask *blocks, size_t numTasks);
+
+    UINT numThreads;
+    BoundedQueue<BlockTask *> tasks;
+    std::vector<std::thread> threads;
+};
@@ -0,0 +1,137 @@
+#include "concurrency.h"
+#include "backup.h"
+
+static const char *REASON_NAMES[] = {"ramp", "knee", "backoff", "probe"};
+
+AdaptiveConcurrency::AdaptiveConcurrency(UINT maxWorkers, const std::atomic<int64_t> *bytes,
+                                         const std::atomic<int64_t> *files)
+        : maxWorkers(maxWorkers > 0 ? maxWorkers : 1), bytes(bytes), files(files) {}
+
+AdaptiveConcurrency::~AdaptiveConcurrency() {
+    stop();
+}
+
+void AdaptiveConcurrency::start() {
+    sampler = std::thread(&AdaptiveConcurrency::run, this);
+}
+
+void AdaptiveConcurrency::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopCv.notify_all();
+    if (sampler.joinable()) {
+        sampler.join();
+    }
+}
+
+void AdaptiveConcurrency::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return active < limit; });
+    active++;
+}
+
+void AdaptiveConcurrency::release(int64_t ns) {
+    heldNs.fetch_add(ns, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active--;
+    }
+    cv.notify_one();
+}
+
+void AdaptiveConcurrency::run() {
+    int64_t startTime = getCurrentMsTime();
+    int64_t sampleTime = startTime;
+    int64_t sampleBytes = bytes->load();
+    int64_t sampleFiles = files->load();
+    int64_t sampleHeldNs = heldNs.load();
+    std::unique_lock<std::mutex> lock(stopMutex);
+    while (!stopCv.wait_for(lock, std::chrono::milliseconds(CONCURRENCY_SAMPLE_MS), [this] { return stopping; })) {
+        int64_t now = getCurrentMsTime();
+        int64_t doneFiles = files->load() - sampleFiles;
+        if (doneFiles < CONCURRENCY_SAMPLE_FILES
+                && (doneFiles == 0 || now - sampleTime < CONCURRENCY_LONG_SAMPLE_MS)) {
+            continue;
+        }
+        // Slot time is only added when a slot is given back, so a long
+        // copy can push this above 1; that still counts as busy
+        double seconds = (now - sampleTime) / 1000.0;
+        double sampleHeldMs = (heldNs.load() - sampleHeldNs) / 1e6;
+        if (sampleHeldMs >= seconds * 1000 * limit * CONCURRENCY_MIN_BUSY) {
+            decide((now - startTime) / 1000.0, (bytes->load() - sampleBytes) / seconds, sampleHeldMs / doneFiles);
+        }
+        sampleTime = now;
+        sampleBytes = bytes->load();
+        sampleFiles = files->load();
+        sampleHeldNs = heldNs.load();
+    }
+}
+
+// Samples ending just after a change are measured mostly at the new count,
+// since slots are held a batch or an object at a time.
+void AdaptiveConcurrency::decide(double atSeconds, double bytesPerSec, double fileMs) {
+    UINT from = limit;
+    UINT to = limit;
+    ConcurrencyReason reason = CONCURRENCY_RAMP;
+    if (baselineBytesPerSec == 0) {
+        to = (std::min)(limit + 1, maxWorkers);
+        baselineBytesPerSec = bytesPerSec;
+        baselineFileMs = fileMs;
+    } else if (steppedUp) {
+        if (bytesPerSec >= baselineBytesPerSec * (1 + CONCURRENCY_GAIN)) {
+            to = (std::min)(limit + 1, maxWorkers);
+            baselineBytesPerSec = bytesPerSec;
+            baselineFileMs = fileMs;
+        } else {
+            to = limit - 1;
+            reason = CONCURRENCY_KNEE;
+        }
+    } else if (limit > 1 && bytesPerSec < baselineBytesPerSec * (1 - CONCURRENCY_DROP)
+               && fileMs > baselineFileMs * (1 + CONCURRENCY_DROP)) {
+        to = (std::max)(limit / 2, 1u);
+        reason = CONCURRENCY_BACKOFF;
+        baselineBytesPerSec = bytesPerSec;
+        baselineFileMs = fileMs;
+    } else {
+        // Steady: follow slow drift, such as bigger files later in the walk
+        baselineBytesPerSec = (baselineBytesPerSec + bytesPerSec) / 2;
+        baselineFileMs = (baselineFileMs + fileMs) / 2;
+        if (++steadySamples >= CONCURRENCY_PROBE_SAMPLES && limit < maxWorkers) {
+            to = limit + 1;
+            reason = CONCURRENCY_PROBE;
+        }
+    }
+    steppedUp = to > from;
+    if (to == from) {
+        return;
+    }
+    steadySamples = 0;
+    peakLimit = (std::max)(peakLimit, to);
+    if (decisions.size() < CONCURRENCY_LOG_LIMIT) {
+        decisions.push_back(ConcurrencyDecision{atSeconds, from, to, bytesPerSec, fileMs, reason});
+    } else {
+        unloggedDecisions++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = to;
+    }
+    cv.notify_all();
+}
+
+void AdaptiveConcurrency::printDecisions(const std::string &label) const {
+    std::cout << label << ": adaptive concurrency ended at " << limit << " of " << maxWorkers << " workers (peak "
+        << peakLimit << ") after " << decisions.size() + unloggedDecisions << " changes." << std::endl;
+    char line[160];
+    for (const ConcurrencyDecision &decision : decisions) {
+        snprintf(line, sizeof(line), "%8.1f s  %2u -> %-2u  %s/s, %.1f ms per file (%s)", decision.atSeconds,
+                 decision.from, decision.to, bytesHumanReadable((int64_t) decision.bytesPerSec).c_str(),
+                 decision.fileMs, REASON_NAMES[decision.reason]);
+        std::cout << label << ": " << line << std::endl;
+    }
+    if (unloggedDecisions > 0) {
+        std::cout << label << ": ... and " << unloggedDecisions << " more." << std::endl;
+    }
+}
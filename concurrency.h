@@ -0,0 +1,121 @@
+#pragma once
+
+#include "common.h"
+#include "stats.h"
+
+// A sample covers at least this long and this many finished files, or
+// any finished file at all once it has run CONCURRENCY_LONG_SAMPLE_MS, as
+// happens with large videos. One in which the slots were mostly free, such
+// as a followed folder sitting idle, is dropped without a decision.
+#define CONCURRENCY_SAMPLE_MS       1000
+#define CONCURRENCY_SAMPLE_FILES    8
+#define CONCURRENCY_LONG_SAMPLE_MS  10000
+#define CONCURRENCY_MIN_BUSY        0.5
+// A worker added must raise throughput this much to stay
+#define CONCURRENCY_GAIN            0.08
+// Throughput down and per-file latency up this much halves the workers
+#define CONCURRENCY_DROP            0.3
+// Steady samples before trying one more worker again
+#define CONCURRENCY_PROBE_SAMPLES   10
+// Decisions kept for the summary; later ones are only counted
+#define CONCURRENCY_LOG_LIMIT       64
+
+enum ConcurrencyReason {
+    CONCURRENCY_RAMP,       // the last worker added paid off, so add another
+    CONCURRENCY_KNEE,       // it did not, so take it back
+    CONCURRENCY_BACKOFF,    // throughput collapsed while latency rose
+    CONCURRENCY_PROBE       // steady for a while, so see if conditions changed
+};
+
+struct ConcurrencyDecision {
+    double atSeconds;       // since start()
+    UINT from;
+    UINT to;
+    double bytesPerSec;     // over the sample that led to it
+    double fileMs;          // mean time a worker held its slot per finished file
+    ConcurrencyReason reason;
+};
+
+// Finds the throughput knee of one source by letting only some of its
+// workers copy at once. Starting from one, it adds a worker per sample
+// while that raises bytes/s by CONCURRENCY_GAIN, takes the last one back
+// when it does not, and halves the count when throughput collapses as
+// latency climbs (additive increase, multiplicative decrease). Workers
+// hold a ConcurrencySlot per batch or object.
+class AdaptiveConcurrency {
+public:
+    // maxWorkers is how many workers the source started; bytes and files
+    // are the source's running totals of finished copies.
+    AdaptiveConcurrency(UINT maxWorkers, const std::atomic<int64_t> *bytes, const std::atomic<int64_t> *files);
+    ~AdaptiveConcurrency();
+
+    AdaptiveConcurrency(const AdaptiveConcurrency &) = delete;
+    AdaptiveConcurrency &operator=(const AdaptiveConcurrency &) = delete;
+
+    // Starts and stops the sampling thread
+    void start();
+    void stop();
+
+    void acquire();
+    void release(int64_t heldNs);
+
+    // One line per decision, prefixed with label; call after stop()
+    void printDecisions(const std::string &label) const;
+
+private:
+    void run();
+    void decide(double atSeconds, double bytesPerSec, double fileMs);
+
+    const UINT maxWorkers;
+    const std::atomic<int64_t> *bytes;
+    const std::atomic<int64_t> *files;
+    std::atomic<int64_t> heldNs{0};
+
+    UINT limit = 1;
+    UINT active = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // Only touched by the sampling thread
+    double baselineBytesPerSec = 0;
+    double baselineFileMs = 0;
+    bool steppedUp = false;
+    UINT steadySamples = 0;
+    UINT peakLimit = 1;
+    std::vector<ConcurrencyDecision> decisions;
+    size_t unloggedDecisions = 0;
+
+    std::thread sampler;
+    bool stopping = false;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+};
+
+// Holds one of a source's concurrency slots for its lifetime, timing how
+// long; a null controller means every worker runs.
+class ConcurrencySlot {
+public:
+    explicit ConcurrencySlot(AdaptiveConcurrency *concurrency) : concurrency(concurrency) {
+        if (concurrency != nullptr) {
+            concurrency->acquire();
+            startTime = getCurrentNsTime();
+        }
+    }
+    // Leaves out time spent waiting for work after the slot was taken
+    void restartTimer() {
+        startTime = getCurrentNsTime();
+    }
+
+    ~ConcurrencySlot() {
+        if (concurrency != nullptr) {
+            concurrency->release(getCurrentNsTime() - startTime);
+        }
+    }
+
+    ConcurrencySlot(const ConcurrencySlot &) = delete;
+    ConcurrencySlot &operator=(const ConcurrencySlot &) = delete;
+
+private:
+    AdaptiveConcurrency *concurrency;
+    int64_t startTime = 0;
+};
@@ -0,0 +1,184 @@
+#include "copybackend.h"
+#include "hash.h"
+
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <vector>
+#include <windows.h>
+
+// Covers 512e and 4Kn drives; COPY_CHUNK_SIZE is a multiple of it
+static const DWORD SECTOR_ALIGN = 4096;
+
+// One chunk buffer per copy thread, from VirtualAlloc so it is page aligned
+// and so sector aligned too
+struct ChunkBuffer {
+    BYTE *data = (BYTE *) VirtualAlloc(nullptr, COPY_CHUNK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    ~ChunkBuffer() {
+        if (data != nullptr) {
+            VirtualFree(data, 0, MEM_RELEASE);
+        }
+    }
+};
+
+// Copies through the calling thread's chunk buffer, hashing each chunk
+// between its read and its write. Unbuffered copies bypass the cache
+// manager and write whole sectors.
+static bool streamCopy(const char *srcPath, const char *dstPath, bool overwrite, bool unbuffered,
+                       uint64_t *checksum) {
+    static thread_local ChunkBuffer buffer;
+    BYTE *buf = buffer.data;
+    if (buf == nullptr) {
+        return false;
+    }
+    HANDLE src = CreateFileA(srcPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             (unbuffered ? FILE_FLAG_NO_BUFFERING : 0) | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (src == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    HANDLE dst = CreateFileA(dstPath, GENERIC_WRITE, 0, nullptr, overwrite ? CREATE_ALWAYS : CREATE_NEW,
+                             unbuffered ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : FILE_ATTRIBUTE_NORMAL,
+                             nullptr);
+    if (dst == INVALID_HANDLE_VALUE) {
+        CloseHandle(src);
+        return false;
+    }
+
+    Xxh64 hash;
+    bool ok = true;
+    uint64_t copied = 0;
+    while (ok) {
+        DWORD bytesRead = 0;
+        ok = ReadFile(src, buf, COPY_CHUNK_SIZE, &bytesRead, nullptr);
+        if (!ok || bytesRead == 0) {
+            break;
+        }
+        if (checksum != nullptr) {
+            hash.update(buf, bytesRead);
+        }
+        // Reads of whole sectors may return a short final chunk; it is
+        // written rounded up and the tail trimmed with SetEndOfFile.
+        DWORD toWrite = bytesRead;
+        if (unbuffered) {
+            toWrite = (bytesRead + SECTOR_ALIGN - 1) & ~(DWORD) (SECTOR_ALIGN - 1);
+            memset(buf + bytesRead, 0, toWrite - bytesRead);
+        }
+        DWORD bytesWritten = 0;
+        ok = WriteFile(dst, buf, toWrite, &bytesWritten, nullptr) && bytesWritten == toWrite;
+        copied += bytesRead;
+    }
+    if (ok && unbuffered) {
+        LARGE_INTEGER end;
+        end.QuadPart = (LONGLONG) copied;
+        ok = SetFilePointerEx(dst, end, nullptr, FILE_BEGIN) && SetEndOfFile(dst);
+    }
+    if (ok) {
+        FILETIME writeTime;
+        if (GetFileTime(src, nullptr, nullptr, &writeTime)) {
+            SetFileTime(dst, nullptr, nullptr, &writeTime);
+        }
+    }
+    CloseHandle(src);
+    CloseHandle(dst);
+    if (!ok) {
+        DeleteFileA(dstPath);
+    } else if (checksum != nullptr) {
+        *checksum = hash.digest();
+    }
+    return ok;
+}
+
+class SystemCopyBackend : public CopyBackend {
+public:
+    const char *name() const override { return "system"; }
+
+    bool copy(const char *srcPath, const char *dstPath, uint64_t sizeBytes, bool overwrite,
+              uint64_t *checksum) override {
+        if (checksum != nullptr) {
+            return streamCopy(srcPath, dstPath, overwrite, false, checksum);
+        }
+        return CopyFileA(srcPath, dstPath, !overwrite);
+    }
+};
+
+// Bypasses the cache manager for large files so a multi-gigabyte video does
+// not evict everything else and get copied through the cache twice.
+class UnbufferedCopyBackend : public SystemCopyBackend {
+public:
+    const char *name() const override { return "unbuffered"; }
+
+    bool copy(const char *srcPath, const char *dstPath, uint64_t sizeBytes, bool overwrite,
+              uint64_t *checksum) override {
+        if (sizeBytes < UNBUFFERED_MIN_SIZE) {
+            return SystemCopyBackend::copy(srcPath, dstPath, sizeBytes, overwrite, checksum);
+        }
+        return streamCopy(srcPath, dstPath, overwrite, true, checksum);
+    }
+};
+
+class PortableCopyBackend : public CopyBackend {
+public:
+    const char *name() const override { return "portable"; }
+
+    bool copy(const char *srcPath, const char *dstPath, uint64_t sizeBytes, bool overwrite,
+              uint64_t *checksum) override {
+        (void) sizeBytes;
+        if (checksum != nullptr && !hashingCopy(srcPath, dstPath, overwrite, checksum)) {
+            return false;
+        }
+        std::error_code ec;
+        std::filesystem::copy_options options = overwrite
+                ? std::filesystem::copy_options::overwrite_existing
+                : std::filesystem::copy_options::none;
+        if (checksum == nullptr && !std::filesystem::copy_file(srcPath, dstPath, options, ec)) {
+            return false;
+        }
+        std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(srcPath, ec);
+        if (!ec) {
+            std::filesystem::last_write_time(dstPath, writeTime, ec);
+        }
+        return true;
+    }
+
+private:
+    static bool hashingCopy(const char *srcPath, const char *dstPath, bool overwrite, uint64_t *checksum) {
+        std::error_code ec;
+        if (!overwrite && std::filesystem::exists(dstPath, ec)) {
+            return false;
+        }
+        std::ifstream src(srcPath, std::ios::binary);
+        std::ofstream dst(dstPath, std::ios::binary | std::ios::trunc);
+        if (!src || !dst) {
+            return false;
+        }
+        std::vector<char> buf(COPY_CHUNK_SIZE);
+        Xxh64 hash;
+        while (src) {
+            src.read(buf.data(), buf.size());
+            std::streamsize n = src.gcount();
+            hash.update(buf.data(), (size_t) n);
+            dst.write(buf.data(), n);
+        }
+        dst.close();
+        if (src.bad() || !dst) {
+            std::filesystem::remove(dstPath, ec);
+            return false;
+        }
+        *checksum = hash.digest();
+        return true;
+    }
+};
+
+std::unique_ptr<CopyBackend> createCopyBackend(const std::string &name) {
+    if (name == "system") {
+        return std::make_unique<SystemCopyBackend>();
+    }
+    if (name == "unbuffered") {
+        return std::make_unique<UnbufferedCopyBackend>();
+    }
+    if (name == "portable") {
+        return std::make_unique<PortableCopyBackend>();
+    }
+    return nullptr;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Files at least this large take the unbuffered path
+#define UNBUFFERED_MIN_SIZE     (64ULL * 1024 * 1024)
+#define COPY_CHUNK_SIZE         (4 * 1024 * 1024)
+
+#define DEFAULT_COPY_BACKEND    "unbuffered"
+// What createCopyBackend() accepts, for prompts
+#define COPY_BACKEND_NAMES      "system, unbuffered, portable"
+
+// One file in a copyBatch() call; success, elapsedNs, the time spent on
+// this file alone, and checksum are filled in by the backend. checksum is
+// only set if wantChecksum is.
+struct CopyRequest {
+    const char *srcPath;
+    const char *dstPath;
+    uint64_t sizeBytes;
+    bool overwrite;
+    bool wantChecksum;
+    bool success;
+    int64_t elapsedNs;
+    uint64_t checksum;      // XXH64 of the bytes written
+};
+
+// How a single file's bytes get from source to destination. One backend is
+// shared by every copy worker, so implementations keep no per-copy state.
+class CopyBackend {
+public:
+    virtual ~CopyBackend() = default;
+
+    virtual const char *name() const = 0;
+
+    // Copies srcPath to dstPath, keeping the source's write time. Fails
+    // without touching dstPath if it exists and overwrite is false; a
+    // partially written destination is removed on failure.
+    //
+    // Unless checksum is nullptr it is set to the XXH64 of the bytes
+    // written, hashed while they are in memory between the read and the
+    // write. Copies that would otherwise never reach user memory
+    // (CopyFileA, copy_file_range) go through a read/write loop instead.
+    virtual bool copy(const char *srcPath, const char *dstPath, uint64_t sizeBytes, bool overwrite,
+                      uint64_t *checksum) = 0;
+
+    // Copies count files, setting each success and checksum as copy()
+    // would. Backends that can overlap many files override this; the
+    // default copies them one at a time.
+    virtual void copyBatch(CopyRequest *requests, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            CopyRequest *request = &requests[i];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            request->success = copy(request->srcPath, request->dstPath, request->sizeBytes, request->overwrite,
+                                    request->wantChecksum ? &request->checksum : nullptr);
+            request->elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    // How many files a worker should hand to copyBatch() at once
+    virtual size_t batchSize() const { return 1; }
+};
+
+// name is one of:
+//   system      CopyFileA, or a buffered loop when checksumming
+//   unbuffered  sector-aligned FILE_FLAG_NO_BUFFERING I/O for large files,
+//               CopyFileA below UNBUFFERED_MIN_SIZE
+//   portable    std::filesystem::copy_file, or a stream loop when checksumming
+// Returns nullptr for an unknown name.
+std::unique_ptr<CopyBackend> createCopyBackend(const std::string &name);
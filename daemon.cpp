@@ -0,0 +1,187 @@
+#include "daemon.h"
+#include "profile.h"
+#include "queue.h"
+#include "wpd.h"
+#include <cfgmgr32.h>
+
+// Spelled out rather than pulling in ntddstor.h and PortableDevice.h's
+// interface GUIDs under INITGUID
+static const GUID VOLUME_INTERFACE_GUID =
+        {0x53f5630d, 0xb6bf, 0x11d0, {0x94, 0xf2, 0x00, 0xa0, 0xc9, 0x1e, 0xfb, 0x8b}};
+static const GUID WPD_INTERFACE_GUID =
+        {0x6ac27878, 0xa6fa, 0x4155, {0xba, 0x85, 0xf9, 0x8f, 0x49, 0x1d, 0x4f, 0x33}};
+
+// A source waiting for the daemon worker, with the profile that claimed it.
+// A device's path is its PnP ID, which it is opened by once its turn comes.
+struct DaemonArrival {
+    IndexedDrive drive;
+    size_t profile;
+};
+
+// Runs on a system thread pool thread; the scan happens on the daemon's
+static DWORD CALLBACK onInterfaceArrival(HCMNOTIFICATION, PVOID context, CM_NOTIFY_ACTION action,
+                                         PCM_NOTIFY_EVENT_DATA, DWORD) {
+    if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL) {
+        SetEvent((HANDLE) context);
+    }
+    return ERROR_SUCCESS;
+}
+
+static HCMNOTIFICATION registerArrivals(const GUID &interfaceGuid, HANDLE changed) {
+    CM_NOTIFY_FILTER filter{};
+    filter.cbSize = sizeof(filter);
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    filter.u.DeviceInterface.ClassGuid = interfaceGuid;
+    HCMNOTIFICATION notification = nullptr;
+    if (CM_Register_Notification(&filter, changed, onInterfaceArrival, &notification) != CR_SUCCESS) {
+        return nullptr;
+    }
+    return notification;
+}
+
+// Signals changed whenever a folder is created in or renamed into dir
+static void watchFolder(HANDLE dir, HANDLE changed) {
+    alignas(DWORD) BYTE buffer[4096];
+    DWORD bytesReturned = 0;
+    while (ReadDirectoryChangesW(dir, buffer, sizeof(buffer), FALSE, FILE_NOTIFY_CHANGE_DIR_NAME,
+                                 &bytesReturned, nullptr, nullptr)) {
+        SetEvent(changed);
+    }
+}
+
+static std::vector<IndexedDrive> currentSources(const std::string &watchDir) {
+    std::vector<IndexedDrive> sources;
+    std::vector<Drive> drives = getLogicalDrives();
+    for (UINT i = 0; i < drives.size(); i++) {
+        sources.push_back(IndexedDrive{drives[i].path, drives[i].name, i, false});
+    }
+    std::vector<WPDevice> devices = GetAllDevices();
+    for (UINT i = 0; i < devices.size(); i++) {
+        sources.push_back(IndexedDrive{devices[i].path, devices[i].name, i, true});
+    }
+    if (!watchDir.empty()) {
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(watchDir, ec)) {
+            if (entry.is_directory(ec)) {
+                sources.push_back(IndexedDrive{entry.path().string() + '\\', entry.path().filename().string(),
+                                               0, false});
+            }
+        }
+    }
+    return sources;
+}
+
+// Backs up arrivals one session at a time, so two cards for the same
+// destination never write its dedup index or run report at once. Every
+// arrival already queued for a profile joins the same session.
+static void daemonWorker(BoundedQueue<DaemonArrival> *arrivals, const std::vector<BackupProfile> *profiles) {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    std::vector<DaemonArrival> batch;
+    while (arrivals->popBatch(&batch, DAEMON_QUEUE_SLOTS)) {
+        for (size_t p = 0; p < profiles->size(); p++) {
+            const BackupProfile &profile = profiles->at(p);
+            std::vector<std::unique_ptr<BackupSource>> sources;
+            for (DaemonArrival &arrival : batch) {
+                if (arrival.profile != p) {
+                    continue;
+                }
+                std::unique_ptr<BackupSource> source = std::make_unique<BackupSource>();
+                if (arrival.drive.isWPD) {
+                    OpenDevice(&source->device, arrival.drive.path);
+                    if (source->device == nullptr) {
+                        std::cout << "! Skipping " << arrival.drive.name << ", device could not be opened."
+                            << std::endl;
+                        continue;
+                    }
+                }
+                std::cout << "Backing up " << arrival.drive.name << " with profile " << profile.name << "."
+                    << std::endl;
+                source->drive = arrival.drive;
+                sources.push_back(std::move(source));
+            }
+            if (sources.empty()) {
+                continue;
+            }
+            std::unique_ptr<CopyBackend> backend =
+                    createCopyBackend(profile.backend.empty() ? DEFAULT_COPY_BACKEND : profile.backend);
+            if (backend == nullptr) {
+                std::cout << "! Unknown copy backend '" << profile.backend << "' in profile " << profile.name
+                    << std::endl;
+                continue;
+            }
+            SessionOptions options;
+            profileOptions(profile, &options);
+            runSession(options, backend.get(), &sources);
+        }
+    }
+    if (SUCCEEDED(hrInit)) {
+        CoUninitialize();
+    }
+}
+
+int runDaemon(const std::string &profilesPath, const std::string &watchDir) {
+    std::vector<std::string> errors;
+    std::vector<BackupProfile> profiles = loadProfiles(profilesPath, &errors);
+    for (const std::string &error : errors) {
+        std::cout << "! Profile " << error << std::endl;
+    }
+    if (profiles.empty()) {
+        std::cout << "! No usable profiles in " << profilesPath << std::endl;
+        return 1;
+    }
+    std::cout << "Loaded " << profiles.size() << " profiles from " << profilesPath << ", waiting for sources."
+        << std::endl;
+
+    // Starts signalled, so sources inserted before the daemon are backed up
+    HANDLE changed = CreateEventA(nullptr, FALSE, TRUE, nullptr);
+    HCMNOTIFICATION volumeArrivals = registerArrivals(VOLUME_INTERFACE_GUID, changed);
+    HCMNOTIFICATION deviceArrivals = registerArrivals(WPD_INTERFACE_GUID, changed);
+    if (volumeArrivals == nullptr || deviceArrivals == nullptr) {
+        std::cout << "! Failed to register for device arrivals, only the watch folder is monitored." << std::endl;
+    }
+    std::thread watcher;
+    if (!watchDir.empty()) {
+        HANDLE dir = CreateFileA(watchDir.c_str(), FILE_LIST_DIRECTORY,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (dir == INVALID_HANDLE_VALUE) {
+            std::cout << "! Failed to watch " << watchDir << ": " << lastErrorMessage();
+        } else {
+            watcher = std::thread(watchFolder, dir, changed);
+        }
+    }
+
+    BoundedQueue<DaemonArrival> arrivals(DAEMON_QUEUE_SLOTS);
+    std::thread worker(daemonWorker, &arrivals, &profiles);
+
+    // A source is handled once per insertion: it stays in present until a
+    // scan no longer finds it. Unnamed volumes are still mounting and are
+    // looked at again on the next scan.
+    std::unordered_set<std::string> present;
+    int64_t settleUntil = 0;
+    while (true) {
+        DWORD timeout = getCurrentMsTime() < settleUntil ? DAEMON_SETTLE_POLL_MS : INFINITE;
+        if (WaitForSingleObject(changed, timeout) == WAIT_OBJECT_0) {
+            settleUntil = getCurrentMsTime() + DAEMON_SETTLE_MS;
+        }
+        std::unordered_set<std::string> seen;
+        for (IndexedDrive &drive : currentSources(watchDir)) {
+            if (drive.name.empty()) {
+                continue;
+            }
+            std::string key = drive.isWPD ? drive.path + ':' + drive.name : drive.path;
+            seen.insert(key);
+            if (present.count(key) > 0) {
+                continue;
+            }
+            auto profile = std::find_if(profiles.begin(), profiles.end(),
+                                        [&drive](const BackupProfile &p) { return p.matches(drive.name); });
+            if (profile == profiles.end()) {
+                std::cout << drive.name << " (" << drive.path << ") arrived, no profile matches it." << std::endl;
+                continue;
+            }
+            arrivals.push(DaemonArrival{drive, (size_t) (profile - profiles.begin())});
+        }
+        present.swap(seen);
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common.h"
+
+// After an arrival event, sources are rescanned this often for this long,
+// since a volume's drive letter and label can show up after its interface.
+#define DAEMON_SETTLE_MS        5000
+#define DAEMON_SETTLE_POLL_MS   250
+#define DAEMON_QUEUE_SLOTS      64
+
+// Runs headless: backs up every drive or portable device whose name
+// matches a profile in profilesPath, first those already present and then
+// each one as it arrives, with no prompts. Arrivals are signalled by
+// volume and WPD device interface notifications, so a backup starts
+// within a poll of insertion.
+//
+// Each sub-folder of watchDir (if not empty) is treated as a drive named
+// after the folder, so the daemon can be tried without hardware by
+// creating a folder there. Returns only if no profile could be loaded.
+int runDaemon(const std::string &profilesPath, const std::string &watchDir);
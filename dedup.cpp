@@ -0,0 +1,314 @@
+#include "dedup.h"
+#include "hash.h"
+#include "layout.h"
+#include "pack.h"
+#include "compress.h"
+
+// On-disk layout (little endian, no padding), paths relative to the base:
+//   header: char magic[4], uint32_t version, uint64_t count
+//   record: uint64_t sizeBytes, uint64_t sample, uint64_t full, BYTE flags,
+//           uint16_t pathLen, char path[pathLen]
+static const char INDEX_MAGIC[4] = {'B', 'B', 'D', 'X'};
+static const uint32_t INDEX_VERSION = 1;
+static const size_t HASH_READ_SIZE = 1024 * 1024;
+
+template <typename T>
+static bool readField(HANDLE file, T *value) {
+    DWORD bytesRead = 0;
+    return ReadFile(file, value, sizeof(T), &bytesRead, nullptr) && bytesRead == sizeof(T);
+}
+
+template <typename T>
+static void appendField(std::string *out, T value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static bool endsWith(std::string_view text, std::string_view suffix) {
+    return text.size() >= suffix.size() && text.substr(text.size() - suffix.size()) == suffix;
+}
+
+// Files in the destination that hold something other than a plain copy of
+// a source file: pack segments and their index, compressed copies and
+// unfinished partial files. Linking a new file to one would store the
+// wrong bytes.
+static bool isContainerFile(std::string_view path) {
+    std::string_view name = path.substr(path.find_last_of('\\') + 1);
+    return endsWith(name, PACK_SEGMENT_EXTENSION) || name == PACK_INDEX_FILE_NAME
+            || endsWith(name, COMPRESSED_FILE_SUFFIX) || endsWith(name, PARTIAL_FILE_SUFFIX);
+}
+
+// Hashes up to len bytes starting at offset into *state.
+static bool hashRange(HANDLE file, LONGLONG offset, uint64_t len, Xxh64 *state) {
+    thread_local std::vector<BYTE> buf(HASH_READ_SIZE);
+    LARGE_INTEGER pos;
+    pos.QuadPart = offset;
+    if (!SetFilePointerEx(file, pos, nullptr, FILE_BEGIN)) {
+        return false;
+    }
+    while (len > 0) {
+        DWORD toRead = len < HASH_READ_SIZE ? (DWORD) len : (DWORD) HASH_READ_SIZE;
+        DWORD bytesRead = 0;
+        if (!ReadFile(file, buf.data(), toRead, &bytesRead, nullptr) || bytesRead == 0) {
+            return false;
+        }
+        state->update(buf.data(), bytesRead);
+        len -= bytesRead;
+    }
+    return true;
+}
+
+ContentIndex::ContentIndex(const std::string &baseDstPath) : basePath(baseDstPath) {
+    if (basePath.empty() || basePath.back() != '\\') {
+        basePath.push_back('\\');
+    }
+}
+
+void ContentIndex::load() {
+    std::string indexPath = basePath + DEDUP_INDEX_FILE_NAME;
+    HANDLE file = CreateFileA(indexPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        seed();
+        return;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    DWORD bytesRead = 0;
+    bool headerOk = ReadFile(file, magic, sizeof(magic), &bytesRead, nullptr)
+            && bytesRead == sizeof(magic) && memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0
+            && readField(file, &version) && version == INDEX_VERSION && readField(file, &count);
+    if (!headerOk) {
+        CloseHandle(file);
+        seed();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    char pathBuf[MAX_PATH * 4];
+    for (uint64_t i = 0; i < count; i++) {
+        ContentEntry entry;
+        uint16_t pathLen = 0;
+        if (!readField(file, &entry.sizeBytes) || !readField(file, &entry.hashes.sample)
+                || !readField(file, &entry.hashes.full) || !readField(file, &entry.hashes.flags)
+                || !readField(file, &pathLen) || pathLen > sizeof(pathBuf)
+                || !ReadFile(file, pathBuf, pathLen, &bytesRead, nullptr) || bytesRead != pathLen) {
+            break;
+        }
+        entry.path = basePath + std::string(pathBuf, pathLen);
+        // Indexes saved before containers were left out may list them
+        if (isContainerFile(entry.path)) {
+            continue;
+        }
+        // Indexes saved before entries were replaced may list a path more
+        // than once; the last record is the newest
+        insert(std::move(entry));
+    }
+    CloseHandle(file);
+}
+
+// Indexes whatever is already in the destination by size only; hashes are
+// filled in later if a new file ever collides with one of them.
+void ContentIndex::seed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::error_code ec;
+    for (const std::filesystem::directory_entry &entry :
+            std::filesystem::recursive_directory_iterator(basePath,
+                    std::filesystem::directory_options::skip_permission_denied, ec)) {
+        if (!entry.is_regular_file(ec)) {
+            continue;
+        }
+        std::string path = entry.path().string();
+        if (path.find("bulldozer.", path.find_last_of('\\') + 1) != std::string::npos || isContainerFile(path)) {
+            continue;
+        }
+        uint64_t sizeBytes = entry.file_size(ec);
+        insert(ContentEntry{sizeBytes, ContentHashes{}, std::move(path)});
+    }
+}
+
+bool ContentIndex::save() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string out;
+    out.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    appendField<uint32_t>(&out, INDEX_VERSION);
+    appendField<uint64_t>(&out, byPath.size());
+    for (const ContentEntry &entry : entries) {
+        if (entry.path.empty()) {
+            continue;
+        }
+        std::string_view relPath(entry.path);
+        relPath.remove_prefix(basePath.size());
+        appendField<uint64_t>(&out, entry.sizeBytes);
+        appendField<uint64_t>(&out, entry.hashes.sample);
+        appendField<uint64_t>(&out, entry.hashes.full);
+        appendField<BYTE>(&out, entry.hashes.flags);
+        appendField<uint16_t>(&out, (uint16_t) relPath.size());
+        out.append(relPath);
+    }
+
+    std::string indexPath = basePath + DEDUP_INDEX_FILE_NAME;
+    std::string tmpPath = indexPath + ".tmp";
+    HANDLE file = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool writeOk = WriteFile(file, out.data(), (DWORD) out.size(), &bytesWritten, nullptr)
+            && bytesWritten == out.size();
+    CloseHandle(file);
+    if (!writeOk) {
+        DeleteFileA(tmpPath.c_str());
+        return false;
+    }
+    return MoveFileExA(tmpPath.c_str(), indexPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+// Fills in whichever of the wanted hashes are not already known.
+bool ContentIndex::ensureHashes(const std::string &path, uint64_t sizeBytes, BYTE wanted, ContentHashes *hashes) {
+    if ((hashes->flags & wanted) == wanted) {
+        return true;
+    }
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    bool ok = true;
+    bool small = sizeBytes <= 2 * DEDUP_SAMPLE_BLOCK;
+    if (small || (wanted & HASH_HAS_FULL)) {
+        // Small files are sampled in their entirety, so one pass gives both
+        Xxh64 state;
+        ok = hashRange(file, 0, sizeBytes, &state);
+        if (ok) {
+            hashes->full = state.digest();
+            hashes->flags |= HASH_HAS_FULL;
+            if (small) {
+                hashes->sample = hashes->full;
+                hashes->flags |= HASH_HAS_SAMPLE;
+            }
+        }
+    }
+    if (ok && !small && (wanted & HASH_HAS_SAMPLE) && !(hashes->flags & HASH_HAS_SAMPLE)) {
+        Xxh64 state(sizeBytes);
+        ok = hashRange(file, 0, DEDUP_SAMPLE_BLOCK, &state)
+                && hashRange(file, (LONGLONG) (sizeBytes - DEDUP_SAMPLE_BLOCK), DEDUP_SAMPLE_BLOCK, &state);
+        if (ok) {
+            hashes->sample = state.digest();
+            hashes->flags |= HASH_HAS_SAMPLE;
+        }
+    }
+    CloseHandle(file);
+    return ok;
+}
+
+bool ContentIndex::findDuplicate(const std::string &srcPath, uint64_t sizeBytes,
+                                 ContentHashes *srcHashes, std::string *existingPath) {
+    // Stage 1: size. Snapshot the candidates so hashing happens unlocked.
+    std::vector<std::pair<size_t, ContentEntry>> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto range = bySize.equal_range(sizeBytes);
+        for (auto it = range.first; it != range.second; ++it) {
+            candidates.emplace_back(it->second, entries[it->second]);
+        }
+    }
+    if (candidates.empty() || sizeBytes == 0) {
+        return false;
+    }
+
+    // Stage 2: first and last blocks, then stage 3: the whole file
+    for (BYTE stage : {(BYTE) HASH_HAS_SAMPLE, (BYTE) HASH_HAS_FULL}) {
+        if (!ensureHashes(srcPath, sizeBytes, stage, srcHashes)) {
+            return false;
+        }
+        std::vector<std::pair<size_t, ContentEntry>> matches;
+        for (auto &candidate : candidates) {
+            ContentHashes *hashes = &candidate.second.hashes;
+            BYTE knownBefore = hashes->flags;
+            if (!ensureHashes(candidate.second.path, sizeBytes, stage, hashes)) {
+                continue;
+            }
+            // Not kept if the entry was dropped meanwhile: the file may
+            // have been overwritten while it was hashed
+            if (hashes->flags != knownBefore) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (entries[candidate.first].path == candidate.second.path) {
+                    entries[candidate.first].hashes = *hashes;
+                }
+            }
+            uint64_t candidateHash = stage == HASH_HAS_SAMPLE ? hashes->sample : hashes->full;
+            uint64_t srcHash = stage == HASH_HAS_SAMPLE ? srcHashes->sample : srcHashes->full;
+            if (candidateHash == srcHash) {
+                matches.push_back(std::move(candidate));
+            }
+        }
+        if (matches.empty()) {
+            return false;
+        }
+        candidates = std::move(matches);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &candidate : candidates) {
+        if (entries[candidate.first].path == candidate.second.path) {
+            *existingPath = candidate.second.path;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Called with the mutex held
+void ContentIndex::insert(ContentEntry entry) {
+    eraseLocked(entry.path);
+    size_t i = entries.size();
+    bySize.emplace(entry.sizeBytes, i);
+    byPath.emplace(entry.path, i);
+    entries.push_back(std::move(entry));
+}
+
+// Called with the mutex held
+void ContentIndex::eraseLocked(const std::string &path) {
+    auto it = byPath.find(path);
+    if (it == byPath.end()) {
+        return;
+    }
+    size_t i = it->second;
+    auto range = bySize.equal_range(entries[i].sizeBytes);
+    for (auto sizeIt = range.first; sizeIt != range.second; ++sizeIt) {
+        if (sizeIt->second == i) {
+            bySize.erase(sizeIt);
+            break;
+        }
+    }
+    entries[i].path.clear();
+    entries[i].hashes = ContentHashes{};
+    byPath.erase(it);
+}
+
+void ContentIndex::add(uint64_t sizeBytes, const std::string &path, const ContentHashes &hashes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    insert(ContentEntry{sizeBytes, hashes, path});
+}
+
+void ContentIndex::invalidate(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    eraseLocked(path);
+}
+
+void ContentIndex::recordAlias(const std::string &dstPath, const std::string &existingPath) {
+    std::lock_guard<std::mutex> lock(logMutex);
+    std::string logPath = basePath + DEDUP_LOG_FILE_NAME;
+    HANDLE file = CreateFileA(logPath.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    std::string line = dstPath + '\t' + existingPath + "\r\n";
+    DWORD bytesWritten = 0;
+    WriteFile(file, line.data(), (DWORD) line.size(), &bytesWritten, nullptr);
+    CloseHandle(file);
+}
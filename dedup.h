@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+
+#define DEDUP_INDEX_FILE_NAME   "bulldozer.dedup"
+#define DEDUP_LOG_FILE_NAME     "bulldozer.duplicates"
+
+// Bytes hashed from each end of a file for the cheap second-stage check
+#define DEDUP_SAMPLE_BLOCK      (64 * 1024)
+
+#define HASH_HAS_SAMPLE         0x1
+#define HASH_HAS_FULL           0x2
+
+struct ContentHashes {
+    uint64_t sample = 0;
+    uint64_t full = 0;
+    BYTE flags = 0;
+};
+
+struct ContentEntry {
+    uint64_t sizeBytes;
+    ContentHashes hashes;
+    std::string path;
+};
+
+// Destination-wide index of stored file contents. Candidates are narrowed by
+// size, then by a hash of the first and last blocks, and only files that
+// still match are hashed in full. Hashes are computed lazily and kept, so
+// each stored file is read at most once across runs.
+//
+// Only plain copies are indexed, since a duplicate is stored as a hard link
+// to one. Pack segments and compressed copies hold other bytes than the
+// source, so packed and compressed files are never indexed, and a later
+// duplicate of one is stored again.
+class ContentIndex {
+public:
+    explicit ContentIndex(const std::string &baseDstPath);
+
+    // Loads the saved index, or indexes existing destination files by size
+    // if there is none yet.
+    void load();
+    bool save();
+
+    // Returns true and sets *existingPath if a stored file has the same
+    // content. Any source hashes computed on the way are left in *srcHashes.
+    bool findDuplicate(const std::string &srcPath, uint64_t sizeBytes,
+                       ContentHashes *srcHashes, std::string *existingPath);
+    // Indexes the file at path, replacing whatever was indexed there before.
+    void add(uint64_t sizeBytes, const std::string &path, const ContentHashes &hashes);
+    // Drops the entry for path. Called before a destination file is
+    // overwritten, so its old hashes never match content it no longer holds.
+    void invalidate(const std::string &path);
+    // Notes a duplicate that could not be hard linked.
+    void recordAlias(const std::string &dstPath, const std::string &existingPath);
+
+    size_t size() const { return byPath.size(); }
+
+private:
+    bool ensureHashes(const std::string &path, uint64_t sizeBytes, BYTE wanted, ContentHashes *hashes);
+    void seed();
+    void insert(ContentEntry entry);
+    void eraseLocked(const std::string &path);
+
+    std::string basePath;
+    std::deque<ContentEntry> entries;
+    std::unordered_multimap<uint64_t, size_t> bySize;
+    // Live entry of each path; erased entries keep their slot with an
+    // empty path until the index is saved
+    std::unordered_map<std::string, size_t> byPath;
+    std::mutex mutex;
+    std::mutex logMutex;
+};
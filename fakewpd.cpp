@@ -0,0 +1,468 @@
+#include "fakewpd.h"
+#include "benchtree.h"
+
+#define FAKE_OPTIMAL_TRANSFER_SIZE  (256 * 1024)
+#define FAKE_BULK_BATCH_SIZE        256
+
+static const UINT32 FAKE_NO_PARENT = (UINT32) -1;
+
+FakeDeviceModel::FakeDeviceModel(const FakeDeviceSpec &spec) : spec(spec) {
+    uint64_t rng = spec.seed;
+    SYSTEMTIME first = {2019, 1, 0, 1};
+    FILETIME firstTime;
+    SystemTimeToFileTime(&first, &firstTime);
+    ULONGLONG firstDate = ((ULONGLONG) firstTime.dwHighDateTime << 32) | firstTime.dwLowDateTime;
+    // Six years, so objects land in many Year/Month folders
+    ULONGLONG dateRange = 6ULL * 365 * 24 * 3600 * 10000000;
+
+    Add(WPD_DEVICE_OBJECT_ID, L"Fake Device", FAKE_NO_PARENT, true, 0, firstDate);
+    UINT32 storage = Add(L"s10001", L"Internal shared storage", 0, true, 0, firstDate);
+    UINT32 dcim = Add(L"f0", L"DCIM", storage, true, 0, firstDate);
+    WCHAR id[32];
+    WCHAR name[32];
+    for (UINT32 f = 0; f < spec.folders; f++) {
+        swprintf(id, 32, L"f%u", f + 1);
+        swprintf(name, 32, L"%03uAPPLE", f + 100);
+        UINT32 folder = Add(id, name, dcim, true, 0, firstDate);
+        for (UINT32 o = 0; o < spec.objectsPerFolder; o++) {
+            UINT32 n = (UINT32) objects.size();
+            ULONGLONG span = spec.maxObjectSize - spec.minObjectSize + 1;
+            ULONGLONG sizeBytes = spec.minObjectSize + splitmix64(&rng) % span;
+            ULONGLONG date = firstDate + splitmix64(&rng) % dateRange;
+            swprintf(id, 32, L"o%u", n);
+            swprintf(name, 32, L"IMG_%05u.JPG", n);
+            Add(id, name, folder, false, sizeBytes, date);
+            totalBytes += sizeBytes;
+        }
+    }
+}
+
+UINT32 FakeDeviceModel::Add(const std::wstring &id, const std::wstring &name, UINT32 parent, bool folder,
+                            ULONGLONG sizeBytes, ULONGLONG date) {
+    UINT32 index = (UINT32) objects.size();
+    WCHAR puid[48];
+    swprintf(puid, 48, L"{FAKE-%016llX}", (unsigned long long) (spec.seed ^ index));
+    objects.push_back(FakeObject{id, name, puid, parent, folder, sizeBytes, date});
+    byId.emplace(id, index);
+    if (parent != FAKE_NO_PARENT) {
+        objects[parent].children.push_back(index);
+    }
+    return index;
+}
+
+const FakeObject *FakeDeviceModel::Find(PCWSTR objectId) const {
+    auto it = byId.find(objectId);
+    return it == byId.end() ? nullptr : &objects[it->second];
+}
+
+void FakeDeviceModel::Delay() const {
+    if (spec.callLatencyUs == 0) {
+        return;
+    }
+    // Sleep() rounds up to the scheduler tick, so short delays spin instead
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(spec.callLatencyUs);
+    if (spec.callLatencyUs >= 2000) {
+        std::this_thread::sleep_until(until);
+    }
+    while (std::chrono::steady_clock::now() < until) {
+        std::this_thread::yield();
+    }
+}
+
+static PWSTR CoTaskDupString(const std::wstring &str) {
+    size_t bytes = (str.size() + 1) * sizeof(WCHAR);
+    PWSTR copy = (PWSTR) CoTaskMemAlloc(bytes);
+    if (copy != nullptr) {
+        memcpy(copy, str.c_str(), bytes);
+    }
+    return copy;
+}
+
+// Reference counting and IUnknown for every fake interface below
+template <typename Interface>
+class CFakeUnknown : public Interface {
+public:
+    explicit CFakeUnknown(std::shared_ptr<const FakeDeviceModel> model) : m_cRef(1), m_pModel(std::move(model)) {}
+    virtual ~CFakeUnknown() {}
+
+    HRESULT __stdcall QueryInterface(REFIID riid, LPVOID *ppvObj) {
+        if (ppvObj == nullptr) {
+            return E_INVALIDARG;
+        }
+        if ((riid == IID_IUnknown) || (riid == __uuidof(Interface))) {
+            AddRef();
+            *ppvObj = static_cast<Interface *>(this);
+            return S_OK;
+        }
+        *ppvObj = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG __stdcall AddRef() {
+        return InterlockedIncrement((long*) &m_cRef);
+    }
+
+    ULONG __stdcall Release() {
+        ULONG ulRefCount = InterlockedDecrement((long*) &m_cRef);
+        if (ulRefCount == 0) {
+            delete this;
+        }
+        return ulRefCount;
+    }
+
+protected:
+    ULONG                                   m_cRef;
+    std::shared_ptr<const FakeDeviceModel>  m_pModel;
+};
+
+// Deterministic object contents, read-only
+class CFakeStream : public CFakeUnknown<IStream> {
+public:
+    CFakeStream(std::shared_ptr<const FakeDeviceModel> model, const FakeObject *object) :
+        CFakeUnknown(std::move(model)), m_pObject(object), m_ullPosition(0) {}
+
+    HRESULT __stdcall QueryInterface(REFIID riid, LPVOID *ppvObj) {
+        if (ppvObj != nullptr && riid == IID_ISequentialStream) {
+            AddRef();
+            *ppvObj = static_cast<ISequentialStream *>(this);
+            return S_OK;
+        }
+        return CFakeUnknown::QueryInterface(riid, ppvObj);
+    }
+
+    HRESULT __stdcall Read(void *pv, ULONG cb, ULONG *pcbRead) {
+        ULONGLONG remaining = m_pObject->sizeBytes - m_ullPosition;
+        ULONG cbRead = cb < remaining ? cb : (ULONG) remaining;
+        m_pModel->Delay();
+        fillSyntheticData((BYTE *) pv, cbRead, m_pModel->Spec().seed ^ m_pObject->sizeBytes, m_ullPosition);
+        if (m_pModel->Spec().bandwidthMBps > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(cbRead / m_pModel->Spec().bandwidthMBps));
+        }
+        m_ullPosition += cbRead;
+        if (pcbRead != nullptr) {
+            *pcbRead = cbRead;
+        }
+        return cbRead < cb ? S_FALSE : S_OK;
+    }
+
+    HRESULT __stdcall Write(const void *pv, ULONG cb, ULONG *pcbWritten) {
+        return STG_E_ACCESSDENIED;
+    }
+
+    HRESULT __stdcall Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER *plibNewPosition) {
+        LONGLONG base = dwOrigin == STREAM_SEEK_SET ? 0
+                : dwOrigin == STREAM_SEEK_CUR ? (LONGLONG) m_ullPosition : (LONGLONG) m_pObject->sizeBytes;
+        LONGLONG position = base + dlibMove.QuadPart;
+        if (position < 0) {
+            return STG_E_INVALIDFUNCTION;
+        }
+        m_ullPosition = (ULONGLONG) position > m_pObject->sizeBytes ? m_pObject->sizeBytes : (ULONGLONG) position;
+        if (plibNewPosition != nullptr) {
+            plibNewPosition->QuadPart = m_ullPosition;
+        }
+        return S_OK;
+    }
+
+    HRESULT __stdcall SetSize(ULARGE_INTEGER libNewSize) { return STG_E_ACCESSDENIED; }
+    HRESULT __stdcall CopyTo(IStream *pstm, ULARGE_INTEGER cb, ULARGE_INTEGER *pcbRead,
+                             ULARGE_INTEGER *pcbWritten) { return E_NOTIMPL; }
+    HRESULT __stdcall Commit(DWORD grfCommitFlags) { return S_OK; }
+    HRESULT __stdcall Revert() { return S_OK; }
+    HRESULT __stdcall LockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb,
+                                 DWORD dwLockType) { return STG_E_INVALIDFUNCTION; }
+    HRESULT __stdcall UnlockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb,
+                                   DWORD dwLockType) { return STG_E_INVALIDFUNCTION; }
+
+    HRESULT __stdcall Stat(STATSTG *pstatstg, DWORD grfStatFlag) {
+        if (pstatstg == nullptr) {
+            return E_POINTER;
+        }
+        memset(pstatstg, 0, sizeof(*pstatstg));
+        pstatstg->type = STGTY_STREAM;
+        pstatstg->cbSize.QuadPart = m_pObject->sizeBytes;
+        return S_OK;
+    }
+
+    HRESULT __stdcall Clone(IStream **ppstm) { return E_NOTIMPL; }
+
+private:
+    const FakeObject*   m_pObject;
+    ULONGLONG           m_ullPosition;
+};
+
+class CFakeEnumObjectIDs : public CFakeUnknown<IEnumPortableDeviceObjectIDs> {
+public:
+    CFakeEnumObjectIDs(std::shared_ptr<const FakeDeviceModel> model, const FakeObject *parent) :
+        CFakeUnknown(std::move(model)), m_pParent(parent), m_dwNext(0) {}
+
+    HRESULT __stdcall Next(ULONG cObjects, LPWSTR *pObjIDs, ULONG *pcFetched) {
+        m_pModel->Delay();
+        ULONG cFetched = 0;
+        while (cFetched < cObjects && m_dwNext < m_pParent->children.size()) {
+            pObjIDs[cFetched++] = CoTaskDupString(m_pModel->At(m_pParent->children[m_dwNext++]).id);
+        }
+        if (pcFetched != nullptr) {
+            *pcFetched = cFetched;
+        }
+        return cFetched == cObjects ? S_OK : S_FALSE;
+    }
+
+    HRESULT __stdcall Skip(ULONG cObjects) {
+        m_dwNext += cObjects;
+        return m_dwNext <= m_pParent->children.size() ? S_OK : S_FALSE;
+    }
+
+    HRESULT __stdcall Reset() {
+        m_dwNext = 0;
+        return S_OK;
+    }
+
+    HRESULT __stdcall Clone(IEnumPortableDeviceObjectIDs **ppEnum) { return E_NOTIMPL; }
+    HRESULT __stdcall Cancel() { return S_OK; }
+
+private:
+    const FakeObject*   m_pParent;
+    size_t              m_dwNext;
+};
+
+// Fills a real PortableDeviceValues with every property wpdmeta.cpp asks for
+static HRESULT GetObjectValues(const FakeDeviceModel *model, const FakeObject *object,
+                               IPortableDeviceValues **ppValues) {
+    CComPtr<IPortableDeviceValues> pValues;
+    HRESULT hr = CoCreateInstance(CLSID_PortableDeviceValues,
+                                  nullptr,
+                                  CLSCTX_INPROC_SERVER,
+                                  IID_PPV_ARGS(&pValues));
+    if (FAILED(hr)) {
+        return hr;
+    }
+    pValues->SetStringValue(WPD_OBJECT_ID, object->id.c_str());
+    pValues->SetStringValue(WPD_OBJECT_ORIGINAL_FILE_NAME, object->name.c_str());
+    pValues->SetStringValue(WPD_OBJECT_PERSISTENT_UNIQUE_ID, object->persistentId.c_str());
+    pValues->SetGuidValue(WPD_OBJECT_CONTENT_TYPE, object->folder ? WPD_CONTENT_TYPE_FOLDER : WPD_CONTENT_TYPE_IMAGE);
+    pValues->SetUnsignedLargeIntegerValue(WPD_OBJECT_SIZE, object->sizeBytes);
+
+    FILETIME fileTime;
+    fileTime.dwLowDateTime = (DWORD) object->date;
+    fileTime.dwHighDateTime = (DWORD) (object->date >> 32);
+    SYSTEMTIME sysTime;
+    PROPVARIANT pv;
+    PropVariantInit(&pv);
+    if (FileTimeToSystemTime(&fileTime, &sysTime) && SystemTimeToVariantTime(&sysTime, &pv.date)) {
+        pv.vt = VT_DATE;
+        pValues->SetValue(WPD_OBJECT_DATE_CREATED, &pv);
+        pValues->SetValue(WPD_OBJECT_DATE_MODIFIED, &pv);
+    }
+    *ppValues = pValues.Detach();
+    return S_OK;
+}
+
+class CFakePropertiesBulk : public CFakeUnknown<IPortableDevicePropertiesBulk> {
+public:
+    using CFakeUnknown::CFakeUnknown;
+
+    HRESULT __stdcall QueueGetValuesByObjectList(IPortableDevicePropVariantCollection *pObjectIDs,
+                                                 IPortableDeviceKeyCollection *pKeys,
+                                                 IPortableDevicePropertiesBulkCallback *pCallback,
+                                                 GUID *pContext) {
+        m_pObjectIDs = pObjectIDs;
+        m_pCallback = pCallback;
+        *pContext = GUID_NULL;
+        return S_OK;
+    }
+
+    HRESULT __stdcall QueueGetValuesByObjectFormat(REFGUID pguidObjectFormat, LPCWSTR pszParentObjectID,
+                                                   const DWORD dwDepth, IPortableDeviceKeyCollection *pKeys,
+                                                   IPortableDevicePropertiesBulkCallback *pCallback,
+                                                   GUID *pContext) { return E_NOTIMPL; }
+    HRESULT __stdcall QueueSetValuesByObjectList(IPortableDeviceValuesCollection *pObjectValues,
+                                                 IPortableDevicePropertiesBulkCallback *pCallback,
+                                                 GUID *pContext) { return E_NOTIMPL; }
+
+    // Runs the whole queued operation before returning, which callers
+    // waiting on their completion event cannot tell apart from a driver
+    // that finishes quickly.
+    HRESULT __stdcall Start(REFGUID pContext) {
+        if (m_pObjectIDs == nullptr || m_pCallback == nullptr) {
+            return E_INVALIDARG;
+        }
+        DWORD cObjectIDs = 0;
+        HRESULT hr = m_pObjectIDs->GetCount(&cObjectIDs);
+        m_pCallback->OnStart(pContext);
+        for (DWORD dwIndex = 0; SUCCEEDED(hr) && dwIndex < cObjectIDs; dwIndex += FAKE_BULK_BATCH_SIZE) {
+            CComPtr<IPortableDeviceValuesCollection> pBatch;
+            hr = CoCreateInstance(CLSID_PortableDeviceValuesCollection,
+                                  nullptr,
+                                  CLSCTX_INPROC_SERVER,
+                                  IID_PPV_ARGS(&pBatch));
+            m_pModel->Delay();
+            for (DWORD i = dwIndex; SUCCEEDED(hr) && i < cObjectIDs && i < dwIndex + FAKE_BULK_BATCH_SIZE; i++) {
+                PROPVARIANT pv;
+                PropVariantInit(&pv);
+                hr = m_pObjectIDs->GetAt(i, &pv);
+                const FakeObject *object = SUCCEEDED(hr) && pv.vt == VT_LPWSTR ? m_pModel->Find(pv.pwszVal) : nullptr;
+                CComPtr<IPortableDeviceValues> pValues;
+                if (object != nullptr && SUCCEEDED(GetObjectValues(m_pModel.get(), object, &pValues))) {
+                    hr = pBatch->Add(pValues);
+                }
+                PropVariantClear(&pv);
+            }
+            if (SUCCEEDED(hr)) {
+                hr = m_pCallback->OnProgress(pContext, pBatch);
+            }
+        }
+        m_pCallback->OnEnd(pContext, hr);
+        m_pObjectIDs.Release();
+        m_pCallback.Release();
+        return S_OK;
+    }
+
+    HRESULT __stdcall Cancel(REFGUID pContext) { return S_OK; }
+
+private:
+    CComPtr<IPortableDevicePropVariantCollection>   m_pObjectIDs;
+    CComPtr<IPortableDevicePropertiesBulkCallback>  m_pCallback;
+};
+
+class CFakeProperties : public CFakeUnknown<IPortableDeviceProperties> {
+public:
+    using CFakeUnknown::CFakeUnknown;
+
+    HRESULT __stdcall QueryInterface(REFIID riid, LPVOID *ppvObj) {
+        if (ppvObj != nullptr && riid == __uuidof(IPortableDevicePropertiesBulk)) {
+            if (!m_pModel->Spec().bulkProperties) {
+                *ppvObj = nullptr;
+                return E_NOINTERFACE;
+            }
+            *ppvObj = static_cast<IPortableDevicePropertiesBulk *>(new (std::nothrow) CFakePropertiesBulk(m_pModel));
+            return *ppvObj != nullptr ? S_OK : E_OUTOFMEMORY;
+        }
+        return CFakeUnknown::QueryInterface(riid, ppvObj);
+    }
+
+    HRESULT __stdcall GetSupportedProperties(LPCWSTR pszObjectID, IPortableDeviceKeyCollection **ppKeys) {
+        return E_NOTIMPL;
+    }
+    HRESULT __stdcall GetPropertyAttributes(LPCWSTR pszObjectID, REFPROPERTYKEY Key,
+                                            IPortableDeviceValues **ppAttributes) { return E_NOTIMPL; }
+
+    HRESULT __stdcall GetValues(LPCWSTR pszObjectID, IPortableDeviceKeyCollection *pKeys,
+                                IPortableDeviceValues **ppValues) {
+        m_pModel->Delay();
+        const FakeObject *object = m_pModel->Find(pszObjectID);
+        if (object == nullptr) {
+            return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+        return GetObjectValues(m_pModel.get(), object, ppValues);
+    }
+
+    HRESULT __stdcall SetValues(LPCWSTR pszObjectID, IPortableDeviceValues *pValues,
+                                IPortableDeviceValues **ppResults) { return E_NOTIMPL; }
+    HRESULT __stdcall Delete(LPCWSTR pszObjectID, IPortableDeviceKeyCollection *pKeys) { return E_NOTIMPL; }
+    HRESULT __stdcall Cancel() { return S_OK; }
+};
+
+class CFakeResources : public CFakeUnknown<IPortableDeviceResources> {
+public:
+    using CFakeUnknown::CFakeUnknown;
+
+    HRESULT __stdcall GetSupportedResources(LPCWSTR pszObjectID, IPortableDeviceKeyCollection **ppKeys) {
+        return E_NOTIMPL;
+    }
+    HRESULT __stdcall GetResourceAttributes(LPCWSTR pszObjectID, REFPROPERTYKEY Key,
+                                            IPortableDeviceValues **ppResourceAttributes) { return E_NOTIMPL; }
+
+    HRESULT __stdcall GetStream(LPCWSTR pszObjectID, REFPROPERTYKEY Key, const DWORD dwMode,
+                                DWORD *pdwOptimalBufferSize, IStream **ppStream) {
+        m_pModel->Delay();
+        const FakeObject *object = m_pModel->Find(pszObjectID);
+        if (object == nullptr || object->folder) {
+            return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+        *ppStream = new (std::nothrow) CFakeStream(m_pModel, object);
+        if (*ppStream == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        *pdwOptimalBufferSize = FAKE_OPTIMAL_TRANSFER_SIZE;
+        return S_OK;
+    }
+
+    HRESULT __stdcall Delete(LPCWSTR pszObjectID, IPortableDeviceKeyCollection *pKeys) { return E_NOTIMPL; }
+    HRESULT __stdcall Cancel() { return S_OK; }
+    HRESULT __stdcall CreateResource(IPortableDeviceValues *pResourceAttributes, IStream **ppData,
+                                     DWORD *pdwOptimalWriteBufferSize, LPWSTR *ppszCookie) { return E_NOTIMPL; }
+};
+
+class CFakeContent : public CFakeUnknown<IPortableDeviceContent> {
+public:
+    using CFakeUnknown::CFakeUnknown;
+
+    HRESULT __stdcall EnumObjects(const DWORD dwFlags, LPCWSTR pszParentObjectID, IPortableDeviceValues *pFilter,
+                                  IEnumPortableDeviceObjectIDs **ppEnum) {
+        m_pModel->Delay();
+        const FakeObject *parent = m_pModel->Find(pszParentObjectID);
+        if (parent == nullptr) {
+            return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+        *ppEnum = new (std::nothrow) CFakeEnumObjectIDs(m_pModel, parent);
+        return *ppEnum != nullptr ? S_OK : E_OUTOFMEMORY;
+    }
+
+    HRESULT __stdcall Properties(IPortableDeviceProperties **ppProperties) {
+        *ppProperties = new (std::nothrow) CFakeProperties(m_pModel);
+        return *ppProperties != nullptr ? S_OK : E_OUTOFMEMORY;
+    }
+
+    HRESULT __stdcall Transfer(IPortableDeviceResources **ppResources) {
+        *ppResources = new (std::nothrow) CFakeResources(m_pModel);
+        return *ppResources != nullptr ? S_OK : E_OUTOFMEMORY;
+    }
+
+    HRESULT __stdcall CreateObjectWithPropertiesOnly(IPortableDeviceValues *pValues, LPWSTR *ppszObjectID) {
+        return E_NOTIMPL;
+    }
+    HRESULT __stdcall CreateObjectWithPropertiesAndData(IPortableDeviceValues *pValues, IStream **ppData,
+                                                        DWORD *pdwOptimalWriteBufferSize,
+                                                        LPWSTR *ppszCookie) { return E_NOTIMPL; }
+    HRESULT __stdcall Delete(const DWORD dwOptions, IPortableDevicePropVariantCollection *pObjectIDs,
+                             IPortableDevicePropVariantCollection **ppResults) { return E_NOTIMPL; }
+    HRESULT __stdcall GetObjectIDsFromPersistentUniqueIDs(IPortableDevicePropVariantCollection *pPersistentUniqueIDs,
+                                                          IPortableDevicePropVariantCollection **ppObjectIDs) {
+        return E_NOTIMPL;
+    }
+    HRESULT __stdcall Cancel() { return S_OK; }
+    HRESULT __stdcall Move(IPortableDevicePropVariantCollection *pObjectIDs, LPCWSTR pszDestinationFolderObjectID,
+                           IPortableDevicePropVariantCollection **ppResults) { return E_NOTIMPL; }
+    HRESULT __stdcall Copy(IPortableDevicePropVariantCollection *pObjectIDs, LPCWSTR pszDestinationFolderObjectID,
+                           IPortableDevicePropVariantCollection **ppResults) { return E_NOTIMPL; }
+};
+
+class CFakePortableDevice : public CFakeUnknown<IPortableDevice> {
+public:
+    using CFakeUnknown::CFakeUnknown;
+
+    HRESULT __stdcall Open(LPCWSTR pszPnPDeviceID, IPortableDeviceValues *pClientInfo) { return S_OK; }
+    HRESULT __stdcall SendCommand(const DWORD dwFlags, IPortableDeviceValues *pParameters,
+                                  IPortableDeviceValues **ppResults) { return E_NOTIMPL; }
+
+    HRESULT __stdcall Content(IPortableDeviceContent **ppContent) {
+        *ppContent = new (std::nothrow) CFakeContent(m_pModel);
+        return *ppContent != nullptr ? S_OK : E_OUTOFMEMORY;
+    }
+
+    HRESULT __stdcall Capabilities(IPortableDeviceCapabilities **ppCapabilities) { return E_NOTIMPL; }
+    HRESULT __stdcall Cancel() { return S_OK; }
+    HRESULT __stdcall Close() { return S_OK; }
+    HRESULT __stdcall Advise(const DWORD dwFlags, IPortableDeviceEventCallback *pCallback,
+                             IPortableDeviceValues *pParameters, LPWSTR *ppszCookie) { return E_NOTIMPL; }
+    HRESULT __stdcall Unadvise(LPCWSTR pszCookie) { return E_NOTIMPL; }
+    HRESULT __stdcall GetPnPDeviceID(LPWSTR *ppszPnPDeviceID) {
+        *ppszPnPDeviceID = CoTaskDupString(L"\\\\?\\fake#wpd");
+        return *ppszPnPDeviceID != nullptr ? S_OK : E_OUTOFMEMORY;
+    }
+};
+
+HRESULT CreateFakeDevice(std::shared_ptr<const FakeDeviceModel> model, IPortableDevice **ppDevice) {
+    *ppDevice = new (std::nothrow) CFakePortableDevice(std::move(model));
+    return *ppDevice != nullptr ? S_OK : E_OUTOFMEMORY;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.h"
+
+// Shape and speed of a simulated device. Object contents are generated on
+// the fly from the seed, so even large devices cost no memory.
+struct FakeDeviceSpec {
+    UINT32 folders;             // DCIM-style folders under the storage root
+    UINT32 objectsPerFolder;
+    ULONGLONG minObjectSize;
+    ULONGLONG maxObjectSize;
+    DWORD callLatencyUs;        // added to every enumerate, property and stream call
+    DWORD bandwidthMBps;        // stream read cap, 0 for unlimited
+    bool bulkProperties;        // expose IPortableDevicePropertiesBulk
+    uint64_t seed;
+};
+
+struct FakeObject {
+    std::wstring id;
+    std::wstring name;
+    std::wstring persistentId;
+    UINT32 parent;
+    bool folder;
+    ULONGLONG sizeBytes;
+    ULONGLONG date;             // FILETIME units
+    std::vector<UINT32> children;
+};
+
+// Immutable object model shared by every interface handed out by one
+// fake device. Object 0 is WPD_DEVICE_OBJECT_ID.
+class FakeDeviceModel {
+public:
+    explicit FakeDeviceModel(const FakeDeviceSpec &spec);
+
+    const FakeDeviceSpec &Spec() const { return spec; }
+    const FakeObject *Find(PCWSTR objectId) const;
+    const FakeObject &At(UINT32 index) const { return objects[index]; }
+    size_t Size() const { return objects.size(); }
+    ULONGLONG TotalBytes() const { return totalBytes; }
+
+    // Sleeps or spins for the configured per-call latency
+    void Delay() const;
+
+private:
+    UINT32 Add(const std::wstring &id, const std::wstring &name, UINT32 parent, bool folder,
+               ULONGLONG sizeBytes, ULONGLONG date);
+
+    FakeDeviceSpec spec;
+    std::vector<FakeObject> objects;
+    std::unordered_map<std::wstring, UINT32> byId;
+    ULONGLONG totalBytes = 0;
+};
+
+// Creates an in-process IPortableDevice that implements the content,
+// property, bulk property, enumeration and resource interfaces used by
+// wpd.cpp and wpdmeta.cpp. Property values are returned in the real
+// PortableDeviceValues objects, so the caller's thread must be in COM.
+HRESULT CreateFakeDevice(std::shared_ptr<const FakeDeviceModel> model, IPortableDevice **ppDevice);
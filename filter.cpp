@@ -0,0 +1,234 @@
+#include "filter.h"
+
+static inline char lowerAscii(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char) (c - 'A' + 'a') : c;
+}
+
+static inline bool isSeparator(char c) {
+    return c == '\\' || c == '/';
+}
+
+// Packs a lowercased extension of at most FILTER_MAX_EXT_LEN chars into a
+// non-zero integer key.
+static uint64_t packExtension(const char *ext, size_t len) {
+    uint64_t key = 0;
+    for (size_t i = 0; i < len; i++) {
+        key = (key << 8) | (BYTE) lowerAscii(ext[i]);
+    }
+    return key;
+}
+
+bool parseSize(const std::string &text, uint64_t *bytes) {
+    char *end = nullptr;
+    double value = strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0) {
+        return false;
+    }
+    std::string unit(end);
+    transform(unit.begin(), unit.end(), unit.begin(), ::tolower);
+    static const char *UNITS[] = {"b", "kb", "mb", "gb", "tb"};
+    double scale = 1;
+    for (const char *u : UNITS) {
+        if (unit.empty() || unit == u || (unit.size() == 1 && unit[0] == u[0] && unit[0] != 'b')) {
+            *bytes = (uint64_t) (value * scale);
+            return true;
+        }
+        scale *= 1000;
+    }
+    return false;
+}
+
+// Accepts YYYY, YYYY-MM or YYYY-MM-DD and returns the start of that period.
+static bool parseDate(const std::string &text, uint64_t *fileTime) {
+    SYSTEMTIME sysTime = {};
+    sysTime.wMonth = 1;
+    sysTime.wDay = 1;
+    int year = 0, month = 1, day = 1;
+    int fields = sscanf(text.c_str(), "%d-%d-%d", &year, &month, &day);
+    if (fields < 1 || year < 1601 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return false;
+    }
+    sysTime.wYear = (WORD) year;
+    sysTime.wMonth = (WORD) month;
+    sysTime.wDay = (WORD) day;
+    FILETIME ft;
+    if (!SystemTimeToFileTime(&sysTime, &ft)) {
+        return false;
+    }
+    *fileTime = ((uint64_t) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return true;
+}
+
+// Case-insensitive * and ? match with single-star backtracking; separators
+// of either kind compare equal.
+static bool globMatch(std::string_view pattern, std::string_view text) {
+    size_t p = 0, t = 0;
+    size_t starP = std::string_view::npos, starT = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            starP = p++;
+            starT = t;
+        } else if (p < pattern.size() && (pattern[p] == '?'
+                || lowerAscii(pattern[p]) == lowerAscii(text[t])
+                || (isSeparator(pattern[p]) && isSeparator(text[t])))) {
+            p++;
+            t++;
+        } else if (starP != std::string_view::npos) {
+            p = starP + 1;
+            t = ++starT;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+bool FileFilter::compile(const std::string &spec, FileFilter *filter, std::string *error) {
+    *filter = FileFilter();
+    std::vector<uint64_t> keys;
+    std::stringstream tokens(spec);
+    std::string token;
+    while (tokens >> token) {
+        if (token[0] == '>' || token[0] == '<') {
+            uint64_t bytes;
+            if (!parseSize(token.substr(1), &bytes)) {
+                *error = "Invalid size '" + token + "'";
+                return false;
+            }
+            (token[0] == '>' ? filter->minSize : filter->maxSize) = bytes;
+        } else if (token.rfind("after:", 0) == 0 || token.rfind("before:", 0) == 0) {
+            bool after = token[0] == 'a';
+            uint64_t fileTime;
+            if (!parseDate(token.substr(after ? 6 : 7), &fileTime)) {
+                *error = "Invalid date '" + token + "'";
+                return false;
+            }
+            (after ? filter->minTime : filter->maxTime) = fileTime;
+        } else if (token.find_first_of("*?") != std::string::npos) {
+            filter->globs.push_back(token);
+        } else {
+            std::stringstream exts(token);
+            std::string ext;
+            while (std::getline(exts, ext, ',')) {
+                ext.erase(std::remove(ext.begin(), ext.end(), '.'), ext.end());
+                if (ext.empty()) {
+                    continue;
+                }
+                if (ext.size() > FILTER_MAX_EXT_LEN) {
+                    *error = "Extension '" + ext + "' is longer than "
+                            + std::to_string(FILTER_MAX_EXT_LEN) + " characters";
+                    return false;
+                }
+                uint64_t key = packExtension(ext.c_str(), ext.size());
+                if (std::find(keys.begin(), keys.end(), key) == keys.end()) {
+                    keys.push_back(key);
+                }
+            }
+        }
+    }
+
+    if (keys.empty()) {
+        return true;
+    }
+
+    // Search for a multiplier that sends every extension to its own slot,
+    // growing the table if a few hundred candidates all collide.
+    filter->numExtensions = keys.size();
+    int bits = 3;
+    while (((size_t) 1 << bits) < keys.size() * 2) {
+        bits++;
+    }
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (;;) {
+        for (int attempt = 0; attempt < 256; attempt++) {
+            seed += 0x9E3779B97F4A7C15ULL;
+            uint64_t mult = (seed ^ (seed >> 31)) | 1;
+            filter->extMultiplier = mult;
+            filter->extShift = 64 - bits;
+            filter->extTable.assign((size_t) 1 << bits, 0);
+            bool perfect = true;
+            for (uint64_t key : keys) {
+                uint64_t *slot = &filter->extTable[filter->slotFor(key)];
+                if (*slot != 0) {
+                    perfect = false;
+                    break;
+                }
+                *slot = key;
+            }
+            if (perfect) {
+                return true;
+            }
+        }
+        bits++;
+    }
+}
+
+bool FileFilter::matchExtension(std::string_view name) const {
+    // Walk back from the end of the name to the dot, never past a separator
+    size_t len = 0;
+    size_t i = name.size();
+    while (i > 0) {
+        char c = name[i - 1];
+        if (c == '.') {
+            break;
+        }
+        if (isSeparator(c) || ++len > FILTER_MAX_EXT_LEN) {
+            return false;
+        }
+        i--;
+    }
+    if (i == 0 || len == 0) {
+        return false;
+    }
+    uint64_t key = packExtension(name.data() + i, len);
+    return extTable[slotFor(key)] == key;
+}
+
+bool FileFilter::matches(std::string_view name, uint64_t sizeBytes, uint64_t mtime) const {
+    if (numExtensions > 0 && !matchExtension(name)) {
+        return false;
+    }
+    if (sizeBytes < minSize || sizeBytes > maxSize || mtime < minTime || mtime >= maxTime) {
+        return false;
+    }
+    if (globs.empty()) {
+        return true;
+    }
+    size_t sep = name.find_last_of("\\/");
+    std::string_view filename = sep == std::string_view::npos ? name : name.substr(sep + 1);
+    for (const std::string &glob : globs) {
+        bool wholePath = glob.find_first_of("\\/") != std::string::npos;
+        if (globMatch(glob, wholePath ? name : filename)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FileFilter::empty() const {
+    return numExtensions == 0 && globs.empty() && minSize == 0 && maxSize == UINT64_MAX
+            && minTime == 0 && maxTime == UINT64_MAX;
+}
+
+std::string FileFilter::describe() const {
+    if (empty()) {
+        return "all files";
+    }
+    std::stringstream ss;
+    if (numExtensions > 0) {
+        ss << numExtensions << " extensions";
+    }
+    if (!globs.empty()) {
+        ss << (ss.tellp() > 0 ? ", " : "") << globs.size() << " globs";
+    }
+    if (minSize > 0 || maxSize != UINT64_MAX) {
+        ss << (ss.tellp() > 0 ? ", " : "") << "size range";
+    }
+    if (minTime > 0 || maxTime != UINT64_MAX) {
+        ss << (ss.tellp() > 0 ? ", " : "") << "date range";
+    }
+    return ss.str();
+}
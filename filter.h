@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+
+#define FILTER_MAX_EXT_LEN  8
+
+// File selection criteria parsed once from a space-separated spec such as
+//   jpg,jpeg,heic,mp4 >10KB <4GB after:2020 before:2024-07 IMG_*
+// Comma-separated words are extensions, >/< give a size range (B, KB, MB,
+// GB, TB), after:/before: give a write-time range and anything with * or ?
+// is a glob on the file name (or on the whole path if it has a separator).
+// matches() does no allocation: extensions are packed into an integer and
+// looked up in a perfect hash table built by compile().
+class FileFilter {
+public:
+    // Returns false and describes the problem in *error if spec is invalid.
+    static bool compile(const std::string &spec, FileFilter *filter, std::string *error);
+
+    // name may be a full path or a bare file name (e.g. a WPD object's
+    // original file name); mtime is in FILETIME units.
+    bool matches(std::string_view name, uint64_t sizeBytes, uint64_t mtime) const;
+
+    bool empty() const;
+    std::string describe() const;
+
+private:
+    bool matchExtension(std::string_view name) const;
+    size_t slotFor(uint64_t key) const { return (size_t) ((key * extMultiplier) >> extShift); }
+
+    std::vector<uint64_t> extTable;     // 0 marks an empty slot
+    uint64_t extMultiplier = 0;
+    int extShift = 64;
+    size_t numExtensions = 0;
+    std::vector<std::string> globs;
+    uint64_t minSize = 0;
+    uint64_t maxSize = UINT64_MAX;
+    uint64_t minTime = 0;
+    uint64_t maxTime = UINT64_MAX;
+};
+
+// Parses a size such as 500, 10KB or 1.5G (decimal units, as in filter specs)
+bool parseSize(const std::string &text, uint64_t *bytes);
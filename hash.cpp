@@ -0,0 +1,123 @@
+#include "hash.h"
+
+#include <cstring>
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t lane) {
+    acc ^= round64(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+Xxh64::Xxh64(uint64_t seed) {
+    lanes[0] = seed + PRIME1 + PRIME2;
+    lanes[1] = seed + PRIME2;
+    lanes[2] = seed;
+    lanes[3] = seed - PRIME1;
+}
+
+void Xxh64::update(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *) data;
+    const uint8_t *end = p + len;
+    totalLen += len;
+
+    if (pendingLen + len < sizeof(pending)) {
+        memcpy(pending + pendingLen, p, len);
+        pendingLen += len;
+        return;
+    }
+
+    if (pendingLen > 0) {
+        size_t fill = sizeof(pending) - pendingLen;
+        memcpy(pending + pendingLen, p, fill);
+        for (int i = 0; i < 4; i++) {
+            lanes[i] = round64(lanes[i], read64(pending + i * 8));
+        }
+        p += fill;
+        pendingLen = 0;
+    }
+
+    // Main loop: 32-byte stripes, one 8-byte word per independent lane
+    uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    while (end - p >= 32) {
+        v1 = round64(v1, read64(p));
+        v2 = round64(v2, read64(p + 8));
+        v3 = round64(v3, read64(p + 16));
+        v4 = round64(v4, read64(p + 24));
+        p += 32;
+    }
+    lanes[0] = v1; lanes[1] = v2; lanes[2] = v3; lanes[3] = v4;
+
+    pendingLen = end - p;
+    memcpy(pending, p, pendingLen);
+}
+
+uint64_t Xxh64::digest() const {
+    uint64_t h;
+    if (totalLen >= 32) {
+        h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = mergeRound(h, lanes[i]);
+        }
+    } else {
+        h = lanes[2] + PRIME5;
+    }
+    h += totalLen;
+
+    const uint8_t *p = pending;
+    const uint8_t *end = pending + pendingLen;
+    while (end - p >= 8) {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t) read32(p) * PRIME1;
+        h = rotl64(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME5;
+        h = rotl64(h, 11) * PRIME1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+    Xxh64 state(seed);
+    state.update(data, len);
+    return state.digest();
+}
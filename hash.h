@@ -0,0 +1,24 @@
+#pragma once
+
+// Only standard headers, so copybackend.cpp can checksum without common.h
+#include <cstddef>
+#include <cstdint>
+
+// Streaming XXH64. The four independent accumulator lanes let the CPU keep
+// several multiplies in flight, so hashing runs well above disk speed
+// without any platform-specific intrinsics.
+class Xxh64 {
+public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    void update(const void *data, size_t len);
+    uint64_t digest() const;
+
+private:
+    uint64_t lanes[4];
+    uint64_t totalLen = 0;
+    uint8_t pending[32];
+    size_t pendingLen = 0;
+};
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed = 0);
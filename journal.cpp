@@ -0,0 +1,247 @@
+#include "journal.h"
+#include "hash.h"
+
+// On-disk layout (little endian, no padding):
+//   header: char magic[4], uint32_t version
+//   record: char type, uint8_t overwrite, uint16_t keyLen, uint16_t dstLen,
+//           uint64_t sizeBytes, uint64_t mtime, uint64_t dateTaken,
+//           char key[keyLen], char dst[dstLen],
+//           uint32_t check (low half of the XXH64 of everything before it)
+// Records are only ever appended, so a crash can at worst tear the last
+// batch; replay stops at the first record whose check does not match.
+// Version 1 records have no dateTaken; they still replay, with it set to 0.
+static const char JOURNAL_MAGIC[4] = {'B', 'B', 'J', 'L'};
+static const uint32_t JOURNAL_VERSION = 2;
+static const uint32_t JOURNAL_VERSION_NO_DATES = 1;
+static const size_t HEADER_SIZE = sizeof(JOURNAL_MAGIC) + sizeof(uint32_t);
+static const size_t RECORD_FIXED_SIZE = 2 + 2 * sizeof(uint16_t) + 3 * sizeof(uint64_t);
+
+static const char RECORD_PLANNED = 'P';
+static const char RECORD_DONE = 'D';
+static const char RECORD_WALKED = 'W';
+
+template <typename T>
+static T readField(const char **cursor) {
+    T value;
+    memcpy(&value, *cursor, sizeof(T));
+    *cursor += sizeof(T);
+    return value;
+}
+
+template <typename T>
+static void appendField(std::string *out, T value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+BackupJournal::~BackupJournal() {
+    if (file != INVALID_HANDLE_VALUE) {
+        flush();
+        CloseHandle(file);
+    }
+}
+
+bool BackupJournal::load(BackupManifest *manifest) {
+    HANDLE in = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (in == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(in, &fileSize) || fileSize.QuadPart < (LONGLONG) HEADER_SIZE
+            || fileSize.QuadPart > MAXDWORD) {
+        CloseHandle(in);
+        return false;
+    }
+
+    blob.resize((size_t) fileSize.QuadPart);
+    DWORD bytesRead = 0;
+    bool readOk = ReadFile(in, blob.data(), (DWORD) blob.size(), &bytesRead, nullptr)
+            && bytesRead == blob.size();
+    CloseHandle(in);
+    const char *cursor = blob.data() + sizeof(JOURNAL_MAGIC);
+    uint32_t version = readOk ? readField<uint32_t>(&cursor) : 0;
+    if (!readOk || memcmp(blob.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0
+            || (version != JOURNAL_VERSION && version != JOURNAL_VERSION_NO_DATES)) {
+        blob.clear();
+        return false;
+    }
+    bool hasDates = version == JOURNAL_VERSION;
+    size_t fixedSize = hasDates ? RECORD_FIXED_SIZE : RECORD_FIXED_SIZE - sizeof(uint64_t);
+
+    const char *end = blob.data() + blob.size();
+    std::vector<JournalRecord> planned;
+    while ((size_t) (end - cursor) >= fixedSize) {
+        const char *start = cursor;
+        char type = readField<char>(&cursor);
+        bool overwrite = readField<uint8_t>(&cursor) != 0;
+        uint16_t keyLen = readField<uint16_t>(&cursor);
+        uint16_t dstLen = readField<uint16_t>(&cursor);
+        uint64_t sizeBytes = readField<uint64_t>(&cursor);
+        uint64_t mtime = readField<uint64_t>(&cursor);
+        uint64_t dateTaken = hasDates ? readField<uint64_t>(&cursor) : 0;
+        if ((size_t) (end - cursor) < (size_t) keyLen + dstLen + sizeof(uint32_t)) {
+            break;
+        }
+        std::string_view key(cursor, keyLen);
+        std::string_view dstPath(cursor + keyLen, dstLen);
+        cursor += keyLen + dstLen;
+        uint32_t check = (uint32_t) xxh64(start, cursor - start);
+        if (readField<uint32_t>(&cursor) != check) {
+            break;
+        }
+
+        JournalRecord record{key, sizeBytes, mtime, overwrite, dstPath, dateTaken};
+        if (type == RECORD_PLANNED) {
+            planned.push_back(record);
+        } else if (type == RECORD_DONE) {
+            done[key] = record;
+            manifest->record(key, sizeBytes, mtime, std::string(dstPath), dateTaken);
+        } else if (type == RECORD_WALKED) {
+            walkDone = true;
+        } else {
+            break;
+        }
+        validBytes = cursor - blob.data();
+    }
+    // Nothing to replay: the run was interrupted before it logged anything.
+    // validBytes stays 0, so open() starts the file over with a new header.
+    if (validBytes == 0) {
+        return false;
+    }
+    // New records cannot follow old ones, so open() writes the replayed
+    // ones again in the current version
+    rewrite = !hasDates;
+
+    for (const auto &kv : done) {
+        doneByteCount += kv.second.sizeBytes;
+    }
+
+    // A resumed run that was itself interrupted may have planned a copy twice
+    std::unordered_set<std::string_view> seen;
+    for (const JournalRecord &record : planned) {
+        if (done.find(record.key) == done.end() && seen.insert(record.key).second) {
+            pendingRecords.push_back(record);
+        }
+    }
+    resuming = true;
+    return true;
+}
+
+bool BackupJournal::open() {
+    file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                       OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // Cut off a torn tail so new records follow the last valid one
+    LARGE_INTEGER offset;
+    offset.QuadPart = rewrite ? 0 : (LONGLONG) validBytes;
+    if (!SetFilePointerEx(file, offset, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    if (validBytes == 0 || rewrite) {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.append(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        appendField<uint32_t>(&buffer, JOURNAL_VERSION);
+    }
+    lastFlushTime = (int64_t) GetTickCount64();
+    if (rewrite) {
+        for (const JournalRecord &record : pendingRecords) {
+            plan(record.key, record.sizeBytes, record.mtime, record.overwrite);
+        }
+        for (const auto &kv : done) {
+            const JournalRecord &record = kv.second;
+            append(RECORD_DONE, record.key, record.sizeBytes, record.mtime, record.dateTaken, false,
+                   record.dstPath);
+        }
+        if (walkDone) {
+            append(RECORD_WALKED, std::string_view(), 0, 0, 0, false, std::string_view());
+        }
+        rewrite = false;
+    }
+    return flush();
+}
+
+void BackupJournal::plan(std::string_view key, uint64_t sizeBytes, uint64_t mtime, bool overwrite) {
+    append(RECORD_PLANNED, key, sizeBytes, mtime, 0, overwrite, std::string_view());
+}
+
+void BackupJournal::complete(std::string_view key, uint64_t sizeBytes, uint64_t mtime, const std::string &dstPath,
+                             uint64_t dateTaken) {
+    append(RECORD_DONE, key, sizeBytes, mtime, dateTaken, false, dstPath);
+}
+
+void BackupJournal::walkFinished() {
+    append(RECORD_WALKED, std::string_view(), 0, 0, 0, false, std::string_view());
+    flush();
+}
+
+void BackupJournal::append(char type, std::string_view key, uint64_t sizeBytes, uint64_t mtime, uint64_t dateTaken,
+                           bool overwrite, std::string_view dstPath) {
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    bool due;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t start = buffer.size();
+        appendField<char>(&buffer, type);
+        appendField<uint8_t>(&buffer, overwrite ? 1 : 0);
+        appendField<uint16_t>(&buffer, (uint16_t) key.size());
+        appendField<uint16_t>(&buffer, (uint16_t) dstPath.size());
+        appendField<uint64_t>(&buffer, sizeBytes);
+        appendField<uint64_t>(&buffer, mtime);
+        appendField<uint64_t>(&buffer, dateTaken);
+        buffer.append(key);
+        buffer.append(dstPath);
+        appendField<uint32_t>(&buffer, (uint32_t) xxh64(buffer.data() + start, buffer.size() - start));
+        bufferedRecords++;
+        due = bufferedRecords >= JOURNAL_FLUSH_RECORDS
+                || (int64_t) GetTickCount64() - lastFlushTime >= JOURNAL_FLUSH_MS;
+    }
+    if (due) {
+        writeOut(false);
+    }
+}
+
+bool BackupJournal::flush() {
+    return writeOut(true);
+}
+
+// Swaps the buffer out under flushMutex, so batches reach the file in the
+// order they were buffered. Unless wait is set, a caller that finds another
+// flush running leaves its records for the next one.
+bool BackupJournal::writeOut(bool wait) {
+    std::unique_lock<std::mutex> flushLock(flushMutex, std::defer_lock);
+    if (wait) {
+        flushLock.lock();
+    } else if (!flushLock.try_lock()) {
+        return true;
+    }
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out.swap(buffer);
+        bufferedRecords = 0;
+        lastFlushTime = (int64_t) GetTickCount64();
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    if (out.empty()) {
+        return true;
+    }
+    DWORD bytesWritten = 0;
+    return WriteFile(file, out.data(), (DWORD) out.size(), &bytesWritten, nullptr)
+            && bytesWritten == out.size() && FlushFileBuffers(file);
+}
+
+void BackupJournal::finish() {
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+    DeleteFileA(path.c_str());
+}
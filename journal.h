@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common.h"
+#include "manifest.h"
+
+#define JOURNAL_FILE_NAME       "bulldozer.journal"
+// A batch of records is written and flushed once either limit is reached
+#define JOURNAL_FLUSH_RECORDS   256
+#define JOURNAL_FLUSH_MS        1000
+
+// One planned or completed copy read back from a journal. Views point into
+// the journal's buffer and stay valid for its lifetime.
+struct JournalRecord {
+    std::string_view key;
+    uint64_t sizeBytes;
+    uint64_t mtime;
+    bool overwrite;
+    std::string_view dstPath;   // completed copies only
+    uint64_t dateTaken;         // completed copies only; 0 if none
+};
+
+// Write-ahead log of one source's backup, kept beside its manifest while a
+// run is in progress. The walker records each copy it plans and workers
+// record each copy once it has been renamed into place. After an
+// interruption the next run replays it: completed copies go straight into
+// the manifest, and if the walk had finished only the unfinished copies are
+// redone, without walking or statting the source again.
+class BackupJournal {
+public:
+    explicit BackupJournal(std::string journalPath) : path(std::move(journalPath)) {}
+    ~BackupJournal();
+
+    BackupJournal(const BackupJournal &) = delete;
+    BackupJournal &operator=(const BackupJournal &) = delete;
+
+    // Reads a journal left by an interrupted run and records its completed
+    // copies in manifest. Returns false if there is none to resume, or it
+    // holds no records.
+    bool load(BackupManifest *manifest);
+    // Opens the journal for appending, after any valid records load() read
+    bool open();
+
+    bool resumed() const { return resuming; }
+    bool walkComplete() const { return walkDone; }
+    // Copies the interrupted run planned but did not finish
+    const std::vector<JournalRecord> &pending() const { return pendingRecords; }
+    // True if the interrupted run finished this copy. Only consults what
+    // load() read, so it is safe to call while workers are completing.
+    bool isDone(std::string_view key) const { return done.find(key) != done.end(); }
+    size_t doneCount() const { return done.size(); }
+    uint64_t doneBytes() const { return doneByteCount; }
+
+    void plan(std::string_view key, uint64_t sizeBytes, uint64_t mtime, bool overwrite);
+    void complete(std::string_view key, uint64_t sizeBytes, uint64_t mtime, const std::string &dstPath,
+                  uint64_t dateTaken);
+    // Records that every copy has been planned, and flushes so a resume
+    // can trust it.
+    void walkFinished();
+
+    // Writes and flushes buffered records
+    bool flush();
+    // Closes and deletes the journal once the manifest holds everything
+    void finish();
+
+private:
+    void append(char type, std::string_view key, uint64_t sizeBytes, uint64_t mtime, uint64_t dateTaken,
+                bool overwrite, std::string_view dstPath);
+    bool writeOut(bool wait);
+
+    std::string path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::vector<char> blob;
+    size_t validBytes = 0;
+    bool rewrite = false;       // load() read an older version, which open() replaces
+    bool resuming = false;
+    bool walkDone = false;
+    std::unordered_map<std::string_view, JournalRecord> done;
+    uint64_t doneByteCount = 0;
+    std::vector<JournalRecord> pendingRecords;
+
+    // Records are buffered under mutex; flushMutex orders the writes, and
+    // workers that find a flush already running just move on.
+    std::string buffer;
+    size_t bufferedRecords = 0;
+    int64_t lastFlushTime = 0;
+    std::mutex mutex;
+    std::mutex flushMutex;
+};
@@ -0,0 +1,81 @@
+#include "layout.h"
+
+static const std::string MONTHS[] = {
+        "January",
+        "February",
+        "March",
+        "April",
+        "May",
+        "June",
+        "July",
+        "August",
+        "September",
+        "October",
+        "November",
+        "December"
+};
+
+// Files whose date could not be read go here instead of a year\month folder
+static const char *UNKNOWN_DATE_DIR = "Unknown";
+static const uint32_t UNKNOWN_DATE_KEY = UINT32_MAX;
+
+DestinationLayout::DestinationLayout(const std::string &baseDstPath, const std::string &driveName) {
+    driveDir = baseDstPath;
+    if (driveDir.empty() || driveDir.back() != '\\') {
+        driveDir.push_back('\\');
+    }
+    driveDir += driveName + '\\';
+
+    // The drive folder and its parents are shared by every file, so create
+    // them up front. Each file used to repeat this plus the year and month.
+    size_t ctr = 0;
+    legacyMkdirsPerFile = 2;
+    while ((ctr = driveDir.find_first_of("\\/", ctr + 1)) != std::string::npos) {
+        CreateDirectoryA(driveDir.substr(0, ctr).c_str(), nullptr);
+        mkdirCallCount++;
+        legacyMkdirsPerFile++;
+    }
+}
+
+const std::string &DestinationLayout::monthDir(WORD year, WORD month) {
+    // A date that failed to convert has no month to index MONTHS with
+    bool known = month >= 1 && month <= 12;
+    uint32_t key = known ? year * 12u + (month - 1) : UNKNOWN_DATE_KEY;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = monthDirs.find(key);
+        if (it != monthDirs.end()) {
+            mkdirAvoidedCount.fetch_add(legacyMkdirsPerFile, std::memory_order_relaxed);
+            return it->second;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    // Another worker may have created it while we waited for the lock
+    auto it = monthDirs.find(key);
+    if (it != monthDirs.end()) {
+        mkdirAvoidedCount.fetch_add(legacyMkdirsPerFile, std::memory_order_relaxed);
+        return it->second;
+    }
+
+    std::string dir;
+    if (known) {
+        dir = driveDir + std::to_string(year) + '\\';
+        if (yearDirs.insert(year).second) {
+            CreateDirectoryA(dir.c_str(), nullptr);
+            mkdirCallCount++;
+        }
+        dir += MONTHS[month - 1] + '\\';
+    } else {
+        dir = driveDir + UNKNOWN_DATE_DIR + '\\';
+    }
+    CreateDirectoryA(dir.c_str(), nullptr);
+    mkdirCallCount++;
+    return monthDirs.emplace(key, std::move(dir)).first->second;
+}
+
+void DestinationLayout::buildPath(WORD year, WORD month, const char *filename, std::string *dstPath) {
+    const std::string &dir = monthDir(year, month);
+    dstPath->assign(dir);
+    dstPath->append(filename);
+}
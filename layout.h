@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+
+// Copies are written under this suffix and renamed into place once
+// complete, so an interrupted copy never looks like a finished backup.
+#define PARTIAL_FILE_SUFFIX     ".bdpart"
+
+// Builds <base>\<drive>\<year>\<MONTH>\<filename> destination paths for one
+// source drive. Each year/month folder is formatted and created once, after
+// which lookups are a shared-lock hash probe with no directory syscalls and
+// no string allocation.
+class DestinationLayout {
+public:
+    DestinationLayout(const std::string &baseDstPath, const std::string &driveName);
+
+    // Returns the month folder (with trailing separator) for the given date,
+    // creating it and any missing parents the first time it is seen. A month
+    // outside 1..12 maps to <base>\<drive>\Unknown\.
+    const std::string &monthDir(WORD year, WORD month);
+
+    // Writes the full destination path for filename into *dstPath, reusing
+    // its existing capacity.
+    void buildPath(WORD year, WORD month, const char *filename, std::string *dstPath);
+
+    // <base>\<drive>\ with trailing separator
+    const std::string &rootDir() const { return driveDir; }
+
+    uint64_t mkdirCalls() const { return mkdirCallCount.load(); }
+    uint64_t mkdirAvoided() const { return mkdirAvoidedCount.load(); }
+
+private:
+    std::string driveDir;
+    std::unordered_map<uint32_t, std::string> monthDirs;
+    std::unordered_set<WORD> yearDirs;
+    size_t legacyMkdirsPerFile;
+    std::shared_mutex mutex;
+    std::atomic<uint64_t> mkdirCallCount{0};
+    std::atomic<uint64_t> mkdirAvoidedCount{0};
+};
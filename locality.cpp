@@ -0,0 +1,73 @@
+#include "locality.h"
+
+#include <windows.h>
+#include <winioctl.h>
+
+uint64_t diskLocation(const char *path) {
+    HANDLE file = CreateFileA(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, 0, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return UINT64_MAX;
+    }
+    // Only the first extent is wanted; more of them is ERROR_MORE_DATA
+    STARTING_VCN_INPUT_BUFFER start{};
+    RETRIEVAL_POINTERS_BUFFER extents{};
+    DWORD bytesReturned = 0;
+    bool mapped = (DeviceIoControl(file, FSCTL_GET_RETRIEVAL_POINTERS, &start, sizeof(start), &extents,
+                                   sizeof(extents), &bytesReturned, nullptr) || GetLastError() == ERROR_MORE_DATA)
+            && extents.ExtentCount > 0 && extents.Extents[0].Lcn.QuadPart >= 0;
+    uint64_t location = (uint64_t) extents.Extents[0].Lcn.QuadPart;
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!mapped) {
+        location = GetFileInformationByHandle(file, &info)
+                ? LOCALITY_BY_ID | ((uint64_t) info.nFileIndexHigh << 32) | info.nFileIndexLow
+                : UINT64_MAX;
+    }
+    CloseHandle(file);
+    return location;
+}
+
+bool seeksAreSlow(const std::string &path) {
+    char volumePath[MAX_PATH];
+    if (!GetVolumePathNameA(path.c_str(), volumePath, sizeof(volumePath))) {
+        return false;
+    }
+    // "E:\" becomes "\\.\E:"; mounted folders and shares are not asked
+    std::string devicePath = std::string("\\\\.\\") + volumePath;
+    if (devicePath.back() == '\\') {
+        devicePath.pop_back();
+    }
+    HANDLE volume = CreateFileA(devicePath.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                                0, nullptr);
+    if (volume != INVALID_HANDLE_VALUE) {
+        STORAGE_PROPERTY_QUERY query{};
+        query.PropertyId = StorageDeviceSeekPenaltyProperty;
+        query.QueryType = PropertyStandardQuery;
+        DEVICE_SEEK_PENALTY_DESCRIPTOR penalty{};
+        DWORD bytesReturned = 0;
+        bool answered = DeviceIoControl(volume, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &penalty,
+                                        sizeof(penalty), &bytesReturned, nullptr)
+                && bytesReturned >= sizeof(penalty);
+        CloseHandle(volume);
+        if (answered) {
+            return penalty.IncursSeekPenalty != FALSE;
+        }
+    }
+    return GetDriveTypeA(volumePath) == DRIVE_REMOVABLE;
+}
+
+static const char *LOCALITY_MODE_NAMES[] = {"auto", "on", "off"};
+
+const char *localityModeName(LocalityMode mode) {
+    return LOCALITY_MODE_NAMES[mode];
+}
+
+bool parseLocalityMode(const std::string &text, LocalityMode *mode) {
+    for (int i = 0; i < 3; i++) {
+        if (text == LOCALITY_MODE_NAMES[i]) {
+            *mode = (LocalityMode) i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Queued copies are reordered this many at a time
+#define LOCALITY_WINDOW     512
+
+enum LocalityMode {
+    LOCALITY_AUTO,          // on for sources where seeks are slow
+    LOCALITY_ON,
+    LOCALITY_OFF
+};
+
+// Set in keys that are a file ID instead of a physical offset, so files
+// whose position is unknown sort after the rest, still in ID order.
+#define LOCALITY_BY_ID      (1ULL << 63)
+
+// Where a file's data starts on its volume: the first extent from
+// FSCTL_GET_RETRIEVAL_POINTERS. Files stored inline or on file systems that
+// cannot map extents fall back to their file ID, which usually tracks
+// allocation order.
+// Returns UINT64_MAX if the file cannot be opened.
+uint64_t diskLocation(const char *path);
+
+// True if reads from the volume holding path pay for seeks: spinning disks,
+// and removable cards behind readers that do not say either way.
+bool seeksAreSlow(const std::string &path);
+
+// Whether a source should be read in disk order
+inline bool useLocalityOrder(LocalityMode mode, const std::string &path) {
+    return mode == LOCALITY_ON || (mode == LOCALITY_AUTO && seeksAreSlow(path));
+}
+
+const char *localityModeName(LocalityMode mode);
+bool parseLocalityMode(const std::string &text, LocalityMode *mode);
@@ -1,49 +1,9 @@
 #include "common.h"
 #include "wpd.h"
-
-static const std::filesystem::directory_options FS_DIR_OPTS = (
-        std::filesystem::directory_options::follow_directory_symlink |
-        std::filesystem::directory_options::skip_permission_denied
-);
-
-static const std::string MONTHS[] = {
-        "January",
-        "February",
-        "March",
-        "April",
-        "May",
-        "June",
-        "July",
-        "August",
-        "September",
-        "October",
-        "November",
-        "December"
-};
-
-static const char BYTE_PREFIXES[] = {'k', 'M', 'G', 'T', 'P', 'E'};
-
-struct CopyResult {
-    bool success;
-    LARGE_INTEGER sizeBytes;
-};
-
-
-std::string lastErrorMessage() {
-    DWORD errMsgId = GetLastError();
-    LPSTR msgBuf = nullptr;
-    size_t msgSize = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-                                    nullptr, errMsgId, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-                                    (LPSTR) &msgBuf, 0, nullptr);
-    std::string message(msgBuf, msgSize);
-    LocalFree(msgBuf);
-    return message;
-}
-
-int getCurrentMsTime() {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-}
+#include "session.h"
+#include "profile.h"
+#include "daemon.h"
+#include "verify.h"
 
 std::string printDrive(Drive *drive, bool toStdOut) {
     std::stringstream ss;
@@ -54,80 +14,54 @@ std::string printDrive(Drive *drive, bool toStdOut) {
     return ss.str();
 }
 
-SYSTEMTIME getFileTime(HANDLE *file) {
-    FILETIME fileTime;
-    GetFileTime(*file, &fileTime, nullptr, nullptr);
-    SYSTEMTIME sysTime;
-    FileTimeToSystemTime(&fileTime, &sysTime);
-    return sysTime;
-}
-
-std::vector<Drive> getLogicalDrives() {
-    DWORD reqBufSize = GetLogicalDriveStringsA(0, nullptr);
-    LPSTR driveLetters = new TCHAR[reqBufSize];
-    GetLogicalDriveStringsA(reqBufSize, driveLetters);
-    LPSTR loopDrive = driveLetters;
-    std::vector<Drive> drives = {};
-    do {
-        if (strcmp(loopDrive, "C:\\") != 0) {
-            LPSTR volName = new TCHAR[256];
-            GetVolumeInformationA(loopDrive, volName, (DWORD) 256,
-                    nullptr, nullptr, nullptr, nullptr, 0);
-            drives.push_back(Drive{std::string(1, loopDrive[0]) + ":\\", volName});
-            delete[] volName;
-        }
-        while (*loopDrive++);
-    } while (*loopDrive);
-    return drives;
-}
-
-CopyResult copyFile(std::string *srcPath, const Drive *srcDrive, const std::string *baseDstPath) {
-    LPCSTR lpcSrcPath = srcPath->c_str();
-    HANDLE srcFile = CreateFileA(lpcSrcPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
-    SYSTEMTIME time = getFileTime(&srcFile);
-
-    std::stringstream dstPathSS;
-    std::string filename = srcPath->substr(srcPath->find_last_of('\\') + 1);
-    dstPathSS << *baseDstPath << '\\' << srcDrive->name << '\\' << time.wYear << '\\'
-               << MONTHS[time.wMonth - 1] << '\\' << filename;
-
-    std::string fileDstPath = dstPathSS.str();
-    std::string dirDstPath = fileDstPath.substr(0, fileDstPath.find_last_of('\\'));
-
-    size_t ctr = 0;
-    do {
-        ctr = dirDstPath.find_first_of("\\/", ctr + 1);
-        CreateDirectory(dirDstPath.substr(0, ctr).c_str(), nullptr);
-    } while (ctr != std::string::npos);
-
-    bool success = CopyFileA(lpcSrcPath, fileDstPath.c_str(), TRUE);
-    LARGE_INTEGER fileSize;
-    GetFileSizeEx(srcFile, &fileSize);
-    return CopyResult{success, fileSize};
-}
-
-IndexedDrive selectDrive(std::vector<Drive> *drives, std::vector<WPDevice> *wpDevices) {
+// Accepts one index, a comma-separated list such as "0,2" or "a" for every
+// drive and device, so several sources can be backed up in one session.
+std::vector<IndexedDrive> selectDrives(std::vector<Drive> *drives, std::vector<WPDevice> *wpDevices) {
     size_t i;
     for (i = 0; i < drives->size(); i++) {
         std::cout << i << ") " << printDrive(&drives->at(i), false);
     }
     for (i = 0; i < wpDevices->size(); i++) {
-        std::cout << drives->size() + i << ") " << printDrive(&wpDevices->at(i), false);
+        std::cout << drives->size() + i << ") WPD - " << wpDevices->at(i).name << std::endl;
     }
+    std::cout << "(comma-separate several, or a for all)" << std::endl;
+    size_t numSources = drives->size() + wpDevices->size();
+    std::vector<UINT> indices;
     std::string sel;
     do {
         std::getline(std::cin, sel);
-    } while (sel.empty());
-    UINT idx = std::stoi(sel);
-    Drive *selDrive;
-    bool isWPD;
-    if (isWPD = i >= drives->size()) {
-        idx -= drives->size();
-        selDrive = &wpDevices->at(idx);
-    } else {
-        selDrive = &drives->at(idx);
-    }
-    return IndexedDrive{selDrive->path, selDrive->name, idx, isWPD};
+        if (!sel.empty() && tolower(sel.at(0)) == 'a') {
+            for (i = 0; i < numSources; i++) {
+                indices.push_back((UINT) i);
+            }
+            break;
+        }
+        std::stringstream items(sel);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            if (item.find_first_of("0123456789") == std::string::npos) {
+                continue;
+            }
+            UINT idx = std::stoi(item);
+            if (idx < numSources && std::find(indices.begin(), indices.end(), idx) == indices.end()) {
+                indices.push_back(idx);
+            }
+        }
+    } while (indices.empty());
+
+    std::vector<IndexedDrive> selected;
+    for (UINT idx : indices) {
+        Drive *selDrive;
+        bool isWPD;
+        if ((isWPD = idx >= drives->size())) {
+            idx -= drives->size();
+            selDrive = &wpDevices->at(idx);
+        } else {
+            selDrive = &drives->at(idx);
+        }
+        selected.push_back(IndexedDrive{selDrive->path, selDrive->name, idx, isWPD});
+    }
+    return selected;
 }
 
 std::string userInput(const std::string &preMessage, bool allowBlank) {
@@ -139,82 +73,136 @@ std::string userInput(const std::string &preMessage, bool allowBlank) {
     return sel;
 }
 
-std::string bytesHumanReadable(int64_t numBytes) {
-    if (-1000 < numBytes && numBytes < 1000) {
-        return std::to_string(numBytes) + " B";
-    }
-    size_t idx = 0;
-    while (numBytes <= -999950 || numBytes >= 999950) {
-        numBytes /= 1000;
-        idx++;
-    }
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%.2f %cB", numBytes / 1000.0, BYTE_PREFIXES[idx]);
-    return std::string(buf);
-}
+static const char USAGE[] = "Usage: backup_bulldozer [--follow DIR]... [--disk-order auto|on|off] | --verify DIR"
+                            " | --daemon [--profiles FILE] [--watch DIR]";
 
-void cleanExtension(std::string *ext) {
-    ext->erase(std::remove(ext->begin(), ext->end(), '.'), ext->end());
-    transform(ext->begin(), ext->end(), ext->begin(), ::tolower);
+// A hot folder given with --follow, named after itself like a drive
+static IndexedDrive followedFolder(std::string path) {
+    if (!path.empty() && path.back() != '\\') {
+        path.push_back('\\');
+    }
+    std::string name = std::filesystem::path(path).parent_path().filename().string();
+    return IndexedDrive{path, name, 0, false};
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     wpdInitialize();
+    bool daemonMode = false;
+    std::string profilesPath = defaultProfilesPath();
+    std::string watchDir;
+    std::vector<IndexedDrive> followed;
+    std::string verifyDir;
+    LocalityMode locality = LOCALITY_AUTO;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--daemon") {
+            daemonMode = true;
+        } else if (arg == "--profiles" && i + 1 < argc) {
+            profilesPath = argv[++i];
+        } else if (arg == "--watch" && i + 1 < argc) {
+            watchDir = argv[++i];
+        } else if (arg == "--follow" && i + 1 < argc) {
+            followed.push_back(followedFolder(argv[++i]));
+        } else if (arg == "--verify" && i + 1 < argc) {
+            verifyDir = argv[++i];
+        } else if (arg == "--disk-order" && i + 1 < argc && parseLocalityMode(argv[i + 1], &locality)) {
+            i++;
+        } else {
+            std::cout << USAGE << std::endl;
+            return 1;
+        }
+    }
+    if (daemonMode) {
+        return runDaemon(profilesPath, watchDir);
+    }
+    if (!verifyDir.empty()) {
+        return runVerify(verifyDir, DEFAULT_COPY_WORKERS);
+    }
+
     std::vector<Drive> drives = getLogicalDrives();
     std::string out = userInput("Base destination path:", false);
     if (out.at(out.size() - 1) != '\\') {
         out.push_back('\\');
     }
-    std::string fileType = userInput("File type (blank if all):", true);
-    if (!fileType.empty()) {
-        cleanExtension(&fileType);
+    FileFilter filter;
+    std::string filterSpec;
+    std::string filterError;
+    while (!FileFilter::compile(filterSpec = userInput("File filter (blank if all, e.g. jpg,heic,mp4 >10KB after:2020 IMG_*):", true),
+                                &filter, &filterError)) {
+        std::cout << "! " << filterError << std::endl;
     }
-
-    CComPtr<IPortableDevice> portableDevice;
-    std::vector<WPDevice> wpDevices = GetAllDevices();
-
-    IndexedDrive selDrive = selectDrive(&drives, &wpDevices);
-    if (selDrive.isWPD) {
-        ChooseDevice(&portableDevice, selDrive.index, wpDevices.size());
-        std::vector<std::string> deviceObjectIds;
-        GetAllContent(portableDevice, &deviceObjectIds);
-        return 0;
+    std::string workersSel = userInput("Copy workers (blank to find the best count for each source, up to "
+            + std::to_string(ADAPTIVE_MAX_WORKERS) + "):", true);
+    bool adaptive = workersSel.empty();
+    int numWorkersSel = adaptive ? ADAPTIVE_MAX_WORKERS : std::stoi(workersSel);
+    UINT numWorkers = numWorkersSel > 0 ? numWorkersSel : 1;
+    std::string dedupSel = userInput("Deduplicate against destination? (y/N):", true);
+    bool dedupEnabled = !dedupSel.empty() && tolower(dedupSel.at(0)) == 'y';
+    uint64_t packThreshold = 0;
+    std::string packSel;
+    while (!(packSel = userInput("Pack files smaller than (blank for off, e.g. 64KB):", true)).empty()
+            && !parseSize(packSel, &packThreshold)) {
+        std::cout << "! Invalid size '" << packSel << "'" << std::endl;
     }
-    if (selDrive.name.empty()) {
-        selDrive.name = userInput("Drive name missing, input new name:", false);
+    std::string compressSel = userInput("Compress files that compress well? (y/N):", true);
+    bool compressEnabled = !compressSel.empty() && tolower(compressSel.at(0)) == 'y';
+    std::string checksumSel = userInput("Checksum drive copies for --verify? They then pass through memory (y/N):",
+                                        true);
+    bool checksums = !checksumSel.empty() && tolower(checksumSel.at(0)) == 'y';
+    std::unique_ptr<CopyBackend> backend;
+    std::string backendSel;
+    while (backend == nullptr) {
+        backendSel = userInput("Copy backend (blank for " DEFAULT_COPY_BACKEND ", or " COPY_BACKEND_NAMES "):",
+                               true);
+        backend = createCopyBackend(backendSel.empty() ? DEFAULT_COPY_BACKEND : backendSel);
+        if (backend == nullptr) {
+            std::cout << "! Unknown copy backend '" << backendSel << "'" << std::endl;
+        }
     }
 
-    int64_t copiedBytes = 0;
-    int64_t skippedBytes = 0;
-    int startTime = getCurrentMsTime();
-    std::cout << "Starting copy..." << std::endl;
-    for (const std::filesystem::directory_entry &entry :
-            std::filesystem::recursive_directory_iterator(selDrive.path, FS_DIR_OPTS)) {
-        std::string inPath = entry.path().string();
-        size_t extPos = inPath.find_last_of('.');
-        bool skipType = fileType.empty();
-
-        if (!skipType && extPos != std::string::npos) {
-            std::string pathExt = inPath.substr(extPos);
-            cleanExtension(&pathExt);
-            skipType = strcmp(pathExt.c_str(), fileType.c_str()) == 0;
+    // Followed folders replace the drive list
+    std::vector<WPDevice> wpDevices;
+    std::vector<IndexedDrive> selected = followed;
+    if (selected.empty()) {
+        wpDevices = GetAllDevices();
+        selected = selectDrives(&drives, &wpDevices);
+    }
+    std::vector<std::unique_ptr<BackupSource>> sources;
+    for (IndexedDrive &selDrive : selected) {
+        if (selDrive.name.empty()) {
+            selDrive.name = userInput("Name missing for " + selDrive.path + ", input new name:", false);
         }
-
-        if (!entry.is_directory() && skipType) {
-            CopyResult result = copyFile(&inPath, &selDrive, &out);
-            if (result.success) {
-                copiedBytes += result.sizeBytes.QuadPart;
-            } else {
-                skippedBytes += result.sizeBytes.QuadPart;
+        std::unique_ptr<BackupSource> source = std::make_unique<BackupSource>();
+        if (selDrive.isWPD) {
+            OpenDevice(&source->device, selDrive.path);
+            if (source->device == nullptr) {
+                std::cout << "! Skipping " << selDrive.name << ", device could not be opened." << std::endl;
+                continue;
             }
         }
+        source->drive = std::move(selDrive);
+        sources.push_back(std::move(source));
+    }
+    if (sources.empty()) {
+        return 1;
+    }
+
+    std::string profileSel = userInput("Save as a profile for --daemon? (blank to skip, or a profile name):", true);
+    if (!profileSel.empty()) {
+        BackupProfile profile{profileSel, {}, out, filterSpec, adaptive ? 0 : numWorkers, packThreshold,
+                              dedupEnabled, compressEnabled, backendSel, checksums};
+        for (const std::unique_ptr<BackupSource> &source : sources) {
+            profile.match.push_back(source->drive.name);
+        }
+        if (saveProfile(profilesPath, profile)) {
+            std::cout << "Profile " << profileSel << " saved to " << profilesPath << std::endl;
+        } else {
+            std::cout << "! Failed to save profile: " << lastErrorMessage();
+        }
     }
 
-    double elapsedTime = ((uint64_t)getCurrentMsTime() - startTime) / 1000.0;
-    std::cout << bytesHumanReadable(copiedBytes)
-        << " copied in " << elapsedTime << " seconds ("
-        << bytesHumanReadable(copiedBytes / elapsedTime)
-        << "/s) with " << bytesHumanReadable(skippedBytes) << " skipped." << std::endl;
+    SessionOptions options{out, filter, numWorkers, adaptive, packThreshold, dedupEnabled, compressEnabled,
+                           !followed.empty(), locality, checksums};
+    runSession(options, backend.get(), &sources);
     return 0;
 }
-
@@ -0,0 +1,163 @@
+#include "manifest.h"
+
+// On-disk layout (little endian, no padding):
+//   header: char magic[4], uint32_t version, uint64_t count
+//   record: uint64_t sizeBytes, uint64_t mtime, uint64_t dateTaken, uint16_t relLen,
+//           uint16_t dstLen, char rel[relLen], char dst[dstLen]
+// Version 1 records have no dateTaken; they still load, with it set to 0.
+static const char MANIFEST_MAGIC[4] = {'B', 'B', 'M', 'F'};
+static const uint32_t MANIFEST_VERSION = 2;
+static const uint32_t MANIFEST_VERSION_NO_DATES = 1;
+static const size_t HEADER_SIZE = sizeof(MANIFEST_MAGIC) + sizeof(uint32_t) + sizeof(uint64_t);
+static const size_t RECORD_FIXED_SIZE = 3 * sizeof(uint64_t) + 2 * sizeof(uint16_t);
+
+template <typename T>
+static T readField(const char **cursor) {
+    T value;
+    memcpy(&value, *cursor, sizeof(T));
+    *cursor += sizeof(T);
+    return value;
+}
+
+template <typename T>
+static void appendField(std::string *out, T value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static void appendRecord(std::string *out, std::string_view relPath, const ManifestEntry &entry) {
+    appendField<uint64_t>(out, entry.sizeBytes);
+    appendField<uint64_t>(out, entry.mtime);
+    appendField<uint64_t>(out, entry.dateTaken);
+    appendField<uint16_t>(out, (uint16_t) relPath.size());
+    appendField<uint16_t>(out, (uint16_t) entry.dstPath.size());
+    out->append(relPath);
+    out->append(entry.dstPath);
+}
+
+bool BackupManifest::load() {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG) HEADER_SIZE
+            || fileSize.QuadPart > MAXDWORD) {
+        CloseHandle(file);
+        return false;
+    }
+
+    blob.resize((size_t) fileSize.QuadPart);
+    DWORD bytesRead = 0;
+    bool readOk = ReadFile(file, blob.data(), (DWORD) blob.size(), &bytesRead, nullptr)
+            && bytesRead == blob.size();
+    CloseHandle(file);
+    if (!readOk || memcmp(blob.data(), MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0) {
+        blob.clear();
+        return false;
+    }
+
+    const char *cursor = blob.data() + sizeof(MANIFEST_MAGIC);
+    const char *end = blob.data() + blob.size();
+    uint32_t version = readField<uint32_t>(&cursor);
+    if (version != MANIFEST_VERSION && version != MANIFEST_VERSION_NO_DATES) {
+        blob.clear();
+        return false;
+    }
+    bool hasDates = version != MANIFEST_VERSION_NO_DATES;
+    size_t recordFixedSize = hasDates ? RECORD_FIXED_SIZE : RECORD_FIXED_SIZE - sizeof(uint64_t);
+    uint64_t count = readField<uint64_t>(&cursor);
+    entries.reserve((size_t) count);
+
+    // Keys and destination paths point straight into the blob
+    for (uint64_t i = 0; i < count; i++) {
+        if ((size_t) (end - cursor) < recordFixedSize) {
+            break;
+        }
+        ManifestEntry entry;
+        entry.sizeBytes = readField<uint64_t>(&cursor);
+        entry.mtime = readField<uint64_t>(&cursor);
+        entry.dateTaken = hasDates ? readField<uint64_t>(&cursor) : 0;
+        uint16_t relLen = readField<uint16_t>(&cursor);
+        uint16_t dstLen = readField<uint16_t>(&cursor);
+        if ((size_t) (end - cursor) < (size_t) relLen + dstLen) {
+            break;
+        }
+        std::string_view relPath(cursor, relLen);
+        entry.dstPath = std::string_view(cursor + relLen, dstLen);
+        cursor += relLen + dstLen;
+        entries[relPath] = entry;
+    }
+    return true;
+}
+
+bool BackupManifest::save() {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    uint64_t count = updates.size();
+    for (const auto &kv : entries) {
+        if (updates.find(kv.first) == updates.end()) {
+            count++;
+        }
+    }
+
+    std::string out;
+    out.reserve(blob.size() + updates.size() * 128 + HEADER_SIZE);
+    out.append(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    appendField<uint32_t>(&out, MANIFEST_VERSION);
+    appendField<uint64_t>(&out, count);
+    for (const auto &kv : entries) {
+        if (updates.find(kv.first) == updates.end()) {
+            appendRecord(&out, kv.first, kv.second);
+        }
+    }
+    for (const auto &kv : updates) {
+        appendRecord(&out, kv.first, kv.second);
+    }
+
+    // Write beside the old manifest and swap, so an interrupted save never
+    // leaves a truncated manifest behind. Both the data and the rename
+    // reach the disk before returning, since the journal that could rebuild
+    // this is deleted next.
+    std::string tmpPath = path + ".tmp";
+    HANDLE file = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool writeOk = WriteFile(file, out.data(), (DWORD) out.size(), &bytesWritten, nullptr)
+            && bytesWritten == out.size() && FlushFileBuffers(file);
+    CloseHandle(file);
+    if (!writeOk) {
+        DeleteFileA(tmpPath.c_str());
+        return false;
+    }
+    return MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+ManifestStatus BackupManifest::classify(std::string_view relPath, uint64_t sizeBytes, uint64_t mtime) const {
+    auto it = entries.find(relPath);
+    if (it == entries.end()) {
+        return MANIFEST_NEW;
+    }
+    if (it->second.sizeBytes != sizeBytes || it->second.mtime != mtime) {
+        return MANIFEST_CHANGED;
+    }
+    return MANIFEST_UNCHANGED;
+}
+
+void BackupManifest::record(std::string_view relPath, uint64_t sizeBytes, uint64_t mtime, const std::string &dstPath,
+                            uint64_t dateTaken) {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    const std::string &ownedRel = ownedStrings.emplace_back(relPath);
+    const std::string &ownedDst = ownedStrings.emplace_back(dstPath);
+    updates[ownedRel] = ManifestEntry{sizeBytes, mtime, dateTaken, ownedDst};
+}
+
+uint64_t BackupManifest::dateTaken(std::string_view relPath, uint64_t sizeBytes, uint64_t mtime) const {
+    auto it = entries.find(relPath);
+    if (it == entries.end() || it->second.sizeBytes != sizeBytes || it->second.mtime != mtime) {
+        return 0;
+    }
+    return it->second.dateTaken;
+}
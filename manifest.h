@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+
+#define MANIFEST_FILE_NAME  "bulldozer.manifest"
+
+enum ManifestStatus {
+    MANIFEST_NEW,
+    MANIFEST_CHANGED,
+    MANIFEST_UNCHANGED
+};
+
+struct ManifestEntry {
+    uint64_t sizeBytes;
+    uint64_t mtime;
+    uint64_t dateTaken;     // from the file's header, FILETIME units; 0 if unknown
+    std::string_view dstPath;
+};
+
+// Record of every file previously backed up from one source drive, keyed by
+// its path relative to the drive root. Stored as a single flat binary file
+// that is read in one call and indexed in place, so a rerun can tell new,
+// changed and unchanged files apart from directory-entry metadata alone.
+class BackupManifest {
+public:
+    explicit BackupManifest(std::string manifestPath) : path(std::move(manifestPath)) {}
+
+    // Returns false if no usable manifest exists; the manifest then starts empty.
+    bool load();
+    // Writes all loaded and recorded entries to a temporary file and swaps it in.
+    bool save();
+
+    // Only consults entries from load(), so it is safe to call while
+    // workers are recording.
+    ManifestStatus classify(std::string_view relPath, uint64_t sizeBytes, uint64_t mtime) const;
+    void record(std::string_view relPath, uint64_t sizeBytes, uint64_t mtime, const std::string &dstPath,
+                uint64_t dateTaken);
+
+    // Header date an earlier run parsed for relPath, or 0 if there is none
+    // or the file's size or write time changed since, as its content may
+    // have too. Like classify(), only consults entries from load().
+    uint64_t dateTaken(std::string_view relPath, uint64_t sizeBytes, uint64_t mtime) const;
+
+    size_t size() const { return entries.size(); }
+
+private:
+    std::string path;
+    std::vector<char> blob;
+    std::unordered_map<std::string_view, ManifestEntry> entries;
+
+    // Backing storage for recorded paths; deque keeps views stable on growth
+    std::deque<std::string> ownedStrings;
+    std::unordered_map<std::string_view, ManifestEntry> updates;
+    std::mutex updateMutex;
+};
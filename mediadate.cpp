@@ -0,0 +1,429 @@
+#include "mediadate.h"
+
+// Seconds from 1601-01-01 (FILETIME) to 1904-01-01 (QuickTime epoch)
+static const uint64_t QUICKTIME_EPOCH_SECONDS = 9561628800ULL;
+static const uint64_t FILETIME_TICKS_PER_SECOND = 10000000ULL;
+// An MP4 or MOV usually has three or four top-level boxes; anything past
+// this is not worth probing
+static const int MAX_TOP_LEVEL_BOXES = 32;
+
+static const uint16_t TIFF_TAG_DATE_TIME = 0x0132;
+static const uint16_t TIFF_TAG_EXIF_IFD = 0x8769;
+static const uint16_t EXIF_TAG_DATE_TIME_ORIGINAL = 0x9003;
+static const uint16_t EXIF_TAG_DATE_TIME_DIGITIZED = 0x9004;
+
+static const char *MEDIA_EXTENSIONS[] = {
+        "jpg", "jpeg", "heic", "heif", "avif", "tif", "tiff", "dng", "cr2", "nef", "arw", "orf", "rw2",
+        "mp4", "mov", "m4v", "3gp"
+};
+
+static const char *HEIF_BRANDS[] = {"heic", "heix", "heim", "heis", "hevc", "hevx", "mif1", "msf1", "avif"};
+
+bool hasMediaExtension(std::string_view name) {
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string_view::npos) {
+        return false;
+    }
+    std::string_view ext = name.substr(dot + 1);
+    for (const char *candidate : MEDIA_EXTENSIONS) {
+        if (ext.size() == strlen(candidate)
+                && std::equal(ext.begin(), ext.end(), candidate,
+                              [](char a, char b) { return tolower((unsigned char) a) == b; })) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Big-endian reader over a header window for JPEG, HEIF and QuickTime
+// structures. Reading past the end clears ok and yields zeros, so parsers
+// check once per structure instead of before every field. A cursor that
+// starts past its end, as one skipping a truncated box's header can, is
+// failed from the start.
+struct ByteCursor {
+    const BYTE *data;
+    size_t pos;
+    size_t end;
+    bool ok;
+
+    ByteCursor(const BYTE *data, size_t pos, size_t end) : data(data), pos(pos), end(end), ok(pos <= end) {}
+
+    uint64_t read(size_t bytes) {
+        if (!ok || end - pos < bytes) {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; i++) {
+            value = (value << 8) | data[pos++];
+        }
+        return value;
+    }
+    void skip(size_t bytes) {
+        if (!ok || end - pos < bytes) {
+            ok = false;
+            return;
+        }
+        pos += bytes;
+    }
+    bool matches(size_t offset, const char *tag) const {
+        return ok && end - pos >= offset + 4 && memcmp(data + pos + offset, tag, 4) == 0;
+    }
+};
+
+// One ISO BMFF box within a window. end is clamped to the window, so a box
+// that continues past it is walked as far as it was read.
+struct Box {
+    char type[4];
+    size_t body;
+    size_t end;
+};
+
+static bool nextBox(ByteCursor *cursor, Box *box) {
+    size_t start = cursor->pos;
+    uint64_t size = cursor->read(4);
+    if (!cursor->ok || cursor->end - cursor->pos < 4) {
+        return false;
+    }
+    memcpy(box->type, cursor->data + cursor->pos, 4);
+    cursor->skip(4);
+    if (size == 1) {
+        size = cursor->read(8);
+    } else if (size == 0) {
+        size = cursor->end - start;
+    }
+    if (!cursor->ok || size < cursor->pos - start) {
+        return false;
+    }
+    box->body = cursor->pos;
+    box->end = (size_t) (std::min)((uint64_t) cursor->end, start + size);
+    cursor->pos = box->end;
+    return true;
+}
+
+static bool boxIs(const Box &box, const char *type) {
+    return memcmp(box.type, type, 4) == 0;
+}
+
+// "YYYY:MM:DD HH:MM:SS", as EXIF stores it
+static uint64_t parseExifDateTime(const BYTE *text, size_t len) {
+    static const char PATTERN[] = "dddd:dd:dd dd:dd:dd";
+    if (len < sizeof(PATTERN) - 1) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(PATTERN) - 1; i++) {
+        if (PATTERN[i] == 'd' ? !isdigit(text[i]) : text[i] != PATTERN[i]) {
+            return 0;
+        }
+    }
+    auto number = [text](size_t offset, size_t digits) {
+        WORD value = 0;
+        for (size_t i = 0; i < digits; i++) {
+            value = (WORD) (value * 10 + (text[offset + i] - '0'));
+        }
+        return value;
+    };
+    SYSTEMTIME time{};
+    time.wYear = number(0, 4);
+    time.wMonth = number(5, 2);
+    time.wDay = number(8, 2);
+    time.wHour = number(11, 2);
+    time.wMinute = number(14, 2);
+    time.wSecond = number(17, 2);
+    // Cameras with an unset clock write all zeros
+    FILETIME fileTime;
+    if (time.wYear < 1900 || !SystemTimeToFileTime(&time, &fileTime)) {
+        return 0;
+    }
+    return ((uint64_t) fileTime.dwHighDateTime << 32) | fileTime.dwLowDateTime;
+}
+
+// TIFF structure as found in EXIF segments and TIFF-based raw files, with
+// offsets relative to the byte-order mark.
+struct TiffView {
+    const BYTE *data;
+    size_t len;
+    bool little;
+
+    uint16_t u16(size_t offset) const {
+        return little ? (uint16_t) (data[offset] | data[offset + 1] << 8)
+                      : (uint16_t) (data[offset] << 8 | data[offset + 1]);
+    }
+    uint32_t u32(size_t offset) const {
+        return little ? (uint32_t) u16(offset) | (uint32_t) u16(offset + 2) << 16
+                      : (uint32_t) u16(offset) << 16 | (uint32_t) u16(offset + 2);
+    }
+
+    // Returns the offset of the tag's 12-byte IFD entry, or 0
+    size_t findTag(uint32_t ifd, uint16_t tag) const {
+        if (ifd == 0 || ifd > len - 2) {
+            return 0;
+        }
+        uint16_t numEntries = u16(ifd);
+        for (uint16_t i = 0; i < numEntries; i++) {
+            size_t entry = ifd + 2 + (size_t) i * 12;
+            if (entry + 12 > len) {
+                return 0;
+            }
+            if (u16(entry) == tag) {
+                return entry;
+            }
+        }
+        return 0;
+    }
+
+    uint64_t dateTag(uint32_t ifd, uint16_t tag) const {
+        size_t entry = findTag(ifd, tag);
+        if (entry == 0) {
+            return 0;
+        }
+        uint32_t count = u32(entry + 4);
+        size_t offset = count <= 4 ? entry + 8 : u32(entry + 8);
+        if (offset >= len || count > len - offset) {
+            return 0;
+        }
+        return parseExifDateTime(data + offset, count);
+    }
+};
+
+static uint64_t tiffDate(const BYTE *data, size_t len) {
+    if (len < 8) {
+        return 0;
+    }
+    TiffView tiff{data, len, data[0] == 'I'};
+    if (!((data[0] == 'I' && data[1] == 'I') || (data[0] == 'M' && data[1] == 'M')) || tiff.u16(2) != 42) {
+        return 0;
+    }
+    uint32_t ifd0 = tiff.u32(4);
+    size_t exifEntry = tiff.findTag(ifd0, TIFF_TAG_EXIF_IFD);
+    if (exifEntry != 0) {
+        uint32_t exifIfd = tiff.u32(exifEntry + 8);
+        uint64_t date = tiff.dateTag(exifIfd, EXIF_TAG_DATE_TIME_ORIGINAL);
+        if (date == 0) {
+            date = tiff.dateTag(exifIfd, EXIF_TAG_DATE_TIME_DIGITIZED);
+        }
+        if (date != 0) {
+            return date;
+        }
+    }
+    return tiff.dateTag(ifd0, TIFF_TAG_DATE_TIME);
+}
+
+// Walks the marker segments after SOI up to the first APP1 holding EXIF
+static uint64_t jpegDate(const BYTE *data, size_t len) {
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        if (data[pos] != 0xFF) {
+            return 0;
+        }
+        BYTE marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        // Start of scan: image data follows, no more metadata
+        if (marker == 0xDA || marker == 0xD9) {
+            return 0;
+        }
+        size_t segmentLen = (size_t) data[pos + 2] << 8 | data[pos + 3];
+        if (marker == 0xE1 && segmentLen >= 8 && pos + 10 <= len && memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+            size_t tiffStart = pos + 10;
+            size_t segmentEnd = (std::min)(len, pos + 2 + segmentLen);
+            return tiffDate(data + tiffStart, segmentEnd - tiffStart);
+        }
+        pos += 2 + segmentLen;
+    }
+    return 0;
+}
+
+uint64_t MediaDateReader::fromFile(HANDLE file, uint64_t fileSize) {
+    return resolve(Source{file, nullptr, fileSize});
+}
+
+uint64_t MediaDateReader::fromBuffer(const BYTE *data, size_t len) {
+    return resolve(Source{INVALID_HANDLE_VALUE, data, len});
+}
+
+// Reads into the start of the window; returns how many bytes arrived
+size_t MediaDateReader::readAt(const Source &src, uint64_t offset, size_t len) {
+    window.resize(MEDIA_DATE_WINDOW);
+    if (offset >= src.size) {
+        return 0;
+    }
+    len = (size_t) (std::min)((uint64_t) (std::min)(len, window.size()), src.size - offset);
+    if (src.data != nullptr) {
+        memcpy(window.data(), src.data + offset, len);
+        return len;
+    }
+    OVERLAPPED overlapped{};
+    overlapped.Offset = (DWORD) offset;
+    overlapped.OffsetHigh = (DWORD) (offset >> 32);
+    DWORD bytesRead = 0;
+    if (!ReadFile(src.file, window.data(), (DWORD) len, &bytesRead, &overlapped)) {
+        return 0;
+    }
+    return bytesRead;
+}
+
+uint64_t MediaDateReader::resolve(const Source &src) {
+    size_t headLen = readAt(src, 0, MEDIA_DATE_WINDOW);
+    const BYTE *head = window.data();
+    if (headLen >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF) {
+        return jpegDate(head, headLen);
+    }
+    if (headLen >= 8 && (memcmp(head, "II*\0", 4) == 0 || memcmp(head, "MM\0*", 4) == 0)) {
+        return tiffDate(head, headLen);
+    }
+    if (headLen >= 12 && memcmp(head + 4, "ftyp", 4) == 0) {
+        for (const char *brand : HEIF_BRANDS) {
+            if (memcmp(head + 8, brand, 4) == 0) {
+                return heifDate(src, headLen);
+            }
+        }
+        return quickTimeDate(src);
+    }
+    // QuickTime files from older cameras start without ftyp
+    if (headLen >= 8 && (memcmp(head + 4, "moov", 4) == 0 || memcmp(head + 4, "mdat", 4) == 0
+            || memcmp(head + 4, "wide", 4) == 0 || memcmp(head + 4, "free", 4) == 0)) {
+        return quickTimeDate(src);
+    }
+    return 0;
+}
+
+// HEIF keeps EXIF as an item: iinf names the item of type "Exif" and iloc
+// says where its bytes are. The meta box is near the start of the file, the
+// item itself takes a second bounded read.
+uint64_t MediaDateReader::heifDate(const Source &src, size_t headLen) {
+    ByteCursor top{window.data(), 0, headLen};
+    Box meta;
+    bool found = false;
+    while (!found && nextBox(&top, &meta)) {
+        found = boxIs(meta, "meta");
+    }
+    if (!found) {
+        return 0;
+    }
+
+    uint32_t exifItem = 0;
+    bool hasExifItem = false;
+    Box iloc{};
+    ByteCursor children{window.data(), meta.body + 4, meta.end};
+    Box child;
+    while (nextBox(&children, &child)) {
+        if (boxIs(child, "iloc")) {
+            iloc = child;
+        } else if (boxIs(child, "iinf")) {
+            ByteCursor infos{window.data(), child.body, child.end};
+            uint64_t version = infos.read(1);
+            infos.skip(3);
+            infos.skip(version == 0 ? 2 : 4);
+            Box infe;
+            while (!hasExifItem && nextBox(&infos, &infe)) {
+                ByteCursor entry{window.data(), infe.body, infe.end};
+                uint64_t entryVersion = entry.read(1);
+                entry.skip(3);
+                if (entryVersion < 2) {
+                    continue;
+                }
+                uint32_t itemId = (uint32_t) entry.read(entryVersion == 2 ? 2 : 4);
+                entry.skip(2);
+                if (entry.matches(0, "Exif")) {
+                    exifItem = itemId;
+                    hasExifItem = true;
+                }
+            }
+        }
+    }
+    if (!hasExifItem || iloc.end == 0) {
+        return 0;
+    }
+
+    ByteCursor loc{window.data(), iloc.body, iloc.end};
+    uint64_t version = loc.read(1);
+    loc.skip(3);
+    uint64_t sizes = loc.read(2);
+    size_t offsetSize = (size_t) (sizes >> 12) & 0xF;
+    size_t lengthSize = (size_t) (sizes >> 8) & 0xF;
+    size_t baseOffsetSize = (size_t) (sizes >> 4) & 0xF;
+    size_t indexSize = version == 1 || version == 2 ? (size_t) sizes & 0xF : 0;
+    uint64_t itemCount = loc.read(version < 2 ? 2 : 4);
+    for (uint64_t i = 0; i < itemCount && loc.ok; i++) {
+        uint32_t itemId = (uint32_t) loc.read(version < 2 ? 2 : 4);
+        uint64_t constructionMethod = version == 1 || version == 2 ? loc.read(2) & 0xF : 0;
+        loc.skip(2);
+        uint64_t baseOffset = loc.read(baseOffsetSize);
+        uint64_t extentCount = loc.read(2);
+        for (uint64_t e = 0; e < extentCount && loc.ok; e++) {
+            loc.skip(indexSize);
+            uint64_t extentOffset = loc.read(offsetSize);
+            uint64_t extentLength = loc.read(lengthSize);
+            // Only the first extent of an item stored in the file itself
+            if (itemId != exifItem || e > 0 || constructionMethod != 0 || !loc.ok) {
+                continue;
+            }
+            size_t itemLen = readAt(src, baseOffset + extentOffset,
+                                    (size_t) (std::min)(extentLength, (uint64_t) MEDIA_DATE_WINDOW));
+            // The item starts with the offset of the TIFF header after it
+            ByteCursor item{window.data(), 0, itemLen};
+            uint64_t tiffOffset = item.read(4);
+            if (!item.ok || tiffOffset > itemLen - 4) {
+                return 0;
+            }
+            return tiffDate(window.data() + 4 + tiffOffset, itemLen - 4 - (size_t) tiffOffset);
+        }
+    }
+    return 0;
+}
+
+// Skips from one top-level box header to the next, so a moov box after a
+// multi-gigabyte mdat costs a handful of small reads. mvhd is normally
+// moov's first child.
+uint64_t MediaDateReader::quickTimeDate(const Source &src) {
+    uint64_t offset = 0;
+    for (int i = 0; i < MAX_TOP_LEVEL_BOXES && offset + 8 <= src.size; i++) {
+        size_t headerLen = readAt(src, offset, 16);
+        ByteCursor header{window.data(), 0, headerLen};
+        uint64_t size = header.read(4);
+        bool isMoov = header.matches(0, "moov");
+        header.skip(4);
+        if (size == 1) {
+            size = header.read(8);
+        } else if (size == 0) {
+            size = src.size - offset;
+        }
+        if (!header.ok || size < header.pos) {
+            return 0;
+        }
+        if (!isMoov) {
+            offset += size;
+            continue;
+        }
+
+        size_t moovLen = readAt(src, offset + header.pos,
+                                (size_t) (std::min)(size - header.pos, (uint64_t) MEDIA_DATE_WINDOW));
+        ByteCursor children{window.data(), 0, moovLen};
+        Box child;
+        while (nextBox(&children, &child)) {
+            if (!boxIs(child, "mvhd")) {
+                continue;
+            }
+            ByteCursor mvhd{window.data(), child.body, child.end};
+            uint64_t version = mvhd.read(1);
+            mvhd.skip(3);
+            uint64_t created = mvhd.read(version == 1 ? 8 : 4);
+            if (!mvhd.ok || created == 0) {
+                return 0;
+            }
+            // QuickTime times are UTC; file under local time like EXIF
+            uint64_t utc = (created + QUICKTIME_EPOCH_SECONDS) * FILETIME_TICKS_PER_SECOND;
+            FILETIME utcTime{(DWORD) utc, (DWORD) (utc >> 32)};
+            FILETIME localTime;
+            if (!FileTimeToLocalFileTime(&utcTime, &localTime)) {
+                return utc;
+            }
+            return ((uint64_t) localTime.dwHighDateTime << 32) | localTime.dwLowDateTime;
+        }
+        return 0;
+    }
+    return 0;
+}
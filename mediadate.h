@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+
+// Most header reads stop here: a JPEG's EXIF segment is at most 64 KB and
+// sits right after SOI, and HEIF/MP4 box headers are only a few bytes each.
+#define MEDIA_DATE_WINDOW   (64 * 1024)
+
+// True for extensions whose headers parseMediaDate() understands, so other
+// files are never opened for a header read.
+bool hasMediaExtension(std::string_view name);
+
+// Reads the date a photo or video was taken from its header: EXIF
+// DateTimeOriginal for JPEG, HEIC/HEIF and TIFF-based raw files, and the
+// mvhd creation time for MP4/MOV. Only a few bounded reads of at most
+// MEDIA_DATE_WINDOW bytes are made, into a buffer reused across files, so
+// one reader per worker never allocates in steady state.
+//
+// Dates are in FILETIME units, 0 if the header has none. EXIF times are
+// the camera's local time, which is what photos should be filed under.
+class MediaDateReader {
+public:
+    // Reads at explicit offsets, so callers need not rewind the handle
+    uint64_t fromFile(HANDLE file, uint64_t fileSize);
+    // For headers already in memory, e.g. the start of a device object.
+    // data must not point into this reader.
+    uint64_t fromBuffer(const BYTE *data, size_t len);
+
+private:
+    struct Source {
+        HANDLE file;
+        const BYTE *data;
+        uint64_t size;
+    };
+
+    uint64_t resolve(const Source &src);
+    size_t readAt(const Source &src, uint64_t offset, size_t len);
+    uint64_t heifDate(const Source &src, size_t headLen);
+    uint64_t quickTimeDate(const Source &src);
+
+    std::vector<BYTE> window;
+};
@@ -0,0 +1,185 @@
+#include "pack.h"
+
+// Index layout (little endian, no padding):
+//   header: char magic[4], uint32_t version
+//   record: uint32_t segment, uint64_t offset, uint64_t length, uint64_t mtime,
+//           uint16_t nameLen, char name[nameLen]
+// Segments are the packed files' bytes back to back, with no framing.
+static const char PACK_INDEX_MAGIC[4] = {'B', 'B', 'P', 'I'};
+static const uint32_t PACK_INDEX_VERSION = 1;
+static const size_t HEADER_SIZE = sizeof(PACK_INDEX_MAGIC) + sizeof(uint32_t);
+static const size_t RECORD_FIXED_SIZE = sizeof(uint32_t) + 3 * sizeof(uint64_t) + sizeof(uint16_t);
+
+template <typename T>
+static T readField(const char **cursor) {
+    T value;
+    memcpy(&value, *cursor, sizeof(T));
+    *cursor += sizeof(T);
+    return value;
+}
+
+template <typename T>
+static void appendField(std::string *out, T value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static bool writeAll(HANDLE file, const void *data, size_t len) {
+    DWORD bytesWritten = 0;
+    return WriteFile(file, data, (DWORD) len, &bytesWritten, nullptr) && bytesWritten == len;
+}
+
+PackWriter::~PackWriter() {
+    for (auto &kv : months) {
+        MonthPack *month = kv.second.get();
+        if (month->segment != INVALID_HANDLE_VALUE) {
+            CloseHandle(month->segment);
+        }
+        if (month->index != INVALID_HANDLE_VALUE) {
+            CloseHandle(month->index);
+        }
+    }
+}
+
+PackWriter::MonthPack *PackWriter::monthFor(const std::string &dir) {
+    std::lock_guard<std::mutex> lock(monthsMutex);
+    std::unique_ptr<MonthPack> &month = months[dir];
+    if (month == nullptr) {
+        month = std::make_unique<MonthPack>();
+        month->dir = dir;
+    }
+    return month.get();
+}
+
+std::string PackWriter::segmentPath(const MonthPack *month, uint32_t segment) const {
+    char name[32];
+    snprintf(name, sizeof(name), PACK_SEGMENT_PREFIX "%04u" PACK_SEGMENT_EXTENSION, segment);
+    return month->dir + name;
+}
+
+// Reads the month's existing index so names packed by earlier runs are
+// known, cutting off a torn last record, and leaves it open for appending.
+bool PackWriter::openMonth(MonthPack *month) {
+    month->opened = true;
+    std::string indexPath = month->dir + PACK_INDEX_FILE_NAME;
+    month->index = CreateFileA(indexPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                               OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (month->index == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(month->index, &fileSize) || fileSize.QuadPart > MAXDWORD) {
+        return false;
+    }
+
+    std::vector<char> blob((size_t) fileSize.QuadPart);
+    DWORD bytesRead = 0;
+    size_t validBytes = 0;
+    if (!blob.empty() && ReadFile(month->index, blob.data(), (DWORD) blob.size(), &bytesRead, nullptr)
+            && bytesRead == blob.size() && blob.size() >= HEADER_SIZE
+            && memcmp(blob.data(), PACK_INDEX_MAGIC, sizeof(PACK_INDEX_MAGIC)) == 0) {
+        const char *cursor = blob.data() + sizeof(PACK_INDEX_MAGIC);
+        const char *end = blob.data() + blob.size();
+        if (readField<uint32_t>(&cursor) == PACK_INDEX_VERSION) {
+            validBytes = HEADER_SIZE;
+            while ((size_t) (end - cursor) >= RECORD_FIXED_SIZE) {
+                PackedFile file;
+                file.segment = readField<uint32_t>(&cursor);
+                file.offset = readField<uint64_t>(&cursor);
+                file.length = readField<uint64_t>(&cursor);
+                readField<uint64_t>(&cursor);
+                uint16_t nameLen = readField<uint16_t>(&cursor);
+                if ((size_t) (end - cursor) < nameLen) {
+                    break;
+                }
+                month->files[std::string(cursor, nameLen)] = file;
+                cursor += nameLen;
+                month->segmentNumber = (std::max)(month->segmentNumber, file.segment);
+                validBytes = cursor - blob.data();
+            }
+        }
+    }
+
+    LARGE_INTEGER offset;
+    offset.QuadPart = (LONGLONG) validBytes;
+    if (!SetFilePointerEx(month->index, offset, nullptr, FILE_BEGIN) || !SetEndOfFile(month->index)) {
+        return false;
+    }
+    if (validBytes == 0) {
+        std::string header;
+        header.append(PACK_INDEX_MAGIC, sizeof(PACK_INDEX_MAGIC));
+        appendField<uint32_t>(&header, PACK_INDEX_VERSION);
+        if (!writeAll(month->index, header.data(), header.size())) {
+            return false;
+        }
+    }
+    return nextSegment(month);
+}
+
+bool PackWriter::nextSegment(MonthPack *month) {
+    if (month->segment != INVALID_HANDLE_VALUE) {
+        CloseHandle(month->segment);
+    }
+    // Skip segments left by a run whose index records never made it out
+    do {
+        month->segmentNumber++;
+    } while (GetFileAttributesA(segmentPath(month, month->segmentNumber).c_str()) != INVALID_FILE_ATTRIBUTES);
+    month->segment = CreateFileA(segmentPath(month, month->segmentNumber).c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+                                 nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+    month->segmentSize = 0;
+    if (month->segment == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    segmentCount++;
+    return true;
+}
+
+PackStatus PackWriter::add(const std::string &dstPath, const void *data, size_t len, uint64_t mtime,
+                           bool overwrite, bool resumed, std::string *location) {
+    size_t sep = dstPath.find_last_of('\\') + 1;
+    MonthPack *month = monthFor(dstPath.substr(0, sep));
+    std::string name = dstPath.substr(sep);
+
+    std::lock_guard<std::mutex> lock(month->mutex);
+    if (!month->opened && !openMonth(month)) {
+        return PACK_FAILED;
+    }
+    if (month->index == INVALID_HANDLE_VALUE || month->segment == INVALID_HANDLE_VALUE) {
+        return PACK_FAILED;
+    }
+
+    auto existing = month->files.find(name);
+    if (existing != month->files.end() && !overwrite) {
+        if (!resumed || existing->second.length != len) {
+            return PACK_EXISTS;
+        }
+        *location = segmentPath(month, existing->second.segment) + '@' + std::to_string(existing->second.offset);
+        return PACK_ADDED;
+    }
+
+    if (month->segmentSize > 0 && month->segmentSize + len > PACK_SEGMENT_SIZE && !nextSegment(month)) {
+        return PACK_FAILED;
+    }
+    PackedFile file{month->segmentNumber, month->segmentSize, len};
+    if (!writeAll(month->segment, data, len)) {
+        // Later files must not land at offsets the index does not expect
+        nextSegment(month);
+        return PACK_FAILED;
+    }
+    month->segmentSize += len;
+
+    // Written straight after the data, so a record never points at bytes
+    // that were not handed to the OS first
+    std::string record;
+    appendField<uint32_t>(&record, file.segment);
+    appendField<uint64_t>(&record, file.offset);
+    appendField<uint64_t>(&record, file.length);
+    appendField<uint64_t>(&record, mtime);
+    appendField<uint16_t>(&record, (uint16_t) name.size());
+    record.append(name);
+    if (!writeAll(month->index, record.data(), record.size())) {
+        return PACK_FAILED;
+    }
+    month->files[name] = file;
+    *location = segmentPath(month, file.segment) + '@' + std::to_string(file.offset);
+    return PACK_ADDED;
+}
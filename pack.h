@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+
+// Packed files go into numbered segments in their month folder, each
+// closed once it reaches PACK_SEGMENT_SIZE, and are listed in one index per
+// month folder.
+#define PACK_SEGMENT_SIZE       (1024ULL * 1024 * 1024)
+#define PACK_SEGMENT_PREFIX     "pack-"
+#define PACK_SEGMENT_EXTENSION  ".bdpack"
+#define PACK_INDEX_FILE_NAME    "pack.bdidx"
+
+enum PackStatus {
+    PACK_ADDED,
+    PACK_EXISTS,
+    PACK_FAILED
+};
+
+// Appends files below a size threshold to large per-month segment files
+// instead of creating one destination file each, so destinations that pay
+// heavily per file (NAS shares) see a handful of big sequential writes.
+//
+// Each month folder's index is an append-only list of
+// (segment, offset, length, mtime, name) records, so any packed file can
+// be restored with one seek into its segment. Names are the file names the
+// unpacked layout would have used, and follow the same rules: an existing
+// name is only replaced when overwrite is set, and the newest record for a
+// name wins. Every run starts a new segment, so a torn segment tail from an
+// interrupted run is never appended to.
+class PackWriter {
+public:
+    explicit PackWriter(uint64_t threshold) : threshold(threshold) {}
+    ~PackWriter();
+
+    PackWriter(const PackWriter &) = delete;
+    PackWriter &operator=(const PackWriter &) = delete;
+
+    bool accepts(uint64_t sizeBytes) const { return sizeBytes < threshold; }
+
+    // Packs data under dstPath, a full unpacked destination path whose
+    // folder selects the month. *location is set to "<segment>@<offset>".
+    // A resumed file already packed at the same length counts as added.
+    PackStatus add(const std::string &dstPath, const void *data, size_t len, uint64_t mtime, bool overwrite,
+                   bool resumed, std::string *location);
+
+    uint64_t segmentsCreated() const { return segmentCount.load(); }
+
+private:
+    struct PackedFile {
+        uint32_t segment;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    // One month folder's open segment and index. Appends to a month are
+    // serialized; different months pack in parallel.
+    struct MonthPack {
+        std::mutex mutex;
+        std::string dir;
+        bool opened = false;
+        HANDLE index = INVALID_HANDLE_VALUE;
+        HANDLE segment = INVALID_HANDLE_VALUE;
+        uint32_t segmentNumber = 0;
+        uint64_t segmentSize = 0;
+        std::unordered_map<std::string, PackedFile> files;
+    };
+
+    MonthPack *monthFor(const std::string &dir);
+    bool openMonth(MonthPack *month);
+    bool nextSegment(MonthPack *month);
+    std::string segmentPath(const MonthPack *month, uint32_t segment) const;
+
+    uint64_t threshold;
+    std::unordered_map<std::string, std::unique_ptr<MonthPack>> months;
+    std::mutex monthsMutex;
+    std::atomic<uint64_t> segmentCount{0};
+};
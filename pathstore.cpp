@@ -0,0 +1,142 @@
+#include "pathstore.h"
+
+PathStore::PathStore(const std::string &rootPath) {
+    rootDir = newDir(nullptr, rootPath, false);
+}
+
+char *PathStore::allocate(size_t size, size_t align) {
+    size_t padding = (align - (uintptr_t) cursor % align) % align;
+    if (padding + size > remaining) {
+        size_t blockSize = (std::max)(size, (size_t) PATH_STORE_BLOCK_SIZE);
+        blocks.push_back(std::make_unique<char[]>(blockSize));
+        cursor = blocks.back().get();
+        remaining = blockSize;
+        padding = 0;
+    }
+    char *out = cursor + padding;
+    cursor += padding + size;
+    remaining -= padding + size;
+    usedBytes += padding + size;
+    return out;
+}
+
+const PathDir *PathStore::newDir(const PathDir *parent, std::string_view segment, bool addSeparator) {
+    size_t segmentLen = segment.size() + (addSeparator ? 1 : 0);
+    char *text = allocate(segmentLen, 1);
+    memcpy(text, segment.data(), segment.size());
+    if (addSeparator) {
+        text[segment.size()] = '\\';
+    }
+    PathDir *dir = reinterpret_cast<PathDir *>(allocate(sizeof(PathDir), alignof(PathDir)));
+    dir->parent = parent;
+    dir->segment = text;
+    dir->segmentLen = (uint32_t) segmentLen;
+    dir->pathLen = (uint32_t) ((parent != nullptr ? parent->pathLen : 0) + segmentLen);
+    numDirs++;
+    return dir;
+}
+
+const PathDir *PathStore::addDir(const PathDir *parent, std::string_view name) {
+    return newDir(parent, name, true);
+}
+
+PathHandle PathStore::addFile(const PathDir *dir, std::string_view name) {
+    char *text = allocate(name.size() + 1, 1);
+    memcpy(text, name.data(), name.size());
+    text[name.size()] = '\0';
+    numFiles++;
+    return PathHandle{dir, text, (uint32_t) name.size()};
+}
+
+const PathDir *PathStore::internDir(std::string_view relDirPath) {
+    // Each prefix is looked up in turn, so siblings share their parents
+    const PathDir *dir = rootDir;
+    size_t start = 0;
+    while (start < relDirPath.size()) {
+        size_t end = relDirPath.find('\\', start);
+        if (end == std::string_view::npos) {
+            end = relDirPath.size();
+        }
+        if (end > start) {
+            auto [it, inserted] = dirsByPath.try_emplace(std::string(relDirPath.substr(0, end)), nullptr);
+            if (inserted) {
+                it->second = addDir(dir, relDirPath.substr(start, end - start));
+            }
+            dir = it->second;
+        }
+        start = end + 1;
+    }
+    return dir;
+}
+
+PathHandle PathStore::intern(std::string_view relPath) {
+    size_t split = relPath.find_last_of('\\');
+    if (split == std::string_view::npos) {
+        return addFile(rootDir, relPath);
+    }
+    return addFile(internDir(relPath.substr(0, split)), relPath.substr(split + 1));
+}
+
+void PathStore::fullPath(const PathHandle &file, std::string *out) {
+    out->resize(file.pathLen());
+    char *text = out->data();
+    memcpy(text + file.dir->pathLen, file.name, file.nameLen);
+    for (const PathDir *dir = file.dir; dir != nullptr; dir = dir->parent) {
+        memcpy(text + dir->pathLen - dir->segmentLen, dir->segment, dir->segmentLen);
+    }
+}
+
+TreeWalker::TreeWalker(const std::string &rootPath, PathStore *store, const PathDir *rootDir) : store(store) {
+    currentPath = rootPath;
+    enter(rootDir);
+}
+
+TreeWalker::~TreeWalker() {
+    for (const Frame &frame : frames) {
+        FindClose(frame.find);
+    }
+}
+
+// Starts listing the folder currentPath names, if it can be listed
+void TreeWalker::enter(const PathDir *dir) {
+    size_t pathLen = currentPath.size();
+    currentPath.push_back('*');
+    HANDLE find = FindFirstFileExA(currentPath.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+    currentPath.resize(pathLen);
+    if (find != INVALID_HANDLE_VALUE) {
+        frames.push_back(Frame{find, pathLen, dir});
+        haveData = true;
+    }
+}
+
+bool TreeWalker::next() {
+    while (!frames.empty()) {
+        if (!haveData && !FindNextFileA(frames.back().find, &data)) {
+            FindClose(frames.back().find);
+            frames.pop_back();
+            continue;
+        }
+        haveData = false;
+        const char *name = data.cFileName;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        numEntries++;
+        const Frame &frame = frames.back();
+        currentPath.resize(frame.pathLen);
+        currentPath.append(name);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            const PathDir *dir = store != nullptr ? store->addDir(frame.dir, name) : nullptr;
+            currentPath.push_back('\\');
+            enter(dir);
+            continue;
+        }
+        nameOffset = frame.pathLen;
+        currentDir = frame.dir;
+        size = ((uint64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        writeTime = ((uint64_t) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+        return true;
+    }
+    return false;
+}
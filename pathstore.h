@@ -0,0 +1,116 @@
+#pragma once
+
+#include "common.h"
+
+// Arena blocks; longer names get a block of their own
+#define PATH_STORE_BLOCK_SIZE   (1024 * 1024)
+
+// One folder under a source root, stored once however many files it holds.
+// segment is what it adds to its parent's path: its name and a trailing
+// separator, or the whole root path for the root.
+struct PathDir {
+    const PathDir *parent;  // nullptr for the root
+    const char *segment;
+    uint32_t segmentLen;
+    uint32_t pathLen;       // full path length, trailing separator included
+};
+
+// A file as a folder and a NUL-terminated name, both owned by a PathStore
+struct PathHandle {
+    const PathDir *dir;
+    const char *name;
+    uint32_t nameLen;
+
+    size_t pathLen() const { return dir->pathLen + nameLen; }
+};
+
+// Interns the folders and file names of one source so that queued files
+// cost a handle instead of a full path string each. Only the walking
+// thread adds to it; nodes never move or change once added, so copy
+// workers may read the handles they are given while the walk goes on.
+class PathStore {
+public:
+    // rootPath ends with a separator
+    explicit PathStore(const std::string &rootPath);
+
+    PathStore(const PathStore &) = delete;
+    PathStore &operator=(const PathStore &) = delete;
+
+    const PathDir *root() const { return rootDir; }
+    const PathDir *addDir(const PathDir *parent, std::string_view name);
+    PathHandle addFile(const PathDir *dir, std::string_view name);
+
+    // Looks up a folder or file by its path relative to the root, adding
+    // whatever is missing. Folders found this way are reused on later
+    // lookups; ones added by addDir() are not indexed.
+    const PathDir *internDir(std::string_view relDirPath);
+    PathHandle intern(std::string_view relPath);
+
+    // Writes the file's full path into *out, reusing its capacity
+    static void fullPath(const PathHandle &file, std::string *out);
+
+    size_t dirCount() const { return numDirs; }
+    size_t fileCount() const { return numFiles; }
+    size_t bytesUsed() const { return usedBytes; }
+
+private:
+    char *allocate(size_t size, size_t align);
+    const PathDir *newDir(const PathDir *parent, std::string_view segment, bool addSeparator);
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *cursor = nullptr;
+    size_t remaining = 0;
+    size_t usedBytes = 0;
+    size_t numDirs = 0;
+    size_t numFiles = 0;
+    const PathDir *rootDir;
+    std::unordered_map<std::string, const PathDir *> dirsByPath;
+};
+
+// Depth-first walk of every file under a folder with FindFirstFileEx, which
+// hands back size and write time with each name. The full path is built in
+// one reused buffer, so a file that is filtered out or unchanged costs no
+// allocation at all. Folders are added to store as they are entered unless
+// it is nullptr, and like the iterator it replaces, links to folders are
+// followed and folders that cannot be listed are skipped.
+class TreeWalker {
+public:
+    // rootPath ends with a separator; rootDir is its node in store
+    TreeWalker(const std::string &rootPath, PathStore *store, const PathDir *rootDir);
+    ~TreeWalker();
+
+    TreeWalker(const TreeWalker &) = delete;
+    TreeWalker &operator=(const TreeWalker &) = delete;
+
+    // Moves to the next file; returns false once the walk is over
+    bool next();
+
+    // Valid until the next call to next()
+    std::string_view path() const { return currentPath; }
+    std::string_view name() const { return std::string_view(currentPath).substr(nameOffset); }
+    const PathDir *dir() const { return currentDir; }
+    uint64_t sizeBytes() const { return size; }
+    uint64_t mtime() const { return writeTime; }
+    // Files and folders seen so far
+    int64_t entries() const { return numEntries; }
+
+private:
+    struct Frame {
+        HANDLE find;
+        size_t pathLen;
+        const PathDir *dir;
+    };
+
+    void enter(const PathDir *dir);
+
+    PathStore *store;
+    std::vector<Frame> frames;
+    std::string currentPath;
+    WIN32_FIND_DATAA data;
+    bool haveData = false;  // data holds the first entry of the newest frame
+    size_t nameOffset = 0;
+    const PathDir *currentDir = nullptr;
+    uint64_t size = 0;
+    uint64_t writeTime = 0;
+    int64_t numEntries = 0;
+};
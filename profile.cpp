@@ -0,0 +1,122 @@
+#include "profile.h"
+
+// Longest value read from the profiles file, including the terminator
+static const DWORD PROFILE_VALUE_SIZE = 1024;
+static const DWORD PROFILE_NAMES_SIZE = 64 * 1024;
+
+static std::string readValue(const std::string &path, const std::string &section, const char *key) {
+    char value[PROFILE_VALUE_SIZE];
+    DWORD len = GetPrivateProfileStringA(section.c_str(), key, "", value, sizeof(value), path.c_str());
+    return std::string(value, len);
+}
+
+static bool isYes(const std::string &value) {
+    return !value.empty() && tolower(value.at(0)) == 'y';
+}
+
+static bool sameName(const std::string &a, const std::string &b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return tolower((unsigned char) x) == tolower((unsigned char) y);
+    });
+}
+
+bool BackupProfile::matches(const std::string &sourceName) const {
+    for (const std::string &candidate : match) {
+        if (sameName(candidate, sourceName)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string defaultProfilesPath() {
+    char exePath[MAX_PATH];
+    DWORD len = GetModuleFileNameA(nullptr, exePath, sizeof(exePath));
+    std::string path(exePath, len);
+    return path.substr(0, path.find_last_of('\\') + 1) + PROFILES_FILE_NAME;
+}
+
+std::vector<BackupProfile> loadProfiles(const std::string &path, std::vector<std::string> *errors) {
+    std::vector<BackupProfile> profiles;
+    std::vector<char> names(PROFILE_NAMES_SIZE);
+    DWORD namesLen = GetPrivateProfileSectionNamesA(names.data(), (DWORD) names.size(), path.c_str());
+    // Section names come back as a list of NUL-terminated strings
+    for (const char *name = names.data(); name < names.data() + namesLen && *name != '\0';
+         name += strlen(name) + 1) {
+        BackupProfile profile;
+        profile.name = name;
+
+        std::stringstream items(readValue(path, profile.name, "match"));
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            if (!item.empty()) {
+                profile.match.push_back(item);
+            }
+        }
+        profile.destination = readValue(path, profile.name, "destination");
+        if (profile.match.empty() || profile.destination.empty()) {
+            errors->push_back(profile.name + ": match and destination are required");
+            continue;
+        }
+        if (profile.destination.back() != '\\') {
+            profile.destination.push_back('\\');
+        }
+
+        profile.filterSpec = readValue(path, profile.name, "filter");
+        FileFilter filter;
+        std::string filterError;
+        if (!FileFilter::compile(profile.filterSpec, &filter, &filterError)) {
+            errors->push_back(profile.name + ": " + filterError);
+            continue;
+        }
+        int numWorkers = GetPrivateProfileIntA(profile.name.c_str(), "workers", 0, path.c_str());
+        profile.numWorkers = numWorkers > 0 ? numWorkers : 0;
+        std::string pack = readValue(path, profile.name, "pack");
+        profile.packThreshold = 0;
+        if (!pack.empty() && !parseSize(pack, &profile.packThreshold)) {
+            errors->push_back(profile.name + ": invalid pack size '" + pack + "'");
+            continue;
+        }
+        profile.dedupEnabled = isYes(readValue(path, profile.name, "dedup"));
+        profile.compressEnabled = isYes(readValue(path, profile.name, "compress"));
+        profile.backend = readValue(path, profile.name, "backend");
+        profile.checksums = isYes(readValue(path, profile.name, "checksums"));
+        profiles.push_back(std::move(profile));
+    }
+    return profiles;
+}
+
+bool saveProfile(const std::string &path, const BackupProfile &profile) {
+    std::string match;
+    for (const std::string &name : profile.match) {
+        match += (match.empty() ? "" : ",") + name;
+    }
+    const char *section = profile.name.c_str();
+    // Deleting the section first drops keys an older version had set
+    WritePrivateProfileStringA(section, nullptr, nullptr, path.c_str());
+    return WritePrivateProfileStringA(section, "match", match.c_str(), path.c_str())
+            && WritePrivateProfileStringA(section, "destination", profile.destination.c_str(), path.c_str())
+            && WritePrivateProfileStringA(section, "filter", profile.filterSpec.c_str(), path.c_str())
+            && WritePrivateProfileStringA(section, "workers", std::to_string(profile.numWorkers).c_str(),
+                                          path.c_str())
+            && WritePrivateProfileStringA(section, "pack", std::to_string(profile.packThreshold).c_str(),
+                                          path.c_str())
+            && WritePrivateProfileStringA(section, "dedup", profile.dedupEnabled ? "y" : "n", path.c_str())
+            && WritePrivateProfileStringA(section, "compress", profile.compressEnabled ? "y" : "n", path.c_str())
+            && WritePrivateProfileStringA(section, "backend", profile.backend.c_str(), path.c_str())
+            && WritePrivateProfileStringA(section, "checksums", profile.checksums ? "y" : "n", path.c_str());
+}
+
+void profileOptions(const BackupProfile &profile, SessionOptions *options) {
+    options->destination = profile.destination;
+    std::string filterError;
+    FileFilter::compile(profile.filterSpec, &options->filter, &filterError);
+    options->adaptive = profile.numWorkers == 0;
+    options->numWorkers = options->adaptive ? ADAPTIVE_MAX_WORKERS : profile.numWorkers;
+    options->packThreshold = profile.packThreshold;
+    options->dedupEnabled = profile.dedupEnabled;
+    options->compressEnabled = profile.compressEnabled;
+    options->follow = false;
+    options->locality = LOCALITY_AUTO;
+    options->checksums = profile.checksums;
+}
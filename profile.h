@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+#include "session.h"
+
+#define PROFILES_FILE_NAME  "bulldozer.profiles.ini"
+
+// Saved backup settings, used by the daemon for any source whose name is
+// listed in match. Stored as one INI section per profile, e.g.
+//   [Camera]
+//   match=EOS_DIGITAL,Pixel 7
+//   destination=D:\Backup
+//   filter=jpg,cr2,mp4 after:2020
+//   workers=4
+//   pack=64KB
+//   dedup=y
+//   compress=n
+//   backend=unbuffered
+//   checksums=n
+// Only match and destination are required. workers=0, or leaving it out,
+// lets each source find its own worker count.
+struct BackupProfile {
+    std::string name;
+    std::vector<std::string> match;     // drive labels or device names, any case
+    std::string destination;
+    std::string filterSpec;
+    UINT numWorkers;                    // 0 adapts to each source
+    uint64_t packThreshold;
+    bool dedupEnabled;
+    bool compressEnabled;
+    std::string backend;                // empty for DEFAULT_COPY_BACKEND
+    bool checksums;
+
+    bool matches(const std::string &sourceName) const;
+};
+
+// PROFILES_FILE_NAME beside the executable, since INI paths must be absolute
+std::string defaultProfilesPath();
+
+// Profiles with a missing destination, an invalid filter or an invalid
+// pack size are left out, with one line each in *errors.
+std::vector<BackupProfile> loadProfiles(const std::string &path, std::vector<std::string> *errors);
+// Adds the profile, replacing any with the same name.
+bool saveProfile(const std::string &path, const BackupProfile &profile);
+
+// Fills in session options; the filter was already checked by loadProfiles()
+void profileOptions(const BackupProfile &profile, SessionOptions *options);
@@ -0,0 +1,121 @@
+#include "progress.h"
+
+static std::string formatDuration(double seconds) {
+    int64_t total = (int64_t) (seconds + 0.5);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld:%02lld:%02lld", (long long) (total / 3600),
+             (long long) (total / 60 % 60), (long long) (total % 60));
+    return std::string(buf);
+}
+
+// Bytes and files that have gone through a copy worker, whatever the outcome
+static int64_t doneBytesOf(const CopyTotals *totals) {
+    return totals->copiedBytes.load(std::memory_order_relaxed)
+            + totals->skippedBytes.load(std::memory_order_relaxed)
+            + totals->dedupBytes.load(std::memory_order_relaxed);
+}
+
+static int64_t doneFilesOf(const CopyTotals *totals) {
+    return totals->copiedFiles.load(std::memory_order_relaxed)
+            + totals->skippedFiles.load(std::memory_order_relaxed)
+            + totals->dedupFiles.load(std::memory_order_relaxed);
+}
+
+ProgressReporter::ProgressReporter(std::vector<ProgressSource> sources, int64_t intervalMs)
+        : sources(std::move(sources)), intervalMs(intervalMs) {
+    rates.resize(this->sources.size());
+}
+
+ProgressReporter::~ProgressReporter() {
+    stop();
+}
+
+void ProgressReporter::start() {
+    startTime = getCurrentMsTime();
+    thread = std::thread(&ProgressReporter::run, this);
+}
+
+void ProgressReporter::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+void ProgressReporter::run() {
+    std::unique_lock<std::mutex> stopLock(mutex);
+    int64_t lastTime = startTime;
+    while (!cv.wait_for(stopLock, std::chrono::milliseconds(intervalMs), [this] { return stopping; })) {
+        int64_t now = getCurrentMsTime();
+        double intervalTime = (now - lastTime) / 1000.0;
+        lastTime = now;
+
+        int64_t plannedFiles = 0;
+        int64_t plannedBytes = 0;
+        int64_t doneFiles = 0;
+        int64_t doneBytes = 0;
+        bool planned = true;
+        std::lock_guard<std::mutex> lock(consoleMutex);
+        for (size_t i = 0; i < sources.size(); i++) {
+            const CopyTotals *totals = sources[i].totals;
+            int64_t sourcePlannedFiles = totals->plannedFiles.load(std::memory_order_relaxed);
+            int64_t sourcePlannedBytes = totals->plannedBytes.load(std::memory_order_relaxed);
+            int64_t sourceDoneFiles = doneFilesOf(totals);
+            int64_t sourceDoneBytes = doneBytesOf(totals);
+            bool sourcePlanned = totals->planned.load(std::memory_order_relaxed);
+            plannedFiles += sourcePlannedFiles;
+            plannedBytes += sourcePlannedBytes;
+            doneFiles += sourceDoneFiles;
+            doneBytes += sourceDoneBytes;
+            planned = planned && sourcePlanned;
+            if (sources[i].done->load(std::memory_order_relaxed)) {
+                std::cout << "  " << sources[i].name << ": done, " << bytesHumanReadable(sourceDoneBytes)
+                    << " in " << sourceDoneFiles << " files." << std::endl;
+                continue;
+            }
+            printLine(sources[i].name, sourcePlannedFiles, sourcePlannedBytes, sourceDoneFiles, sourceDoneBytes,
+                      sourcePlanned, &rates[i], intervalTime);
+        }
+        if (sources.size() > 1) {
+            printLine("Session", plannedFiles, plannedBytes, doneFiles, doneBytes, planned, &sessionRate,
+                      intervalTime);
+        }
+        std::cout << "  Elapsed " << formatDuration((now - startTime) / 1000.0) << std::endl;
+    }
+}
+
+// ETA comes from a smoothed rate, so one slow file does not make it jump.
+// Until the pre-scan finishes the totals are lower bounds and no ETA is given.
+void ProgressReporter::printLine(const std::string &name, int64_t plannedFiles, int64_t plannedBytes,
+                                 int64_t doneFiles, int64_t doneBytes, bool planned, Rate *rate,
+                                 double intervalTime) {
+    if (intervalTime > 0) {
+        double intervalRate = (doneBytes - rate->lastBytes) / intervalTime;
+        rate->bytesPerSec = rate->lastBytes == 0 && rate->bytesPerSec == 0
+                ? intervalRate
+                : PROGRESS_RATE_WEIGHT * intervalRate + (1 - PROGRESS_RATE_WEIGHT) * rate->bytesPerSec;
+    }
+    rate->lastBytes = doneBytes;
+
+    int64_t leftFiles = plannedFiles > doneFiles ? plannedFiles - doneFiles : 0;
+    int64_t leftBytes = plannedBytes > doneBytes ? plannedBytes - doneBytes : 0;
+    std::cout << "  " << name << ": " << bytesHumanReadable(doneBytes) << " of "
+        << bytesHumanReadable(plannedBytes) << (planned ? "" : "+");
+    if (planned && plannedBytes > 0) {
+        char percent[16];
+        snprintf(percent, sizeof(percent), " (%.1f%%)", 100.0 * doneBytes / plannedBytes);
+        std::cout << percent;
+    }
+    std::cout << ", " << leftFiles << " files left, " << bytesHumanReadable((int64_t) rate->bytesPerSec) << "/s";
+    if (!planned) {
+        std::cout << ", scanning";
+    } else if (rate->bytesPerSec > 0) {
+        std::cout << ", ETA " << formatDuration(leftBytes / rate->bytesPerSec);
+    }
+    std::cout << std::endl;
+}
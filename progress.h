@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+#include "backup.h"
+
+#define PROGRESS_INTERVAL_MS    2000
+// Weight of the newest interval in the smoothed rate behind the ETA
+#define PROGRESS_RATE_WEIGHT    0.3
+
+struct ProgressSource {
+    std::string name;
+    const CopyTotals *totals;
+    const std::atomic<bool> *done;
+};
+
+// Prints bytes and files remaining, the current rate and an ETA for every
+// source, plus the session when there are several, every intervalMs on its
+// own thread. Only relaxed loads of the totals happen there, so copy
+// threads never wait on the reporter or on console output.
+class ProgressReporter {
+public:
+    ProgressReporter(std::vector<ProgressSource> sources, int64_t intervalMs);
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter &) = delete;
+    ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+    void start();
+    void stop();
+
+private:
+    struct Rate {
+        int64_t lastBytes = 0;
+        double bytesPerSec = 0;
+    };
+
+    void run();
+    void printLine(const std::string &name, int64_t plannedFiles, int64_t plannedBytes, int64_t doneFiles,
+                   int64_t doneBytes, bool planned, Rate *rate, double intervalTime);
+
+    std::vector<ProgressSource> sources;
+    std::vector<Rate> rates;
+    Rate sessionRate;
+    int64_t intervalMs;
+    int64_t startTime = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+
+// Fixed-capacity FIFO shared between one or more producers and consumers.
+// push() blocks while the queue is full and pop() blocks while it is empty,
+// so a fast walker cannot run arbitrarily far ahead of the copy workers.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    // Returns false if the queue was closed before the item could be added.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and fully drained.
+    bool pop(T *item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        *item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Like pop(), but replaces *batch with up to maxItems of the items that
+    // are already queued, waiting only for the first.
+    bool popBatch(std::vector<T> *batch, size_t maxItems) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        batch->clear();
+        while (!items.empty() && batch->size() < maxItems) {
+            batch->push_back(std::move(items.front()));
+            items.pop_front();
+        }
+        lock.unlock();
+        notFull.notify_all();
+        return true;
+    }
+
+    // Wakes every waiter; remaining items can still be popped.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    bool closed = false;
+};
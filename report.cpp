@@ -0,0 +1,154 @@
+#include "report.h"
+
+static const double REPORT_PERCENTILES[] = {50.0, 90.0, 99.0};
+
+// Names and paths are in the ANSI code page; JSON wants escaped UTF-8.
+static void appendJsonString(std::ostringstream *out, const std::string &value) {
+    std::string utf8;
+    int wideLen = MultiByteToWideChar(CP_ACP, 0, value.c_str(), (int) value.size(), nullptr, 0);
+    if (wideLen > 0) {
+        std::wstring wide(wideLen, L'\0');
+        MultiByteToWideChar(CP_ACP, 0, value.c_str(), (int) value.size(), &wide[0], wideLen);
+        int utf8Len = WideCharToMultiByte(CP_UTF8, 0, wide.c_str(), wideLen, nullptr, 0, nullptr, nullptr);
+        utf8.resize(utf8Len);
+        WideCharToMultiByte(CP_UTF8, 0, wide.c_str(), wideLen, &utf8[0], utf8Len, nullptr, nullptr);
+    }
+
+    *out << '"';
+    for (char c : utf8) {
+        if (c == '"' || c == '\\') {
+            *out << '\\' << c;
+        } else if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) c);
+            *out << escaped;
+        } else {
+            *out << c;
+        }
+    }
+    *out << '"';
+}
+
+static void appendStages(std::ostringstream *out, const StageStats *stats, const std::string &indent) {
+    *out << "{\n";
+    for (size_t i = 0; i < STAGE_COUNT; i++) {
+        Stage stage = (Stage) i;
+        *out << indent << "  \"" << stageName(stage) << "\": {\"seconds\": " << stats->stageNs(stage) / 1e9
+            << ", \"ops\": " << stats->stageOps(stage) << ", \"bytes\": " << stats->stageBytes(stage) << "}"
+            << (i + 1 < STAGE_COUNT ? ",\n" : "\n");
+    }
+    *out << indent << "}";
+}
+
+// Per size bucket: file count, percentiles and the raw power-of-two
+// microsecond histogram, trimmed after the last non-empty bucket.
+static void appendLatency(std::ostringstream *out, const StageStats *stats, const std::string &indent) {
+    *out << "{\n";
+    for (size_t s = 0; s < SIZE_BUCKET_COUNT; s++) {
+        SizeBucket size = (SizeBucket) s;
+        int64_t files = 0;
+        size_t used = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            int64_t count = stats->latencyCount(size, i);
+            files += count;
+            if (count > 0) {
+                used = i + 1;
+            }
+        }
+        *out << indent << "  \"" << sizeBucketName(size) << "\": {\"files\": " << files;
+        for (double percentile : REPORT_PERCENTILES) {
+            *out << ", \"p" << (int) percentile << "Us\": " << stats->latencyPercentileUs(size, percentile);
+        }
+        *out << ", \"histogramUs\": [";
+        for (size_t i = 0; i < used; i++) {
+            *out << (i > 0 ? ", " : "") << stats->latencyCount(size, i);
+        }
+        *out << "]}" << (s + 1 < SIZE_BUCKET_COUNT ? ",\n" : "\n");
+    }
+    *out << indent << "}";
+}
+
+static void appendTotals(std::ostringstream *out, const CopyTotals *totals, const std::string &indent) {
+    *out << indent << "\"copiedFiles\": " << totals->copiedFiles.load() << ",\n"
+        << indent << "\"copiedBytes\": " << totals->copiedBytes.load() << ",\n"
+        << indent << "\"skippedFiles\": " << totals->skippedFiles.load() << ",\n"
+        << indent << "\"skippedBytes\": " << totals->skippedBytes.load() << ",\n"
+        << indent << "\"newFiles\": " << totals->newFiles.load() << ",\n"
+        << indent << "\"changedFiles\": " << totals->changedFiles.load() << ",\n"
+        << indent << "\"unchangedFiles\": " << totals->unchangedFiles.load() << ",\n"
+        << indent << "\"unchangedBytes\": " << totals->unchangedBytes.load() << ",\n"
+        << indent << "\"dedupFiles\": " << totals->dedupFiles.load() << ",\n"
+        << indent << "\"dedupBytes\": " << totals->dedupBytes.load() << ",\n"
+        << indent << "\"packedFiles\": " << totals->packedFiles.load() << ",\n"
+        << indent << "\"packedBytes\": " << totals->packedBytes.load() << ",\n"
+        << indent << "\"compressedFiles\": " << totals->compressedFiles.load() << ",\n"
+        << indent << "\"compressedBytes\": " << totals->compressedBytes.load() << ",\n"
+        << indent << "\"compressedStoredBytes\": " << totals->compressedStoredBytes.load() << ",\n"
+        << indent << "\"resumedFiles\": " << totals->resumedFiles.load() << ",\n"
+        << indent << "\"resumedBytes\": " << totals->resumedBytes.load() << ",\n"
+        << indent << "\"stages\": ";
+    appendStages(out, &totals->stages, indent);
+    *out << ",\n" << indent << "\"fileLatency\": ";
+    appendLatency(out, &totals->stages, indent);
+    *out << "\n";
+}
+
+bool writeRunReport(const std::string &path, const RunReport &report) {
+    CopyTotals session;
+    for (const ReportSource &source : report.sources) {
+        addTotals(&session, source.totals);
+    }
+
+    char startedAt[32];
+    snprintf(startedAt, sizeof(startedAt), "%04u-%02u-%02uT%02u:%02u:%02uZ",
+             report.startedAt.wYear, report.startedAt.wMonth, report.startedAt.wDay,
+             report.startedAt.wHour, report.startedAt.wMinute, report.startedAt.wSecond);
+
+    std::ostringstream out;
+    out << "{\n"
+        << "  \"version\": " << REPORT_VERSION << ",\n"
+        << "  \"startedAt\": \"" << startedAt << "\",\n"
+        << "  \"elapsedSeconds\": " << report.elapsedTime << ",\n"
+        << "  \"backend\": ";
+    appendJsonString(&out, report.backend);
+    out << ",\n"
+        << "  \"workers\": " << report.numWorkers << ",\n"
+        << "  \"adaptiveWorkers\": " << (report.adaptive ? "true" : "false") << ",\n"
+        << "  \"dedup\": " << (report.dedupEnabled ? "true" : "false") << ",\n"
+        << "  \"session\": {\n";
+    appendTotals(&out, &session, "    ");
+    out << "  },\n"
+        << "  \"sources\": [";
+    for (size_t i = 0; i < report.sources.size(); i++) {
+        const ReportSource &source = report.sources[i];
+        out << (i > 0 ? ",\n" : "\n") << "    {\n"
+            << "      \"name\": ";
+        appendJsonString(&out, source.name);
+        out << ",\n      \"path\": ";
+        appendJsonString(&out, source.path);
+        out << ",\n"
+            << "      \"device\": " << (source.isDevice ? "true" : "false") << ",\n"
+            << "      \"elapsedSeconds\": " << source.elapsedTime << ",\n";
+        appendTotals(&out, source.totals, "      ");
+        out << "    }";
+    }
+    out << "\n  ]\n}\n";
+    std::string json = out.str();
+
+    // Same swap as the manifest, so a dashboard never reads half a report
+    std::string tmpPath = path + ".tmp";
+    HANDLE file = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool writeOk = WriteFile(file, json.data(), (DWORD) json.size(), &bytesWritten, nullptr)
+            && bytesWritten == json.size();
+    CloseHandle(file);
+    if (!writeOk) {
+        DeleteFileA(tmpPath.c_str());
+        return false;
+    }
+    return MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
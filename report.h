@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include "backup.h"
+
+#define REPORT_FILE_NAME    "bulldozer.report.json"
+#define REPORT_VERSION      1
+
+struct ReportSource {
+    std::string name;
+    std::string path;
+    bool isDevice;
+    double elapsedTime;
+    const CopyTotals *totals;
+};
+
+// Everything the end-of-run JSON report describes. Written once per
+// session, so fleet dashboards can compare readers and cards across runs.
+struct RunReport {
+    SYSTEMTIME startedAt;       // UTC
+    double elapsedTime;
+    std::string backend;
+    UINT numWorkers;            // the ceiling when adaptive
+    bool adaptive;
+    bool dedupEnabled;
+    std::vector<ReportSource> sources;
+};
+
+// Writes the report as JSON, replacing any previous report at path.
+bool writeRunReport(const std::string &path, const RunReport &report);
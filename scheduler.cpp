@@ -0,0 +1,19 @@
+#include "scheduler.h"
+
+void WriteScheduler::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t ticket = nextTicket++;
+    cv.wait(lock, [this, ticket] { return ticket == servingTicket && active < slots; });
+    servingTicket++;
+    active++;
+    // The next ticket may also fit in a free slot
+    cv.notify_all();
+}
+
+void WriteScheduler::release() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active--;
+    }
+    cv.notify_all();
+}
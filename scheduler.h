@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+
+// Limits how many copies write to the destination at once across every
+// source in a session. Waiters are served in arrival order, so a fast SD
+// reader cannot starve a slow phone transfer of destination bandwidth.
+class WriteScheduler {
+public:
+    explicit WriteScheduler(UINT slots) : slots(slots > 0 ? slots : 1) {}
+
+    void acquire();
+    void release();
+
+private:
+    UINT slots;
+    UINT active = 0;
+    uint64_t nextTicket = 0;
+    uint64_t servingTicket = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+// Holds a write slot for its lifetime; a null scheduler means no limit.
+class WriteSlot {
+public:
+    explicit WriteSlot(WriteScheduler *scheduler) : scheduler(scheduler) {
+        if (scheduler != nullptr) {
+            scheduler->acquire();
+        }
+    }
+    ~WriteSlot() {
+        if (scheduler != nullptr) {
+            scheduler->release();
+        }
+    }
+
+    WriteSlot(const WriteSlot &) = delete;
+    WriteSlot &operator=(const WriteSlot &) = delete;
+
+private:
+    WriteScheduler *scheduler;
+};
@@ -0,0 +1,117 @@
+#include "session.h"
+#include "report.h"
+#include "progress.h"
+
+std::vector<Drive> getLogicalDrives() {
+    DWORD reqBufSize = GetLogicalDriveStringsA(0, nullptr);
+    LPSTR driveLetters = new TCHAR[reqBufSize];
+    GetLogicalDriveStringsA(reqBufSize, driveLetters);
+    LPSTR loopDrive = driveLetters;
+    std::vector<Drive> drives = {};
+    do {
+        if (strcmp(loopDrive, "C:\\") != 0) {
+            LPSTR volName = new TCHAR[256];
+            GetVolumeInformationA(loopDrive, volName, (DWORD) 256,
+                    nullptr, nullptr, nullptr, nullptr, 0);
+            drives.push_back(Drive{std::string(1, loopDrive[0]) + ":\\", volName});
+            delete[] volName;
+        }
+        while (*loopDrive++);
+    } while (*loopDrive);
+    return drives;
+}
+
+// Reader thread for one source in a session.
+static void backupSource(BackupSource *source, const SessionOptions *options, ContentIndex *dedup,
+                         BlockCompressor *compressor, WriteScheduler *scheduler, CopyBackend *backend) {
+    int64_t startTime = getCurrentMsTime();
+    if (source->drive.isWPD) {
+        HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        backupDevice(source->device, source->drive.name, options->destination, &options->filter,
+                     options->numWorkers, options->adaptive, options->packThreshold, dedup, scheduler,
+                     &source->totals);
+        if (SUCCEEDED(hrInit)) {
+            CoUninitialize();
+        }
+    } else {
+        backupDrive(&source->drive, options->destination, &options->filter, options->numWorkers,
+                    options->adaptive, options->packThreshold, dedup, compressor, scheduler, backend, options->locality,
+                    options->follow, options->checksums, &source->totals);
+    }
+    source->elapsedTime = (getCurrentMsTime() - startTime) / 1000.0;
+    source->done = true;
+}
+
+void runSession(const SessionOptions &options, CopyBackend *backend,
+                std::vector<std::unique_ptr<BackupSource>> *sources) {
+    // One index serves every source, so a file already copied from one
+    // card or phone is found when the same photo turns up on another.
+    std::unique_ptr<ContentIndex> dedup;
+    if (options.dedupEnabled) {
+        int64_t indexStartTime = getCurrentMsTime();
+        dedup = std::make_unique<ContentIndex>(options.destination);
+        dedup->load();
+        std::cout << "Indexed " << dedup->size() << " destination files in "
+            << getCurrentMsTime() - indexStartTime << " ms." << std::endl;
+    }
+
+    // One pool compresses blocks for every source, sized to the machine
+    std::unique_ptr<BlockCompressor> compressor;
+    if (options.compressEnabled) {
+        compressor = std::make_unique<BlockCompressor>(std::thread::hardware_concurrency());
+    }
+
+    // Each source reads with numWorkers threads, but only that many writes
+    // land on the destination at once across the whole session. With
+    // adaptive sources numWorkers is only a ceiling, so the destination gets
+    // the default limit instead, and each source stops adding workers once
+    // the destination stops keeping up.
+    UINT numWriters = options.adaptive ? std::min<UINT>(options.numWorkers, DEFAULT_COPY_WORKERS) : options.numWorkers;
+    WriteScheduler scheduler(numWriters);
+    std::vector<ProgressSource> progressSources;
+    for (const std::unique_ptr<BackupSource> &source : *sources) {
+        progressSources.push_back(ProgressSource{source->drive.name, &source->totals, &source->done});
+    }
+    ProgressReporter reporter(std::move(progressSources), PROGRESS_INTERVAL_MS);
+    RunReport report{};
+    GetSystemTime(&report.startedAt);
+    int64_t startTime = getCurrentMsTime();
+    std::vector<std::thread> readers;
+    for (std::unique_ptr<BackupSource> &source : *sources) {
+        readers.emplace_back(backupSource, source.get(), &options, dedup.get(), compressor.get(), &scheduler,
+                             backend);
+    }
+    reporter.start();
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    reporter.stop();
+    if (dedup != nullptr && !dedup->save()) {
+        std::cout << "! Failed to save dedup index: " << lastErrorMessage();
+    }
+
+    double elapsedTime = (getCurrentMsTime() - startTime) / 1000.0;
+    if (sources->size() > 1) {
+        CopyTotals session;
+        for (const std::unique_ptr<BackupSource> &source : *sources) {
+            addTotals(&session, &source->totals);
+        }
+        printSummary("Session", &session, elapsedTime, options.numWorkers, dedup != nullptr);
+    }
+
+    report.elapsedTime = elapsedTime;
+    report.backend = backend->name();
+    report.numWorkers = options.numWorkers;
+    report.adaptive = options.adaptive;
+    report.dedupEnabled = dedup != nullptr;
+    for (const std::unique_ptr<BackupSource> &source : *sources) {
+        report.sources.push_back(ReportSource{source->drive.name, source->drive.path, source->drive.isWPD,
+                                              source->elapsedTime, &source->totals});
+    }
+    std::string reportPath = options.destination + REPORT_FILE_NAME;
+    if (writeRunReport(reportPath, report)) {
+        std::cout << "Run report written to " << reportPath << std::endl;
+    } else {
+        std::cout << "! Failed to write run report: " << lastErrorMessage();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+#include "backup.h"
+
+#define DEFAULT_COPY_WORKERS    4
+// Ceiling for sources whose worker count adapts
+#define ADAPTIVE_MAX_WORKERS    16
+
+// One drive or device in a session, backed up on its own thread. totals
+// is read by the progress reporter while the backup runs.
+struct BackupSource {
+    IndexedDrive drive;
+    CComPtr<IPortableDevice> device;
+    CopyTotals totals;
+    double elapsedTime = 0;
+    std::atomic<bool> done{false};
+};
+
+// Settings shared by every source in a session, from the console prompts
+// or from a saved profile.
+struct SessionOptions {
+    std::string destination;    // with trailing separator
+    FileFilter filter;
+    UINT numWorkers;            // per source, or the most an adaptive source uses
+    bool adaptive;              // each source finds its own throughput knee
+    uint64_t packThreshold;     // 0 packs nothing
+    bool dedupEnabled;
+    bool compressEnabled;
+    bool follow;                // keep copying new files until Ctrl+C; drives only
+    LocalityMode locality;      // drives only
+    bool checksums;             // hash plain drive copies for --verify; drives only
+};
+
+// Every drive letter except C:, named by volume label
+std::vector<Drive> getLogicalDrives();
+
+// Backs up all sources at once with live progress, then prints the
+// summaries and writes the run report into the destination.
+void runSession(const SessionOptions &options, CopyBackend *backend,
+                std::vector<std::unique_ptr<BackupSource>> *sources);
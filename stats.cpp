@@ -0,0 +1,91 @@
+#include "stats.h"
+
+static const char *STAGE_NAMES[STAGE_COUNT] = {
+        "walk",
+        "queueWait",
+        "locality",
+        "fileTime",
+        "mediaDate",
+        "directory",
+        "dedup",
+        "writeWait",
+        "copy",
+        "compress",
+        "manifest",
+        "wpdEnumerate",
+        "wpdMetadata",
+        "wpdTransfer"
+};
+
+static const char *SIZE_BUCKET_NAMES[SIZE_BUCKET_COUNT] = {
+        "under64KB",
+        "under1MB",
+        "under16MB",
+        "under256MB",
+        "larger"
+};
+
+const char *stageName(Stage stage) {
+    return STAGE_NAMES[stage];
+}
+
+const char *sizeBucketName(SizeBucket bucket) {
+    return SIZE_BUCKET_NAMES[bucket];
+}
+
+SizeBucket sizeBucketOf(uint64_t sizeBytes) {
+    if (sizeBytes < 64 * 1024) {
+        return SIZE_UNDER_64K;
+    }
+    if (sizeBytes < 1024 * 1024) {
+        return SIZE_UNDER_1M;
+    }
+    if (sizeBytes < 16 * 1024 * 1024) {
+        return SIZE_UNDER_16M;
+    }
+    if (sizeBytes < 256 * 1024 * 1024) {
+        return SIZE_UNDER_256M;
+    }
+    return SIZE_LARGER;
+}
+
+// Bucket 0 holds anything under 1us, bucket i anything under 2^i us
+void StageStats::recordFileLatency(uint64_t sizeBytes, int64_t ns) {
+    int64_t us = ns / 1000;
+    size_t bucket = 0;
+    while (us > 0 && bucket < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    latency[sizeBucketOf(sizeBytes)][bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t StageStats::latencyPercentileUs(SizeBucket size, double percentile) const {
+    int64_t total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        total += latency[size][i].load();
+    }
+    if (total == 0) {
+        return 0;
+    }
+    int64_t rank = (int64_t) (total * percentile / 100.0 + 0.5);
+    int64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += latency[size][i].load();
+        if (seen >= rank && seen > 0) {
+            return (int64_t) 1 << i;
+        }
+    }
+    return (int64_t) 1 << (LATENCY_BUCKETS - 1);
+}
+
+void StageStats::add(const StageStats *other) {
+    for (size_t i = 0; i < STAGE_COUNT; i++) {
+        record((Stage) i, other->stages[i].ns.load(), other->stages[i].bytes.load(), other->stages[i].ops.load());
+    }
+    for (size_t size = 0; size < SIZE_BUCKET_COUNT; size++) {
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            latency[size][i] += other->latency[size][i].load();
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.h"
+
+// Per-file latencies are bucketed by powers of two of microseconds, so the
+// last bucket starts at about 36 minutes.
+#define LATENCY_BUCKETS     32
+
+// Hot-path stages timed during a backup
+enum Stage {
+    STAGE_WALK,             // directory iteration and manifest lookups on the walker
+    STAGE_QUEUE_WAIT,       // walker blocked on a full copy queue
+    STAGE_LOCALITY,         // looking up where queued files start on disk
+    STAGE_FILE_TIME,        // opening a source file for getFileTime()
+    STAGE_MEDIA_DATE,       // reading photo and video headers for their date
+    STAGE_DIRECTORY,        // destination folder lookup and CreateDirectory
+    STAGE_DEDUP,            // hashing and index lookups for duplicates
+    STAGE_WRITE_WAIT,       // waiting for a session write slot
+    STAGE_COPY,             // backend copies
+    STAGE_COMPRESS,         // block-compressed copies, reading through renaming
+    STAGE_MANIFEST,         // manifest load and save
+    STAGE_WPD_ENUMERATE,    // walking the device object tree
+    STAGE_WPD_METADATA,     // fetching object properties
+    STAGE_WPD_TRANSFER,     // streaming objects off the device
+    STAGE_COUNT
+};
+
+// Files are split by size so a slow card shows up as a shift in one row
+// instead of being averaged away by thousands of small files.
+enum SizeBucket {
+    SIZE_UNDER_64K,
+    SIZE_UNDER_1M,
+    SIZE_UNDER_16M,
+    SIZE_UNDER_256M,
+    SIZE_LARGER,
+    SIZE_BUCKET_COUNT
+};
+
+const char *stageName(Stage stage);
+const char *sizeBucketName(SizeBucket bucket);
+SizeBucket sizeBucketOf(uint64_t sizeBytes);
+
+// Monotonic nanoseconds, only meaningful as a difference between two calls
+inline int64_t getCurrentNsTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Time, operation and byte counts per stage plus per-file copy latency
+// histograms. Updated with relaxed atomics from every worker; each stage
+// sits on its own cache line so workers in different stages do not contend.
+class StageStats {
+public:
+    void record(Stage stage, int64_t ns, int64_t bytes = 0, int64_t ops = 1) {
+        StageCounter &counter = stages[stage];
+        counter.ns.fetch_add(ns, std::memory_order_relaxed);
+        counter.ops.fetch_add(ops, std::memory_order_relaxed);
+        counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // One file's end-to-end copy or transfer time
+    void recordFileLatency(uint64_t sizeBytes, int64_t ns);
+
+    int64_t stageNs(Stage stage) const { return stages[stage].ns.load(); }
+    int64_t stageOps(Stage stage) const { return stages[stage].ops.load(); }
+    int64_t stageBytes(Stage stage) const { return stages[stage].bytes.load(); }
+    int64_t latencyCount(SizeBucket size, size_t bucket) const { return latency[size][bucket].load(); }
+
+    // Upper bound, in microseconds, of the latency bucket holding the given
+    // percentile of files in one size bucket; 0 if it holds no files.
+    int64_t latencyPercentileUs(SizeBucket size, double percentile) const;
+
+    void add(const StageStats *other);
+
+private:
+    struct alignas(64) StageCounter {
+        std::atomic<int64_t> ns{0};
+        std::atomic<int64_t> ops{0};
+        std::atomic<int64_t> bytes{0};
+    };
+
+    StageCounter stages[STAGE_COUNT];
+    std::atomic<int64_t> latency[SIZE_BUCKET_COUNT][LATENCY_BUCKETS] = {};
+};
+
+// Records the time from construction to destruction against one stage;
+// a null stats pointer makes it a no-op.
+class StageTimer {
+public:
+    StageTimer(StageStats *stats, Stage stage, int64_t bytes = 0)
+            : stats(stats), stage(stage), bytes(bytes), startTime(stats != nullptr ? getCurrentNsTime() : 0) {}
+    ~StageTimer() {
+        if (stats != nullptr) {
+            stats->record(stage, getCurrentNsTime() - startTime, bytes);
+        }
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    StageStats *stats;
+    Stage stage;
+    int64_t bytes;
+    int64_t startTime;
+};
@@ -0,0 +1,122 @@
+#include "streamcopy.h"
+
+StreamCopyEngine::StreamCopyEngine(TransferCounters *counters, size_t numBuffers) :
+        counters(counters), numBuffers(numBuffers > 0 ? numBuffers : 1),
+        freeBuffers(numBuffers > 0 ? numBuffers : 1), filledChunks((numBuffers > 0 ? numBuffers : 1) + 1) {
+    writer = std::thread(&StreamCopyEngine::WriterLoop, this);
+}
+
+StreamCopyEngine::~StreamCopyEngine() {
+    filledChunks.close();
+    freeBuffers.close();
+    writer.join();
+}
+
+// Only called between objects, when every buffer is back in the free queue.
+void StreamCopyEngine::EnsureBufferSize(DWORD cbTransferSize) {
+    if (cbTransferSize <= bufferSize) {
+        return;
+    }
+    BYTE *unused;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        freeBuffers.pop(&unused);
+    }
+    buffers.clear();
+    for (size_t i = 0; i < numBuffers; i++) {
+        buffers.emplace_back(new BYTE[cbTransferSize]);
+        freeBuffers.push(buffers.back().get());
+    }
+    bufferSize = cbTransferSize;
+}
+
+void StreamCopyEngine::WriterLoop() {
+    // The destination stream may be used from this thread, so join the MTA
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+    Chunk chunk;
+    while (filledChunks.pop(&chunk)) {
+        if (chunk.data == nullptr) {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            objectDone = true;
+            doneCv.notify_one();
+            continue;
+        }
+
+        // After a failed write keep draining so the reader gets its buffers back
+        if (SUCCEEDED(writeResult.load(std::memory_order_relaxed))) {
+            ULONG cbWritten = 0;
+            HRESULT hr = currentDest->Write(chunk.data, chunk.len, &cbWritten);
+            if (FAILED(hr)) {
+                printf("! Failed to write %lu bytes of object data to the destination stream, hr = 0x%lx\n", chunk.len, hr);
+                writeResult.store(hr);
+            } else {
+                objectBytesWritten += cbWritten;
+                objectHash.update(chunk.data, cbWritten);
+                counters->bytesWritten.fetch_add(cbWritten, std::memory_order_relaxed);
+            }
+        }
+        freeBuffers.push(chunk.data);
+    }
+
+    if (SUCCEEDED(hrInit)) {
+        CoUninitialize();
+    }
+}
+
+HRESULT StreamCopyEngine::Copy(IStream *pDestStream, IStream *pSourceStream, DWORD cbTransferSize, ULONGLONG *pcbWritten,
+                               uint64_t *pChecksum) {
+    if (cbTransferSize == 0) {
+        return E_INVALIDARG;
+    }
+    EnsureBufferSize(cbTransferSize);
+    currentDest = pDestStream;
+    writeResult.store(S_OK);
+    objectBytesWritten = 0;
+    objectHash = Xxh64();
+    objectDone = false;
+
+    // Read until the number of bytes returned from the source stream is 0, or
+    // an error occured on either side of the transfer.
+    HRESULT hr = S_OK;
+    BYTE *buffer = nullptr;
+    while (freeBuffers.pop(&buffer)) {
+        if (FAILED(writeResult.load())) {
+            freeBuffers.push(buffer);
+            break;
+        }
+        ULONG cbRead = 0;
+        hr = pSourceStream->Read(buffer, cbTransferSize, &cbRead);
+        if (FAILED(hr)) {
+            printf("! Failed to read %lu bytes from the source stream, hr = 0x%lx\n", cbTransferSize, hr);
+        }
+        if (FAILED(hr) || cbRead == 0) {
+            freeBuffers.push(buffer);
+            break;
+        }
+        counters->bytesRead.fetch_add(cbRead, std::memory_order_relaxed);
+        counters->chunks.fetch_add(1, std::memory_order_relaxed);
+        filledChunks.push(Chunk{buffer, cbRead});
+    }
+
+    // Wait for the writer to finish everything queued for this object
+    filledChunks.push(Chunk{nullptr, 0});
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCv.wait(lock, [this] { return objectDone; });
+    }
+    currentDest = nullptr;
+
+    if (SUCCEEDED(hr)) {
+        hr = writeResult.load();
+    }
+    if (SUCCEEDED(hr)) {
+        counters->objects.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (pcbWritten != nullptr) {
+        *pcbWritten = objectBytesWritten;
+    }
+    if (pChecksum != nullptr) {
+        *pChecksum = objectHash.digest();
+    }
+    return hr;
+}
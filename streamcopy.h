@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common.h"
+#include "queue.h"
+#include "hash.h"
+
+// Two buffers let the device read of chunk N+1 overlap the disk write of chunk N
+#define NUM_TRANSFER_BUFFERS    2
+
+// Progress for every object copied through an engine. Updated with relaxed
+// atomics so readers never slow the transfer down.
+struct TransferCounters {
+    std::atomic<ULONGLONG> bytesRead{0};
+    std::atomic<ULONGLONG> bytesWritten{0};
+    std::atomic<ULONGLONG> chunks{0};
+    std::atomic<ULONGLONG> objects{0};
+};
+
+// Copies IStream objects with the read on the calling thread and the write
+// on a dedicated writer thread. Transfer buffers are allocated once, sized to
+// the largest cbOptimalTransferSize seen, and reused for every object.
+class StreamCopyEngine {
+public:
+    explicit StreamCopyEngine(TransferCounters *counters, size_t numBuffers = NUM_TRANSFER_BUFFERS);
+    ~StreamCopyEngine();
+
+    StreamCopyEngine(const StreamCopyEngine &) = delete;
+    StreamCopyEngine &operator=(const StreamCopyEngine &) = delete;
+
+    // Copies pSourceStream to pDestStream in cbTransferSize chunks and
+    // returns once every byte has been written (or either side failed).
+    // The writer hashes each chunk after writing it, so *pChecksum (if not
+    // nullptr) costs the reader nothing.
+    HRESULT Copy(IStream *pDestStream, IStream *pSourceStream, DWORD cbTransferSize, ULONGLONG *pcbWritten,
+                 uint64_t *pChecksum = nullptr);
+
+private:
+    struct Chunk {
+        BYTE  *data;    // nullptr marks the end of the current object
+        ULONG len;
+    };
+
+    void EnsureBufferSize(DWORD cbTransferSize);
+    void WriterLoop();
+
+    TransferCounters *counters;
+    size_t numBuffers;
+    std::vector<std::unique_ptr<BYTE[]>> buffers;
+    DWORD bufferSize = 0;
+    BoundedQueue<BYTE *> freeBuffers;
+    BoundedQueue<Chunk> filledChunks;
+
+    // State of the object currently being copied, owned by the writer
+    // between Copy() queueing its first chunk and the end marker.
+    IStream *currentDest = nullptr;
+    std::atomic<HRESULT> writeResult{S_OK};
+    ULONGLONG objectBytesWritten = 0;
+    Xxh64 objectHash;
+    bool objectDone = false;
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+
+    std::thread writer;
+};
@@ -0,0 +1,120 @@
+#include "verify.h"
+#include "backup.h"
+#include "hash.h"
+
+enum VerifyStatus {
+    VERIFY_OK,
+    VERIFY_MISSING,
+    VERIFY_MISMATCH
+};
+
+struct VerifyContext {
+    std::vector<CatalogEntry> entries;
+    std::atomic<size_t> next{0};
+    std::atomic<int64_t> verifiedFiles{0};
+    std::atomic<int64_t> verifiedBytes{0};
+    std::atomic<int64_t> missingFiles{0};
+    std::atomic<int64_t> mismatchedFiles{0};
+};
+
+// Packed files are cataloged as "<segment>@<offset>"; file names may
+// contain '@' too, so the part before it must name a segment.
+static bool splitPackLocation(const std::string &location, std::string *path, uint64_t *offset) {
+    size_t at = location.rfind('@');
+    size_t extLen = strlen(PACK_SEGMENT_EXTENSION);
+    if (at == std::string::npos || at < extLen
+            || location.compare(at - extLen, extLen, PACK_SEGMENT_EXTENSION) != 0
+            || location.find_first_not_of("0123456789", at + 1) != std::string::npos) {
+        return false;
+    }
+    path->assign(location, 0, at);
+    *offset = std::stoull(location.substr(at + 1));
+    return true;
+}
+
+static VerifyStatus verifyEntry(const CatalogEntry &entry, std::vector<char> *buffer) {
+    std::string path;
+    uint64_t offset = 0;
+    bool packed = splitPackLocation(entry.location, &path, &offset);
+    if (!packed) {
+        path = entry.location;
+    }
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return VERIFY_MISSING;
+    }
+    LARGE_INTEGER fileSize;
+    LARGE_INTEGER start;
+    start.QuadPart = (LONGLONG) offset;
+    bool ok = GetFileSizeEx(file, &fileSize)
+            && (packed ? (uint64_t) fileSize.QuadPart >= offset + entry.length
+                       : (uint64_t) fileSize.QuadPart == entry.length)
+            && SetFilePointerEx(file, start, nullptr, FILE_BEGIN);
+    Xxh64 hash;
+    uint64_t remaining = entry.length;
+    while (ok && remaining > 0) {
+        DWORD toRead = (DWORD) (std::min)(remaining, (uint64_t) buffer->size());
+        DWORD bytesRead = 0;
+        ok = ReadFile(file, buffer->data(), toRead, &bytesRead, nullptr) && bytesRead == toRead;
+        hash.update(buffer->data(), bytesRead);
+        remaining -= bytesRead;
+    }
+    CloseHandle(file);
+    return ok && hash.digest() == entry.checksum ? VERIFY_OK : VERIFY_MISMATCH;
+}
+
+static void verifyWorker(VerifyContext *ctx) {
+    std::vector<char> buffer(COPY_CHUNK_SIZE);
+    size_t i;
+    while ((i = ctx->next.fetch_add(1)) < ctx->entries.size()) {
+        const CatalogEntry &entry = ctx->entries[i];
+        VerifyStatus status = verifyEntry(entry, &buffer);
+        if (status == VERIFY_OK) {
+            ctx->verifiedFiles.fetch_add(1, std::memory_order_relaxed);
+            ctx->verifiedBytes.fetch_add(entry.length, std::memory_order_relaxed);
+            continue;
+        }
+        (status == VERIFY_MISSING ? ctx->missingFiles : ctx->mismatchedFiles).fetch_add(1);
+        std::lock_guard<std::mutex> lock(consoleMutex);
+        std::cout << (status == VERIFY_MISSING ? "! Missing: " : "! Checksum mismatch: ") << entry.location
+            << std::endl;
+    }
+}
+
+int runVerify(const std::string &destination, UINT numWorkers) {
+    std::string base = destination;
+    if (base.empty() || base.back() != '\\') {
+        base.push_back('\\');
+    }
+    // The folder itself if it is one source's, and every source folder in it
+    VerifyContext ctx;
+    size_t numCatalogs = loadCatalogs(base, &ctx.entries);
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(base, ec)) {
+        if (entry.is_directory(ec)) {
+            numCatalogs += loadCatalogs(entry.path().string() + '\\', &ctx.entries);
+        }
+    }
+    if (numCatalogs == 0) {
+        std::cout << "! No checksum catalogs found in " << base << std::endl;
+        return 1;
+    }
+    std::cout << "Verifying " << ctx.entries.size() << " files from " << numCatalogs << " catalogs with "
+        << numWorkers << " workers..." << std::endl;
+
+    int64_t startTime = getCurrentMsTime();
+    std::vector<std::thread> workers;
+    for (UINT i = 0; i < numWorkers; i++) {
+        workers.emplace_back(verifyWorker, &ctx);
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    double elapsedTime = (getCurrentMsTime() - startTime) / 1000.0;
+    int64_t problems = ctx.mismatchedFiles.load() + ctx.missingFiles.load();
+    std::cout << "Verified " << ctx.verifiedFiles.load() << " files (" << bytesHumanReadable(ctx.verifiedBytes)
+        << ") in " << elapsedTime << " seconds, " << ctx.mismatchedFiles.load() << " mismatched, "
+        << ctx.missingFiles.load() << " missing." << std::endl;
+    return problems == 0 ? 0 : 1;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "common.h"
+
+// Re-hashes everything the catalogs under destination list, with
+// numWorkers files read at once, and prints every file that is missing or
+// no longer matches. destination is a backup base path or one source's
+// folder in it. Returns 0 if everything matched, 1 otherwise.
+int runVerify(const std::string &destination, UINT numWorkers);
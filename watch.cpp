@@ -0,0 +1,155 @@
+#include "watch.h"
+#include "backup.h"
+
+static const DWORD WATCH_FILTER = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+        | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+static HANDLE stopEvent = nullptr;
+static std::once_flag stopHandlerOnce;
+
+static BOOL WINAPI onConsoleCtrl(DWORD ctrlType) {
+    if (ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT) {
+        SetEvent(stopEvent);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+HANDLE watchStopEvent() {
+    std::call_once(stopHandlerOnce, []() {
+        stopEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+        SetConsoleCtrlHandler(onConsoleCtrl, TRUE);
+    });
+    return stopEvent;
+}
+
+ChangeWatcher::~ChangeWatcher() {
+    if (dir != INVALID_HANDLE_VALUE) {
+        // The read must be finished before its buffer goes away
+        DWORD bytesReturned;
+        CancelIoEx(dir, &overlapped);
+        GetOverlappedResult(dir, &overlapped, &bytesReturned, TRUE);
+        CloseHandle(dir);
+    }
+    if (event != nullptr) {
+        CloseHandle(event);
+    }
+}
+
+bool ChangeWatcher::open() {
+    watchStopEvent();
+    dir = CreateFileA(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                      nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (dir == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    buffer.resize(WATCH_BUFFER_SIZE / sizeof(DWORD));
+    return event != nullptr && issueRead();
+}
+
+bool ChangeWatcher::issueRead() {
+    overlapped = OVERLAPPED{};
+    overlapped.hEvent = event;
+    return ReadDirectoryChangesW(dir, buffer.data(), (DWORD) (buffer.size() * sizeof(DWORD)), TRUE, WATCH_FILTER,
+                                 nullptr, &overlapped, nullptr);
+}
+
+void ChangeWatcher::parse(DWORD bytesReturned) {
+    int64_t now = getCurrentMsTime();
+    const BYTE *next = (const BYTE *) buffer.data();
+    const BYTE *end = next + bytesReturned;
+    while (next < end) {
+        const FILE_NOTIFY_INFORMATION *info = (const FILE_NOTIFY_INFORMATION *) next;
+        std::wstring_view name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+        // Converted the way the walker's directory entries are, so both
+        // produce the same relative paths
+        std::string path = root + std::filesystem::path(name).string();
+        switch (info->Action) {
+            case FILE_ACTION_MODIFIED: {
+                // A folder is modified whenever anything inside it changes,
+                // and those changes are reported on their own. Only folders
+                // added or moved in are walked.
+                DWORD attributes = GetFileAttributesA(path.c_str());
+                if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                    break;
+                }
+                pending[path] = now;
+                break;
+            }
+            case FILE_ACTION_ADDED:
+            case FILE_ACTION_RENAMED_NEW_NAME:
+                pending[path] = now;
+                break;
+            case FILE_ACTION_REMOVED:
+            case FILE_ACTION_RENAMED_OLD_NAME:
+                // Backups keep deleted files, but there is nothing left to copy
+                pending.erase(path);
+                break;
+        }
+        if (info->NextEntryOffset == 0) {
+            break;
+        }
+        next += info->NextEntryOffset;
+    }
+}
+
+// Opening without FILE_SHARE_WRITE fails while a camera or sync client
+// still has the file open to write, however long it pauses between writes.
+static bool stillWriting(const std::string &path) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return GetLastError() == ERROR_SHARING_VIOLATION;
+    }
+    CloseHandle(file);
+    return false;
+}
+
+bool ChangeWatcher::wait(std::vector<std::string> *ready, bool *overflowed) {
+    HANDLE handles[] = {event, stopEvent};
+    *overflowed = false;
+    while (ready->empty()) {
+        DWORD result = WaitForMultipleObjects(2, handles, FALSE, pending.empty() ? INFINITE : WATCH_POLL_MS);
+        if (result == WAIT_OBJECT_0 + 1) {
+            return false;
+        }
+        if (result == WAIT_OBJECT_0) {
+            DWORD bytesReturned = 0;
+            if (!GetOverlappedResult(dir, &overlapped, &bytesReturned, FALSE) || bytesReturned == 0) {
+                // The buffer overflowed and the changes were dropped
+                *overflowed = true;
+            } else {
+                parse(bytesReturned);
+            }
+            if (!issueRead()) {
+                std::cout << "! Stopped watching " << root << ": " << lastErrorMessage();
+                return false;
+            }
+            if (*overflowed) {
+                pending.clear();
+                return true;
+            }
+        }
+
+        int64_t now = getCurrentMsTime();
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (now - it->second < WATCH_QUIET_MS) {
+                ++it;
+                continue;
+            }
+            DWORD attributes = GetFileAttributesA(it->first.c_str());
+            if (attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY)
+                    && stillWriting(it->first)) {
+                it->second = now;
+                ++it;
+                continue;
+            }
+            if (attributes != INVALID_FILE_ATTRIBUTES) {
+                ready->push_back(it->first);
+            }
+            it = pending.erase(it);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+
+// A changed file is handed on once nothing has touched it for this long
+// and no other process still has it open for writing.
+#define WATCH_QUIET_MS          2000
+#define WATCH_POLL_MS           250
+#define WATCH_BUFFER_SIZE       (64 * 1024)
+// A followed source's manifest is saved at most this often, so a crash
+// loses little more than the journal can replay
+#define WATCH_CHECKPOINT_MS     60000
+
+// Set on Ctrl+C or Ctrl+Break once a watcher has been created, so every
+// followed source finishes its queued copies and saves its manifest.
+HANDLE watchStopEvent();
+
+// Follows changes anywhere under a source folder with ReadDirectoryChangesW,
+// debouncing files that are still being written. Opened before the first
+// walk, so nothing created while it runs is missed.
+class ChangeWatcher {
+public:
+    explicit ChangeWatcher(std::string rootPath) : root(std::move(rootPath)) {}
+    ~ChangeWatcher();
+
+    ChangeWatcher(const ChangeWatcher &) = delete;
+    ChangeWatcher &operator=(const ChangeWatcher &) = delete;
+
+    bool open();
+
+    // Waits for notifications and adds the full paths of changed files and
+    // of folders added or moved in that have settled to *ready. Sets
+    // *overflowed if notifications were lost and the source must be walked
+    // again. Returns false once watchStopEvent() is set.
+    bool wait(std::vector<std::string> *ready, bool *overflowed);
+
+private:
+    bool issueRead();
+    void parse(DWORD bytesReturned);
+
+    std::string root;
+    HANDLE dir = INVALID_HANDLE_VALUE;
+    HANDLE event = nullptr;
+    OVERLAPPED overlapped{};
+    std::vector<DWORD> buffer;  // DWORD-aligned, as ReadDirectoryChangesW requires
+    // Full path of each changed file or folder to the time of its last notification
+    std::unordered_map<std::string, int64_t> pending;
+};
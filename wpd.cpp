@@ -1,8 +1,12 @@
 #include "wpd.h"
+#include "streamcopy.h"
+#include "layout.h"
 
-// This number controls how many object identifiers are requested during each call
-// to IEnumPortableDeviceObjectIDs::Next()
-#define NUM_OBJECTS_TO_REQUEST  10
+// These numbers bound how many object identifiers are requested during each call
+// to IEnumPortableDeviceObjectIDs::Next(). Each folder starts small and doubles the
+// request while the device keeps filling it, so large folders take few round-trips.
+#define MIN_OBJECTS_TO_REQUEST  32
+#define MAX_OBJECTS_TO_REQUEST  2048
 
 #define CLIENT_NAME             L"WPD Sample Application"
 #define CLIENT_MAJOR_VER        1
@@ -70,14 +74,10 @@ void GetClientInformation(IPortableDeviceValues** ppClientInformation) {
     }
 }
 
-// Calls EnumerateDevices() function to display devices on the system
-// and to obtain the total number of devices found.  If 1 or more devices
-// are found, this function prompts the user to choose a device using
-// a zero-based index.
-void ChooseDevice(IPortableDevice** ppDevice, const UINT uiCurrentDevice, DWORD cPnPDeviceIDs) {
-    HRESULT                         hr              = S_OK;
-    PWSTR*                          pPnpDeviceIDs   = NULL;
-    CComPtr<IPortableDeviceManager> pPortableDeviceManager;
+// Opens the device whose PnP device ID GetAllDevices() listed as its path.
+// Going by ID rather than position keeps a device plugged in or removed
+// since the list was taken from shifting the choice onto another one.
+void OpenDevice(IPortableDevice** ppDevice, const std::string &pnpDeviceId) {
     CComPtr<IPortableDeviceValues>  pClientInformation;
 
     if (ppDevice == nullptr) {
@@ -98,59 +98,30 @@ void ChooseDevice(IPortableDevice** ppDevice, const UINT uiCurrentDevice, DWORD
 
     GetClientInformation(&pClientInformation);
 
-    // CoCreate the IPortableDeviceManager interface to enumerate
-    // portable devices and to get information about them.
-    hr = CoCreateInstance(CLSID_PortableDeviceManager,
-                          NULL,
-                          CLSCTX_INPROC_SERVER,
-                          IID_PPV_ARGS(&pPortableDeviceManager));
+    int idLen = MultiByteToWideChar(CP_UTF8, 0, pnpDeviceId.c_str(), (int) pnpDeviceId.size(), nullptr, 0);
+    std::wstring wideId(idLen, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, pnpDeviceId.c_str(), (int) pnpDeviceId.size(), &wideId[0], idLen);
+
+    // CoCreate the IPortableDevice interface and call Open() with the
+    // chosen PnPDeviceID string.
+    HRESULT hr = CoCreateInstance(CLSID_PortableDeviceFTM,
+                                  nullptr,
+                                  CLSCTX_INPROC_SERVER,
+                                  IID_PPV_ARGS(ppDevice));
     if (FAILED(hr)) {
-        printf("! Failed to CoCreateInstance CLSID_PortableDeviceManager, hr = 0x%lx\n",hr);
+        printf("! Failed to CoCreateInstance CLSID_PortableDeviceFTM, hr = 0x%lx\n", hr);
+        return;
+    }
+    // FORCE READ-ONLY, DO NOT WRITE
+    //pClientInformation->SetUnsignedIntegerValue(WPD_CLIENT_DESIRED_ACCESS, GENERIC_READ);
+    hr = (*ppDevice)->Open(wideId.c_str(), pClientInformation);
+    if (FAILED(hr)) {
+        printf("! Failed to Open the device, hr = 0x%lx\n", hr);
+        // Release the IPortableDevice interface, because we cannot proceed
+        // with an unopen device.
+        (*ppDevice)->Release();
+        *ppDevice = nullptr;
     }
-
-    if (SUCCEEDED(hr)) {
-        pPnpDeviceIDs = new (std::nothrow)PWSTR[cPnPDeviceIDs];
-        hr = pPortableDeviceManager->GetDevices(pPnpDeviceIDs, &cPnPDeviceIDs);
-        if (SUCCEEDED(hr)) {
-            // CoCreate the IPortableDevice interface and call Open() with
-        // the chosen PnPDeviceID string.
-            hr = CoCreateInstance(CLSID_PortableDeviceFTM,
-                nullptr,
-                CLSCTX_INPROC_SERVER,
-                IID_PPV_ARGS(ppDevice));
-            if (SUCCEEDED(hr)) {
-                // FORCE READ-ONLY, DO NOT WRITE
-                //pClientInformation->SetUnsignedIntegerValue(WPD_CLIENT_DESIRED_ACCESS, GENERIC_READ);
-                hr = (*ppDevice)->Open(pPnpDeviceIDs[uiCurrentDevice], pClientInformation);
-                if (FAILED(hr)) {
-                    printf("! Failed to Open the device, hr = 0x%lx\n", hr);
-                    // Release the IPortableDevice interface, because we cannot proceed
-                    // with an unopen device.
-                    (*ppDevice)->Release();
-                    *ppDevice = nullptr;
-                }
-            } else {
-                printf("! Failed to CoCreateInstance CLSID_PortableDeviceFTM, hr = 0x%lx\n", hr);
-            }
-        } else {
-            printf("! Failed to get the device list from the system, hr = 0x%lx\n", hr);
-        }
-
-        // Free all returned PnPDeviceID strings by using CoTaskMemFree.
-        // NOTE: CoTaskMemFree can handle nullptr pointers, so no nullptr
-        //       check is needed.
-        for (DWORD dwIndex = 0; dwIndex < cPnPDeviceIDs; dwIndex++) {
-            CoTaskMemFree(pPnpDeviceIDs[dwIndex]);
-            pPnpDeviceIDs[dwIndex] = nullptr;
-        }
-
-        // Delete the array of PWSTR pointers
-        delete[] pPnpDeviceIDs;
-        pPnpDeviceIDs = nullptr;
-        } else {
-            printf("! Failed to get the device list from the system, hr = 0x%lx\n", hr);
-        }
-        // If no devices were found on the system, just exit this function.
 }
 
 void UnregisterForEventNotifications(_In_opt_ IPortableDevice *device, _In_opt_ PCWSTR eventCookie) {
@@ -166,48 +137,70 @@ void UnregisterForEventNotifications(_In_opt_ IPortableDevice *device, _In_opt_
     }
 }
 
-// Recursively called function which enumerates using the specified
-// object identifier as the parent.
-void RecursiveEnumerate(_In_ PCWSTR objectID, _In_ IPortableDeviceContent* content, _In_ std::vector<std::string>* deviceObjectIds) {
-    CComPtr<IEnumPortableDeviceObjectIDs> enumObjectIDs;
-
-    // Get an IEnumPortableDeviceObjectIDs interface by calling EnumObjects with the
-    // specified parent object identifier.
-    HRESULT hr = content->EnumObjects(0,                // Flags are unused
-                                      objectID,         // Starting from the passed in object
-                                      nullptr,          // Filter is unused
-                                      &enumObjectIDs);
-    if (FAILED(hr)) {
-        wprintf(L"! Failed to get IEnumPortableDeviceObjectIDs from IPortableDeviceContent, hr = 0x%lx\n", hr);
+UINT32 WPDObjectTree::Add(PCWSTR objectId, UINT32 parent) {
+    size_t len = wcslen(objectId);
+    if (blockUsed + len + 1 > ARENA_BLOCK_CHARS) {
+        // IDs longer than a block get a block of their own
+        size_t blockChars = len + 1 > ARENA_BLOCK_CHARS ? len + 1 : ARENA_BLOCK_CHARS;
+        blocks.emplace_back(new WCHAR[blockChars]);
+        blockUsed = 0;
     }
+    WCHAR *dst = blocks.back().get() + blockUsed;
+    memcpy(dst, objectId, (len + 1) * sizeof(WCHAR));
+    blockUsed += len + 1;
+    nodes.push_back(WPDObjectNode{dst, (UINT32) len, parent});
+    return (UINT32) (nodes.size() - 1);
+}
 
-    // Loop calling Next() while S_OK is being returned.
-    while (hr == S_OK) {
-        DWORD  numFetched = 0;
-        PWSTR  objectIDArray[NUM_OBJECTS_TO_REQUEST] = {nullptr};
-        hr = enumObjectIDs->Next(NUM_OBJECTS_TO_REQUEST,    // Number of objects to request on each NEXT call
-                                 objectIDArray,             // Array of PWSTR array which will be populated on each NEXT call
-                                 &numFetched);              // Number of objects written to the PWSTR array
-        if (SUCCEEDED(hr)) {
-            // Traverse the results of the Next() operation and recursively enumerate
-            // Remember to free all returned object identifiers using CoTaskMemFree()
-            
-            for (DWORD index = 0; (index < numFetched) && (objectIDArray[index] != nullptr); index++) {
-                RecursiveEnumerate(objectIDArray[index], content, deviceObjectIds);
-                char tempId[8];
-                wcstombs(tempId, objectIDArray[index], 8);
-                deviceObjectIds->push_back(tempId);
-                // Free allocated PWSTRs after the recursive enumeration call has completed.
-                CoTaskMemFree(objectIDArray[index]);
-                objectIDArray[index] = nullptr;
+// Enumerates every object below the nodes already in the tree. Nodes are
+// expanded in the order they were added, so the tree itself is the work
+// queue and no recursion or per-level state is needed.
+HRESULT EnumerateObjects(_In_ IPortableDeviceContent* content, WPDObjectTree* tree) {
+    PWSTR objectIDArray[MAX_OBJECTS_TO_REQUEST] = {nullptr};
+    HRESULT hrResult = S_OK;
+
+    for (UINT32 nodeIndex = 0; nodeIndex < tree->Size(); nodeIndex++) {
+        CComPtr<IEnumPortableDeviceObjectIDs> enumObjectIDs;
+
+        // Get an IEnumPortableDeviceObjectIDs interface by calling EnumObjects with the
+        // specified parent object identifier.
+        HRESULT hr = content->EnumObjects(0,                                // Flags are unused
+                                          tree->At(nodeIndex).objectId,     // Starting from the queued object
+                                          nullptr,                          // Filter is unused
+                                          &enumObjectIDs);
+        if (FAILED(hr)) {
+            wprintf(L"! Failed to get IEnumPortableDeviceObjectIDs from IPortableDeviceContent, hr = 0x%lx\n", hr);
+            hrResult = hr;
+            continue;
+        }
+
+        // Loop calling Next() while S_OK is being returned.
+        DWORD numToRequest = MIN_OBJECTS_TO_REQUEST;
+        while (hr == S_OK) {
+            DWORD numFetched = 0;
+            hr = enumObjectIDs->Next(numToRequest,      // Number of objects to request on each NEXT call
+                                     objectIDArray,     // Array of PWSTR array which will be populated on each NEXT call
+                                     &numFetched);      // Number of objects written to the PWSTR array
+            if (SUCCEEDED(hr)) {
+                // Copy the IDs into the tree, then free all returned object
+                // identifiers using CoTaskMemFree()
+                for (DWORD index = 0; (index < numFetched) && (objectIDArray[index] != nullptr); index++) {
+                    tree->Add(objectIDArray[index], nodeIndex);
+                    CoTaskMemFree(objectIDArray[index]);
+                    objectIDArray[index] = nullptr;
+                }
+                if (numFetched == numToRequest && numToRequest < MAX_OBJECTS_TO_REQUEST) {
+                    numToRequest *= 2;
+                }
             }
         }
     }
+    return hrResult;
 }
 
 // Enumerate all content on the device starting with the
-// "DEVICE" object
-void GetAllContent(_In_ IPortableDevice* device, std::vector<std::string>* deviceObjectIds) {
+// "DEVICE" object, which becomes node 0 of the tree
+void GetAllContent(_In_ IPortableDevice* device, WPDObjectTree* tree) {
     HRESULT                         hr = S_OK;
     CComPtr<IPortableDeviceContent>  content;
 
@@ -220,8 +213,8 @@ void GetAllContent(_In_ IPortableDevice* device, std::vector<std::string>* devic
 
     // Enumerate content starting from the "DEVICE" object.
     if (SUCCEEDED(hr)) {
-        wprintf(L"\n");
-        RecursiveEnumerate(WPD_DEVICE_OBJECT_ID, content.Detach(), deviceObjectIds);
+        tree->Add(WPD_DEVICE_OBJECT_ID, WPD_NO_PARENT);
+        EnumerateObjects(content, tree);
     }
 }
 
@@ -306,13 +299,13 @@ std::vector<WPDevice> GetAllDevices() {
                 // For each device found, display the devices friendly name,
                 // manufacturer, and description strings.
                 for (dwIndex = 0; dwIndex < cPnPDeviceIDs; dwIndex++) {
-                    devices.push_back(
-                        WPDevice{
-                            "WPD",
-                            GetDeviceName(pPortableDeviceManager, pPnpDeviceIDs[dwIndex]), 
-                            pPnpDeviceIDs[dwIndex]
-                        }
-                    );
+                    // The PnP ID is the device's path, so it can be opened
+                    // again by ID after the strings are freed below
+                    PCWSTR id = pPnpDeviceIDs[dwIndex];
+                    int idLen = WideCharToMultiByte(CP_UTF8, 0, id, -1, nullptr, 0, nullptr, nullptr);
+                    std::string path(idLen > 0 ? idLen - 1 : 0, '\0');
+                    WideCharToMultiByte(CP_UTF8, 0, id, -1, &path[0], idLen, nullptr, nullptr);
+                    devices.push_back(WPDevice{path, GetDeviceName(pPortableDeviceManager, id)});
                 }
             } else {
                 printf("! Failed to get the device list from the system, hr = 0x%lx\n",hr);
@@ -391,68 +384,121 @@ HRESULT GetStringValue(IPortableDeviceProperties *pProperties,PCWSTR pszObjectID
     return hr;
 }
 
-// Copies data from a source stream to a destination stream using the
-// specified cbTransferSize as the temporary buffer size.
-HRESULT StreamCopy(IStream *pDestStream, IStream *pSourceStream, DWORD cbTransferSize, DWORD *pcbWritten) {
-    HRESULT hr = S_OK;
-
-    // Allocate a temporary buffer (of Optimal transfer size) for the read results to
-    // be written to.
-    BYTE *pObjectData = new (std::nothrow) BYTE[cbTransferSize];
-    if (pObjectData != nullptr) {
-        DWORD cbTotalBytesRead    = 0;
-        DWORD cbTotalBytesWritten = 0;
-
-        DWORD cbBytesRead    = 0;
-        DWORD cbBytesWritten = 0;
-
-        // Read until the number of bytes returned from the source stream is 0, or
-        // an error occured during transfer.
-        do {
-            // Read object data from the source stream
-            hr = pSourceStream->Read(pObjectData, cbTransferSize, &cbBytesRead);
-            if (FAILED(hr)) {
-                printf("! Failed to read %lu bytes from the source stream, hr = 0x%lx\n",cbTransferSize, hr);
-            }
-
-            // Write object data to the destination stream
-            if (SUCCEEDED(hr)) {
-                cbTotalBytesRead += cbBytesRead; // Calculating total bytes read from device for debugging purposes only
-
-                hr = pDestStream->Write(pObjectData, cbBytesRead, &cbBytesWritten);
-                if (FAILED(hr)) {
-                    printf("! Failed to write %lu bytes of object data to the destination stream, hr = 0x%lx\n",cbBytesRead, hr);
-                }
-
-                if (SUCCEEDED(hr)) {
-                    cbTotalBytesWritten += cbBytesWritten; // Calculating total bytes written to the file for debugging purposes only
-                }
-            }
+// Streams an object's default resource into a new file at dstPath and sets
+// *pChecksum (if not nullptr) to the XXH64 of what was written. Unless
+// overwrite is set an existing file is left alone and the call fails. The
+// data goes to a PARTIAL_FILE_SUFFIX file first and is renamed into place
+// once complete, so an interrupted transfer is never mistaken for a backup.
+HRESULT TransferObjectToFile(_In_ IPortableDeviceResources* pResources, _In_ PCWSTR objectID, _In_ PCWSTR dstPath,
+                             bool overwrite, StreamCopyEngine* engine, ULONGLONG* pcbWritten, uint64_t* pChecksum) {
+    CComPtr<IStream> pObjectDataStream;
+    CComPtr<IStream> pFinalFileStream;
+    DWORD            cbOptimalTransferSize = 0;
+
+    // Already backed up is the common case here, so stay quiet about it
+    if (!overwrite && GetFileAttributesW(dstPath) != INVALID_FILE_ATTRIBUTES) {
+        return HRESULT_FROM_WIN32(ERROR_FILE_EXISTS);
+    }
+    std::wstring partialPath = std::wstring(dstPath) + L"" PARTIAL_FILE_SUFFIX;
 
-            // Output Read/Write operation information only if we have received data and if no error has occured so far.
-            if (SUCCEEDED(hr) && (cbBytesRead > 0)) {
-                printf("Read %lu bytes from the source stream...Wrote %lu bytes to the destination stream...\n", cbBytesRead, cbBytesWritten);
-            }
+    HRESULT hr = pResources->GetStream(objectID,                // Identifier of the object we want to transfer
+                                       WPD_RESOURCE_DEFAULT,    // We are transferring the default resource (which is the entire object's data)
+                                       STGM_READ,               // Opening a stream in READ mode, because we are reading data from the device.
+                                       &cbOptimalTransferSize,  // Driver supplied optimal transfer size
+                                       &pObjectDataStream);
+    if (FAILED(hr)) {
+        wprintf(L"! Failed to get IStream for object '%ws', hr = 0x%lx\n", objectID, hr);
+        return hr;
+    }
 
-        } while (SUCCEEDED(hr) && (cbBytesRead > 0));
+    // A partial file left by an interrupted run is simply replaced
+    hr = SHCreateStreamOnFileEx(partialPath.c_str(),
+                                STGM_WRITE | STGM_SHARE_DENY_WRITE | STGM_CREATE,
+                                FILE_ATTRIBUTE_NORMAL,
+                                TRUE,                   // Create the file if it does not exist
+                                nullptr,
+                                &pFinalFileStream);
+    if (FAILED(hr)) {
+        wprintf(L"! Failed to create '%ws', hr = 0x%lx\n", partialPath.c_str(), hr);
+        return hr;
+    }
 
-        // If the caller supplied a pcbWritten parameter and we
-        // and we are successful, set it to cbTotalBytesWritten
-        // before exiting.
-        if ((SUCCEEDED(hr)) && (pcbWritten != nullptr)) {
-            *pcbWritten = cbTotalBytesWritten;
+    hr = engine->Copy(pFinalFileStream, pObjectDataStream, cbOptimalTransferSize, pcbWritten, pChecksum);
+    pFinalFileStream.Release();
+    if (FAILED(hr)) {
+        wprintf(L"! Failed to transfer object '%ws', hr = 0x%lx\n", objectID, hr);
+    } else if (!MoveFileExW(partialPath.c_str(), dstPath, overwrite ? MOVEFILE_REPLACE_EXISTING : 0)) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        if (hr != HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS)) {
+            wprintf(L"! Failed to rename '%ws' into place, hr = 0x%lx\n", partialPath.c_str(), hr);
         }
+    }
+    if (FAILED(hr)) {
+        DeleteFileW(partialPath.c_str());
+    }
+    return hr;
+}
 
-        // Remember to delete the temporary transfer buffer
-        delete [] pObjectData;
-        pObjectData = nullptr;
-    } else {
-        printf("! Failed to allocate %lu bytes for the temporary transfer buffer.\n", cbTransferSize);
+// Streams an object's default resource into data, replacing its contents.
+// Used for objects small enough to be packed rather than written out.
+HRESULT TransferObjectToMemory(_In_ IPortableDeviceResources* pResources, _In_ PCWSTR objectID,
+                               StreamCopyEngine* engine, std::vector<BYTE>* data) {
+    CComPtr<IStream> pObjectDataStream;
+    CComPtr<IStream> pMemoryStream;
+    DWORD            cbOptimalTransferSize = 0;
+    ULONGLONG        cbWritten = 0;
+
+    HRESULT hr = pResources->GetStream(objectID, WPD_RESOURCE_DEFAULT, STGM_READ,
+                                       &cbOptimalTransferSize, &pObjectDataStream);
+    if (FAILED(hr)) {
+        wprintf(L"! Failed to get IStream for object '%ws', hr = 0x%lx\n", objectID, hr);
+        return hr;
+    }
+    hr = CreateStreamOnHGlobal(nullptr, TRUE, &pMemoryStream);
+    if (SUCCEEDED(hr)) {
+        hr = engine->Copy(pMemoryStream, pObjectDataStream, cbOptimalTransferSize, &cbWritten);
+    }
+    if (FAILED(hr)) {
+        wprintf(L"! Failed to transfer object '%ws', hr = 0x%lx\n", objectID, hr);
+        return hr;
     }
 
+    HGLOBAL hGlobal = nullptr;
+    hr = GetHGlobalFromStream(pMemoryStream, &hGlobal);
+    if (SUCCEEDED(hr)) {
+        const BYTE *bytes = (const BYTE *) GlobalLock(hGlobal);
+        if (bytes == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        data->assign(bytes, bytes + cbWritten);
+        GlobalUnlock(hGlobal);
+    }
     return hr;
 }
 
+HRESULT ReadObjectHeader(_In_ IPortableDeviceResources* pResources, _In_ PCWSTR objectID,
+                         BYTE* buffer, ULONG bufferSize, ULONG* pcbRead) {
+    CComPtr<IStream> pObjectDataStream;
+    DWORD            cbOptimalTransferSize = 0;
+
+    *pcbRead = 0;
+    HRESULT hr = pResources->GetStream(objectID, WPD_RESOURCE_DEFAULT, STGM_READ,
+                                       &cbOptimalTransferSize, &pObjectDataStream);
+    if (FAILED(hr)) {
+        return hr;
+    }
+    // Drivers may return fewer bytes than asked for before the end
+    while (SUCCEEDED(hr) && *pcbRead < bufferSize) {
+        ULONG cbRead = 0;
+        hr = pObjectDataStream->Read(buffer + *pcbRead, bufferSize - *pcbRead, &cbRead);
+        if (cbRead == 0) {
+            break;
+        }
+        *pcbRead += cbRead;
+    }
+    return *pcbRead > 0 ? S_OK : hr;
+}
+
 void TransferContentFromDevice(IPortableDevice* pDevice) {
     HRESULT                            hr                   = S_OK;
     WCHAR                              szSelection[81]      = {0};
@@ -537,14 +583,16 @@ void TransferContentFromDevice(IPortableDevice* pDevice) {
     // 6) Read on the object's data stream and write to the final file's data stream using the
     // driver supplied optimal transfer buffer size.
     if (SUCCEEDED(hr)) {
-        DWORD cbTotalBytesWritten = 0;
-
-        // Since we have IStream-compatible interfaces, call our helper function
-        // that copies the contents of a source stream into a destination stream.
-        hr = StreamCopy(pFinalFileStream,       // Destination (The Final File to transfer to)
-                        pObjectDataStream,      // Source (The Object's data to transfer from)
-                        cbOptimalTransferSize,  // The driver specified optimal transfer buffer size
-                        &cbTotalBytesWritten);  // The total number of bytes transferred from device to the finished file
+        ULONGLONG        cbTotalBytesWritten = 0;
+        TransferCounters counters;
+        StreamCopyEngine engine(&counters);
+
+        // Since we have IStream-compatible interfaces, use the copy engine, which
+        // overlaps reads from the device with writes to the destination stream.
+        hr = engine.Copy(pFinalFileStream,       // Destination (The Final File to transfer to)
+                         pObjectDataStream,      // Source (The Object's data to transfer from)
+                         cbOptimalTransferSize,  // The driver specified optimal transfer buffer size
+                         &cbTotalBytesWritten);  // The total number of bytes transferred from device to the finished file
         if (FAILED(hr)) {
             printf("! Failed to transfer object from device, hr = 0x%lx\n",hr);
         } else {
@@ -1,18 +1,57 @@
+#pragma once
+
 #include "common.h"
 
+#define WPD_NO_PARENT   ((UINT32) -1)
+
+class StreamCopyEngine;
+
+struct WPDObjectNode {
+    PCWSTR objectId;    // NUL-terminated, owned by the tree's arena
+    UINT32 idLen;
+    UINT32 parent;      // index of the parent node, WPD_NO_PARENT for the root
+};
+
+// Flat parent-indexed tree of every object on a device. Object IDs are
+// copied once into fixed-size arena blocks, so node pointers stay valid as
+// the tree grows and memory is bounded by the IDs themselves.
+class WPDObjectTree {
+public:
+    UINT32 Add(PCWSTR objectId, UINT32 parent);
+
+    size_t Size() const { return nodes.size(); }
+    const WPDObjectNode &At(size_t index) const { return nodes[index]; }
+    std::wstring_view ObjectId(size_t index) const { return std::wstring_view(nodes[index].objectId, nodes[index].idLen); }
+    size_t ArenaBytes() const { return blocks.size() * ARENA_BLOCK_CHARS * sizeof(WCHAR); }
+
+private:
+    static const size_t ARENA_BLOCK_CHARS = 64 * 1024;
+
+    std::vector<WPDObjectNode> nodes;
+    std::vector<std::unique_ptr<WCHAR[]>> blocks;
+    size_t blockUsed = ARENA_BLOCK_CHARS;
+};
+
 bool wpdInitialize();
 void wpdUninitialize();
 
 void GetClientInformation(IPortableDeviceValues** ppClientInformation);
-void ChooseDevice(IPortableDevice** ppDevice, UINT uiCurrentDevice, DWORD cPnPDeviceIDs);
+void OpenDevice(IPortableDevice** ppDevice, const std::string &pnpDeviceId);
 void UnregisterForEventNotifications(_In_opt_ IPortableDevice *device, _In_opt_ PCWSTR eventCookie);
 
-void RecursiveEnumerate(_In_ PCWSTR objectID, _In_ IPortableDeviceContent* content, std::vector<std::string>* deviceObjectIds);
-void GetAllContent(_In_ IPortableDevice* device, std::vector<std::string>* deviceObjectIds);
+HRESULT EnumerateObjects(_In_ IPortableDeviceContent* content, WPDObjectTree* tree);
+void GetAllContent(_In_ IPortableDevice* device, WPDObjectTree* tree);
 
 std::string GetDeviceName(IPortableDeviceManager *pPortableDeviceManager, PCWSTR pPnPDeviceID);
 std::vector<WPDevice> GetAllDevices();
 
 HRESULT GetStringValue(IPortableDeviceProperties *pProperties,PCWSTR pszObjectID, REFPROPERTYKEY key,CAtlStringW &strStringValue);
-HRESULT StreamCopy(IStream *pDestStream, IStream *pSourceStream, DWORD cbTransferSize, DWORD *pcbWritten);
+HRESULT TransferObjectToFile(_In_ IPortableDeviceResources* pResources, _In_ PCWSTR objectID, _In_ PCWSTR dstPath,
+                             bool overwrite, StreamCopyEngine* engine, ULONGLONG* pcbWritten, uint64_t* pChecksum);
+HRESULT TransferObjectToMemory(_In_ IPortableDeviceResources* pResources, _In_ PCWSTR objectID,
+                               StreamCopyEngine* engine, std::vector<BYTE>* data);
+// Reads at most bufferSize bytes from the start of the object, for header
+// parsing without transferring the whole object.
+HRESULT ReadObjectHeader(_In_ IPortableDeviceResources* pResources, _In_ PCWSTR objectID,
+                         BYTE* buffer, ULONG bufferSize, ULONG* pcbRead);
 void TransferContentFromDevice(IPortableDevice* pDevice);
\ No newline at end of file
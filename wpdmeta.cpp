@@ -0,0 +1,280 @@
+#include "wpdmeta.h"
+
+static const PROPERTYKEY METADATA_KEYS[] = {
+    WPD_OBJECT_ORIGINAL_FILE_NAME,
+    WPD_OBJECT_SIZE,
+    WPD_OBJECT_CONTENT_TYPE,
+    WPD_OBJECT_DATE_CREATED,
+    WPD_OBJECT_DATE_MODIFIED,
+    WPD_OBJECT_PERSISTENT_UNIQUE_ID
+};
+
+// Converts a VT_DATE property to FILETIME units, or 0 if it is missing.
+static ULONGLONG GetDateValue(IPortableDeviceValues *pValues, REFPROPERTYKEY key) {
+    PROPVARIANT pv;
+    PropVariantInit(&pv);
+    ULONGLONG result = 0;
+    if (SUCCEEDED(pValues->GetValue(key, &pv)) && pv.vt == VT_DATE) {
+        SYSTEMTIME sysTime;
+        FILETIME fileTime;
+        if (VariantTimeToSystemTime(pv.date, &sysTime) && SystemTimeToFileTime(&sysTime, &fileTime)) {
+            result = ((ULONGLONG) fileTime.dwHighDateTime << 32) | fileTime.dwLowDateTime;
+        }
+    }
+    PropVariantClear(&pv);
+    return result;
+}
+
+void WPDObjectTable::Reserve(size_t numObjects) {
+    records.reserve(numObjects);
+    // Names and PUIDs are typically a few dozen characters each
+    pool.reserve(numObjects * 64);
+}
+
+UINT32 WPDObjectTable::Intern(PCWSTR str, UINT32 *len) {
+    UINT32 offset = (UINT32) pool.size();
+    *len = 0;
+    if (str != nullptr) {
+        *len = (UINT32) wcslen(str);
+        pool.append(str, *len);
+    }
+    return offset;
+}
+
+// Appends one object's property values. Missing properties are left zeroed
+// rather than failing the object, since drivers differ in what they report.
+void WPDObjectTable::Add(IPortableDeviceValues *pValues, UINT32 node) {
+    WPDObjectRecord record = {};
+    PWSTR pszValue = nullptr;
+
+    record.node = node;
+    if (SUCCEEDED(pValues->GetStringValue(WPD_OBJECT_ORIGINAL_FILE_NAME, &pszValue))) {
+        record.nameOffset = Intern(pszValue, &record.nameLen);
+        CoTaskMemFree(pszValue);
+        pszValue = nullptr;
+    }
+    if (SUCCEEDED(pValues->GetStringValue(WPD_OBJECT_PERSISTENT_UNIQUE_ID, &pszValue))) {
+        record.puidOffset = Intern(pszValue, &record.puidLen);
+        CoTaskMemFree(pszValue);
+        pszValue = nullptr;
+    }
+    pValues->GetGuidValue(WPD_OBJECT_CONTENT_TYPE, &record.contentType);
+    pValues->GetUnsignedLargeIntegerValue(WPD_OBJECT_SIZE, &record.sizeBytes);
+    record.dateCreated = GetDateValue(pValues, WPD_OBJECT_DATE_CREATED);
+    record.dateModified = GetDateValue(pValues, WPD_OBJECT_DATE_MODIFIED);
+    records.push_back(record);
+}
+
+typedef std::unordered_map<std::wstring_view, UINT32> NodeIndex;
+
+// Receives batches of results from IPortableDevicePropertiesBulk, matches them
+// back to tree nodes by object ID and signals completeEvent once the driver
+// reports the operation has ended.
+class CGetBulkValuesCallback : public IPortableDevicePropertiesBulkCallback {
+public:
+    CGetBulkValuesCallback(WPDObjectTable *table, const NodeIndex *nodeIndex, HANDLE completeEvent) :
+        m_cRef(1), m_pTable(table), m_pNodeIndex(nodeIndex), m_hCompleteEvent(completeEvent), m_hrStatus(S_OK) {}
+
+    HRESULT __stdcall QueryInterface(REFIID riid, LPVOID *ppvObj) {
+        if (ppvObj == nullptr) {
+            return E_INVALIDARG;
+        }
+        if ((riid == IID_IUnknown) || (riid == IID_IPortableDevicePropertiesBulkCallback)) {
+            AddRef();
+            *ppvObj = this;
+            return S_OK;
+        }
+        *ppvObj = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG __stdcall AddRef() {
+        return InterlockedIncrement((long*) &m_cRef);
+    }
+
+    ULONG __stdcall Release() {
+        ULONG ulRefCount = InterlockedDecrement((long*) &m_cRef);
+        if (ulRefCount == 0) {
+            delete this;
+        }
+        return ulRefCount;
+    }
+
+    HRESULT __stdcall OnStart(REFGUID Context) {
+        return S_OK;
+    }
+
+    HRESULT __stdcall OnProgress(REFGUID Context, IPortableDeviceValuesCollection* pResultValues) {
+        DWORD cValues = 0;
+        HRESULT hr = pResultValues->GetCount(&cValues);
+        for (DWORD dwIndex = 0; SUCCEEDED(hr) && dwIndex < cValues; dwIndex++) {
+            CComPtr<IPortableDeviceValues> pValues;
+            hr = pResultValues->GetAt(dwIndex, &pValues);
+            PWSTR pszObjectID = nullptr;
+            if (SUCCEEDED(hr) && SUCCEEDED(pValues->GetStringValue(WPD_OBJECT_ID, &pszObjectID))) {
+                auto it = m_pNodeIndex->find(pszObjectID);
+                if (it != m_pNodeIndex->end()) {
+                    m_pTable->Add(pValues, it->second);
+                }
+                CoTaskMemFree(pszObjectID);
+            }
+        }
+        return hr;
+    }
+
+    HRESULT __stdcall OnEnd(REFGUID Context, HRESULT hrStatus) {
+        m_hrStatus = hrStatus;
+        SetEvent(m_hCompleteEvent);
+        return S_OK;
+    }
+
+    HRESULT Status() const {
+        return m_hrStatus;
+    }
+
+private:
+    ULONG           m_cRef;
+    WPDObjectTable* m_pTable;
+    const NodeIndex* m_pNodeIndex;
+    HANDLE          m_hCompleteEvent;
+    HRESULT         m_hrStatus;
+};
+
+static HRESULT FetchBulk(IPortableDeviceProperties *pProperties, IPortableDeviceKeyCollection *pKeys,
+                         const WPDObjectTree *tree, WPDObjectTable *table) {
+    CComPtr<IPortableDevicePropertiesBulk>      pPropertiesBulk;
+    CComPtr<IPortableDevicePropVariantCollection> pObjectIDs;
+    GUID                                        context = GUID_NULL;
+
+    HRESULT hr = pProperties->QueryInterface(IID_PPV_ARGS(&pPropertiesBulk));
+    if (FAILED(hr)) {
+        // Not an error: plenty of drivers only implement per-object reads
+        return hr;
+    }
+
+    hr = CoCreateInstance(CLSID_PortableDevicePropVariantCollection,
+                          nullptr,
+                          CLSCTX_INPROC_SERVER,
+                          IID_PPV_ARGS(&pObjectIDs));
+    if (FAILED(hr)) {
+        printf("! Failed to CoCreateInstance CLSID_PortableDevicePropVariantCollection, hr = 0x%lx\n", hr);
+        return hr;
+    }
+
+    // Add() copies the value, so each PROPVARIANT can borrow the ID string
+    // straight from the tree. Node 0 is the device object itself.
+    NodeIndex nodeIndex;
+    nodeIndex.reserve(tree->Size());
+    for (UINT32 node = 1; node < tree->Size(); node++) {
+        nodeIndex.emplace(tree->ObjectId(node), node);
+        PROPVARIANT pv;
+        PropVariantInit(&pv);
+        pv.vt = VT_LPWSTR;
+        pv.pwszVal = const_cast<PWSTR>(tree->At(node).objectId);
+        hr = pObjectIDs->Add(&pv);
+        if (FAILED(hr)) {
+            printf("! Failed to add object ID to IPortableDevicePropVariantCollection, hr = 0x%lx\n", hr);
+            return hr;
+        }
+    }
+
+    HANDLE completeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (completeEvent == nullptr) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    CGetBulkValuesCallback *pCallback = new (std::nothrow) CGetBulkValuesCallback(table, &nodeIndex, completeEvent);
+    if (pCallback == nullptr) {
+        CloseHandle(completeEvent);
+        return E_OUTOFMEMORY;
+    }
+
+    hr = pPropertiesBulk->QueueGetValuesByObjectList(pObjectIDs, pKeys, pCallback, &context);
+    if (SUCCEEDED(hr)) {
+        hr = pPropertiesBulk->Start(context);
+        if (SUCCEEDED(hr)) {
+            WaitForSingleObject(completeEvent, INFINITE);
+            hr = pCallback->Status();
+        } else {
+            printf("! Failed to start bulk property operation, hr = 0x%lx\n", hr);
+        }
+    } else {
+        printf("! QueueGetValuesByObjectList failed, hr = 0x%lx\n", hr);
+    }
+
+    pCallback->Release();
+    CloseHandle(completeEvent);
+    return hr;
+}
+
+// Nodes already flagged in fetched (if given) are skipped.
+static HRESULT FetchPerObject(IPortableDeviceProperties *pProperties, IPortableDeviceKeyCollection *pKeys,
+                              const WPDObjectTree *tree, WPDObjectTable *table,
+                              const std::vector<bool> *fetched = nullptr) {
+    // The key collection is built once by the caller and reused, so each
+    // object costs exactly one GetValues round-trip.
+    for (UINT32 node = 1; node < tree->Size(); node++) {
+        if (fetched != nullptr && (*fetched)[node]) {
+            continue;
+        }
+        CComPtr<IPortableDeviceValues> pValues;
+        HRESULT hr = pProperties->GetValues(tree->At(node).objectId, pKeys, &pValues);
+        if (SUCCEEDED(hr)) {
+            table->Add(pValues, node);
+        } else {
+            wprintf(L"! Failed to read properties of object '%ws', hr = 0x%lx\n", tree->At(node).objectId, hr);
+        }
+    }
+    return S_OK;
+}
+
+HRESULT FetchObjectMetadata(_In_ IPortableDevice* device, const WPDObjectTree* tree, WPDObjectTable* table) {
+    CComPtr<IPortableDeviceContent>       pContent;
+    CComPtr<IPortableDeviceProperties>    pProperties;
+    CComPtr<IPortableDeviceKeyCollection> pKeys;
+
+    HRESULT hr = device->Content(&pContent);
+    if (FAILED(hr)) {
+        printf("! Failed to get IPortableDeviceContent from IPortableDevice, hr = 0x%lx\n", hr);
+        return hr;
+    }
+    hr = pContent->Properties(&pProperties);
+    if (FAILED(hr)) {
+        printf("! Failed to get IPortableDeviceProperties from IPortableDeviceContent, hr = 0x%lx\n", hr);
+        return hr;
+    }
+
+    hr = CoCreateInstance(CLSID_PortableDeviceKeyCollection,
+                          nullptr,
+                          CLSCTX_INPROC_SERVER,
+                          IID_PPV_ARGS(&pKeys));
+    if (FAILED(hr)) {
+        printf("! Failed to CoCreateInstance CLSID_PortableDeviceKeyCollection, hr = 0x%lx\n", hr);
+        return hr;
+    }
+    for (const PROPERTYKEY &key : METADATA_KEYS) {
+        HRESULT hrTemp = pKeys->Add(key);
+        if (FAILED(hrTemp)) {
+            printf("! Failed to add PROPERTYKEY to IPortableDeviceKeyCollection, hr= 0x%lx\n", hrTemp);
+        }
+    }
+
+    table->Reserve(tree->Size());
+    hr = FetchBulk(pProperties, pKeys, tree, table);
+    if (FAILED(hr)) {
+        // Drop any partial bulk results before refetching everything
+        *table = WPDObjectTable(tree);
+        table->Reserve(tree->Size());
+        hr = FetchPerObject(pProperties, pKeys, tree, table);
+    } else if (table->Size() + 1 < tree->Size()) {
+        // The operation succeeded but the driver left some objects out of
+        // its results; read just those one at a time
+        std::vector<bool> fetched(tree->Size(), false);
+        for (size_t i = 0; i < table->Size(); i++) {
+            fetched[table->At(i).node] = true;
+        }
+        printf("! Bulk property read returned %zu of %zu objects, reading the rest individually\n",
+               table->Size(), tree->Size() - 1);
+        hr = FetchPerObject(pProperties, pKeys, tree, table, &fetched);
+    }
+    return hr;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "wpd.h"
+
+// Metadata for one device object. The object ID is referenced by its node in
+// the enumerated tree and other strings live in the owning table's pool, so
+// records stay small and trivially copyable.
+struct WPDObjectRecord {
+    UINT32    node;
+    UINT32    nameOffset;
+    UINT32    nameLen;
+    UINT32    puidOffset;
+    UINT32    puidLen;
+    GUID      contentType;
+    ULONGLONG sizeBytes;
+    ULONGLONG dateCreated;      // FILETIME units, 0 if the driver did not report it
+    ULONGLONG dateModified;
+};
+
+class WPDObjectTable {
+public:
+    explicit WPDObjectTable(const WPDObjectTree *tree) : tree(tree) {}
+
+    void Reserve(size_t numObjects);
+    void Add(IPortableDeviceValues *pValues, UINT32 node);
+
+    size_t Size() const { return records.size(); }
+    const WPDObjectRecord &At(size_t index) const { return records[index]; }
+    std::wstring_view ObjectId(size_t index) const { return tree->ObjectId(records[index].node); }
+    PCWSTR ObjectIdCStr(size_t index) const { return tree->At(records[index].node).objectId; }
+    std::wstring_view Name(size_t index) const { return Str(records[index].nameOffset, records[index].nameLen); }
+    std::wstring_view PersistentId(size_t index) const { return Str(records[index].puidOffset, records[index].puidLen); }
+
+private:
+    std::wstring_view Str(UINT32 offset, UINT32 len) const { return std::wstring_view(pool.data() + offset, len); }
+    UINT32 Intern(PCWSTR str, UINT32 *len);
+
+    const WPDObjectTree *tree;
+    std::vector<WPDObjectRecord> records;
+    std::wstring pool;
+};
+
+// Fetches name, size, content type, dates and persistent ID for every object
+// below the tree's root. Uses IPortableDevicePropertiesBulk so the driver can
+// stream all results in one pass, falling back to one GetValues call per
+// object (with every key requested at once) when the driver does not support it,
+// and for any objects a bulk read that reported success left out.
+HRESULT FetchObjectMetadata(_In_ IPortableDevice* device, const WPDObjectTree* tree, WPDObjectTable* table);